@@ -54,6 +54,8 @@ void UsageFault_Handler(void);
 void DebugMon_Handler(void);
 void USART3_IRQHandler(void);
 void TIM6_DAC_IRQHandler(void);
+void DMA2_Stream7_IRQHandler(void);
+void QUADSPI_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
 /* USER CODE END EFP */
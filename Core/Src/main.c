@@ -43,6 +43,7 @@
 /* Private variables ---------------------------------------------------------*/
 
 QSPI_HandleTypeDef hqspi;
+DMA_HandleTypeDef hdma_quadspi;
 
 UART_HandleTypeDef huart3;
 
@@ -67,6 +68,7 @@ const osMessageQueueAttr_t cmdParamQueue_attributes = {.name = "cmdParamQueue"};
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART3_UART_Init(void);
 static void MX_USB_OTG_FS_PCD_Init(void);
 static void MX_QUADSPI_Init(void);
@@ -109,6 +111,7 @@ int main(void)
 
     /* Initialize all configured peripherals */
     MX_GPIO_Init();
+    MX_DMA_Init();
     MX_USART3_UART_Init();
     MX_USB_OTG_FS_PCD_Init();
     MX_QUADSPI_Init();
@@ -120,6 +123,7 @@ int main(void)
 
     /* USER CODE BEGIN RTOS_MUTEX */
     /* add mutexes, ... */
+    W25N04KV_InitBus(); // Create the mutex giving one task at a time the QSPI bus
     /* USER CODE END RTOS_MUTEX */
 
     /* USER CODE BEGIN RTOS_SEMAPHORES */
@@ -147,6 +151,9 @@ int main(void)
 
     /* USER CODE BEGIN RTOS_THREADS */
     xTaskCreate(W25N04KV_InitCLI, "CLI", 2048 * 4, NULL, osPriorityNormal, NULL); // Create the CLI task
+    xTaskCreate(W25N04KV_LogErrors, "ErrorLog", 256, NULL, osPriorityLow, NULL); // Create the error logger task
+    xTaskCreate(W25N04KV_ManageFlash, "FlashManager", 512, NULL, osPriorityHigh, NULL); // Create the manager task
+    xTaskCreate(W25N04KV_EraseAhead, "EraseAhead", 256, NULL, osPriorityLow, NULL); // Create the erase-ahead task
     /* add threads, ... */
     /* USER CODE END RTOS_THREADS */
 
@@ -327,6 +334,21 @@ static void MX_USB_OTG_FS_PCD_Init(void)
     /* USER CODE END USB_OTG_FS_Init 2 */
 }
 
+/**
+ * Enable DMA controller clock
+ */
+static void MX_DMA_Init(void)
+{
+
+    /* DMA controller clock enable */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    /* DMA interrupt init */
+    /* DMA2_Stream7_IRQn interrupt configuration */
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+}
+
 /**
  * @brief GPIO Initialization Function
  * @param None
@@ -6,20 +6,68 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../Flash-W25N04KV/src/cli.c \
+../Flash-W25N04KV/src/flash-ahead.c \
+../Flash-W25N04KV/src/flash-bbm.c \
+../Flash-W25N04KV/src/flash-bbt.c \
+../Flash-W25N04KV/src/flash-circular.c \
+../Flash-W25N04KV/src/flash-commands.c \
+../Flash-W25N04KV/src/flash-copy.c \
+../Flash-W25N04KV/src/flash-dirty.c \
+../Flash-W25N04KV/src/flash-dma.c \
+../Flash-W25N04KV/src/flash-ecc.c \
+../Flash-W25N04KV/src/flash-ftl.c \
+../Flash-W25N04KV/src/flash-log.c \
+../Flash-W25N04KV/src/flash-manager.c \
 ../Flash-W25N04KV/src/flash-qspi.c \
 ../Flash-W25N04KV/src/flash-spi.c \
+../Flash-W25N04KV/src/flash-super.c \
+../Flash-W25N04KV/src/flash-tune.c \
+../Flash-W25N04KV/src/flash-wear.c \
+../Flash-W25N04KV/src/flash-writer.c \
 ../Flash-W25N04KV/src/tests.c 
 
 OBJS += \
 ./Flash-W25N04KV/src/cli.o \
+./Flash-W25N04KV/src/flash-ahead.o \
+./Flash-W25N04KV/src/flash-bbm.o \
+./Flash-W25N04KV/src/flash-bbt.o \
+./Flash-W25N04KV/src/flash-circular.o \
+./Flash-W25N04KV/src/flash-commands.o \
+./Flash-W25N04KV/src/flash-copy.o \
+./Flash-W25N04KV/src/flash-dirty.o \
+./Flash-W25N04KV/src/flash-dma.o \
+./Flash-W25N04KV/src/flash-ecc.o \
+./Flash-W25N04KV/src/flash-ftl.o \
+./Flash-W25N04KV/src/flash-log.o \
+./Flash-W25N04KV/src/flash-manager.o \
 ./Flash-W25N04KV/src/flash-qspi.o \
 ./Flash-W25N04KV/src/flash-spi.o \
+./Flash-W25N04KV/src/flash-super.o \
+./Flash-W25N04KV/src/flash-tune.o \
+./Flash-W25N04KV/src/flash-wear.o \
+./Flash-W25N04KV/src/flash-writer.o \
 ./Flash-W25N04KV/src/tests.o 
 
 C_DEPS += \
 ./Flash-W25N04KV/src/cli.d \
+./Flash-W25N04KV/src/flash-ahead.d \
+./Flash-W25N04KV/src/flash-bbm.d \
+./Flash-W25N04KV/src/flash-bbt.d \
+./Flash-W25N04KV/src/flash-circular.d \
+./Flash-W25N04KV/src/flash-commands.d \
+./Flash-W25N04KV/src/flash-copy.d \
+./Flash-W25N04KV/src/flash-dirty.d \
+./Flash-W25N04KV/src/flash-dma.d \
+./Flash-W25N04KV/src/flash-ecc.d \
+./Flash-W25N04KV/src/flash-ftl.d \
+./Flash-W25N04KV/src/flash-log.d \
+./Flash-W25N04KV/src/flash-manager.d \
 ./Flash-W25N04KV/src/flash-qspi.d \
 ./Flash-W25N04KV/src/flash-spi.d \
+./Flash-W25N04KV/src/flash-super.d \
+./Flash-W25N04KV/src/flash-tune.d \
+./Flash-W25N04KV/src/flash-wear.d \
+./Flash-W25N04KV/src/flash-writer.d \
 ./Flash-W25N04KV/src/tests.d 
 
 
@@ -30,7 +78,7 @@ Flash-W25N04KV/src/%.o Flash-W25N04KV/src/%.su Flash-W25N04KV/src/%.cyclo: ../Fl
 clean: clean-Flash-2d-W25N04KV-2f-src
 
 clean-Flash-2d-W25N04KV-2f-src:
-	-$(RM) ./Flash-W25N04KV/src/cli.cyclo ./Flash-W25N04KV/src/cli.d ./Flash-W25N04KV/src/cli.o ./Flash-W25N04KV/src/cli.su ./Flash-W25N04KV/src/flash-qspi.cyclo ./Flash-W25N04KV/src/flash-qspi.d ./Flash-W25N04KV/src/flash-qspi.o ./Flash-W25N04KV/src/flash-qspi.su ./Flash-W25N04KV/src/flash-spi.cyclo ./Flash-W25N04KV/src/flash-spi.d ./Flash-W25N04KV/src/flash-spi.o ./Flash-W25N04KV/src/flash-spi.su ./Flash-W25N04KV/src/tests.cyclo ./Flash-W25N04KV/src/tests.d ./Flash-W25N04KV/src/tests.o ./Flash-W25N04KV/src/tests.su
+	-$(RM) ./Flash-W25N04KV/src/cli.cyclo ./Flash-W25N04KV/src/cli.d ./Flash-W25N04KV/src/cli.o ./Flash-W25N04KV/src/cli.su ./Flash-W25N04KV/src/flash-ahead.cyclo ./Flash-W25N04KV/src/flash-ahead.d ./Flash-W25N04KV/src/flash-ahead.o ./Flash-W25N04KV/src/flash-ahead.su ./Flash-W25N04KV/src/flash-bbm.cyclo ./Flash-W25N04KV/src/flash-bbm.d ./Flash-W25N04KV/src/flash-bbm.o ./Flash-W25N04KV/src/flash-bbm.su ./Flash-W25N04KV/src/flash-bbt.cyclo ./Flash-W25N04KV/src/flash-bbt.d ./Flash-W25N04KV/src/flash-bbt.o ./Flash-W25N04KV/src/flash-bbt.su ./Flash-W25N04KV/src/flash-circular.cyclo ./Flash-W25N04KV/src/flash-circular.d ./Flash-W25N04KV/src/flash-circular.o ./Flash-W25N04KV/src/flash-circular.su ./Flash-W25N04KV/src/flash-commands.cyclo ./Flash-W25N04KV/src/flash-commands.d ./Flash-W25N04KV/src/flash-commands.o ./Flash-W25N04KV/src/flash-commands.su ./Flash-W25N04KV/src/flash-copy.cyclo ./Flash-W25N04KV/src/flash-copy.d ./Flash-W25N04KV/src/flash-copy.o ./Flash-W25N04KV/src/flash-copy.su ./Flash-W25N04KV/src/flash-dirty.cyclo ./Flash-W25N04KV/src/flash-dirty.d ./Flash-W25N04KV/src/flash-dirty.o ./Flash-W25N04KV/src/flash-dirty.su ./Flash-W25N04KV/src/flash-dma.cyclo ./Flash-W25N04KV/src/flash-dma.d ./Flash-W25N04KV/src/flash-dma.o ./Flash-W25N04KV/src/flash-dma.su ./Flash-W25N04KV/src/flash-ecc.cyclo ./Flash-W25N04KV/src/flash-ecc.d ./Flash-W25N04KV/src/flash-ecc.o ./Flash-W25N04KV/src/flash-ecc.su ./Flash-W25N04KV/src/flash-ftl.cyclo ./Flash-W25N04KV/src/flash-ftl.d ./Flash-W25N04KV/src/flash-ftl.o ./Flash-W25N04KV/src/flash-ftl.su ./Flash-W25N04KV/src/flash-log.cyclo ./Flash-W25N04KV/src/flash-log.d ./Flash-W25N04KV/src/flash-log.o ./Flash-W25N04KV/src/flash-log.su ./Flash-W25N04KV/src/flash-manager.cyclo ./Flash-W25N04KV/src/flash-manager.d ./Flash-W25N04KV/src/flash-manager.o ./Flash-W25N04KV/src/flash-manager.su ./Flash-W25N04KV/src/flash-qspi.cyclo ./Flash-W25N04KV/src/flash-qspi.d ./Flash-W25N04KV/src/flash-qspi.o ./Flash-W25N04KV/src/flash-qspi.su ./Flash-W25N04KV/src/flash-spi.cyclo ./Flash-W25N04KV/src/flash-spi.d ./Flash-W25N04KV/src/flash-spi.o ./Flash-W25N04KV/src/flash-spi.su ./Flash-W25N04KV/src/flash-super.cyclo ./Flash-W25N04KV/src/flash-super.d ./Flash-W25N04KV/src/flash-super.o ./Flash-W25N04KV/src/flash-super.su ./Flash-W25N04KV/src/flash-tune.cyclo ./Flash-W25N04KV/src/flash-tune.d ./Flash-W25N04KV/src/flash-tune.o ./Flash-W25N04KV/src/flash-tune.su ./Flash-W25N04KV/src/flash-wear.cyclo ./Flash-W25N04KV/src/flash-wear.d ./Flash-W25N04KV/src/flash-wear.o ./Flash-W25N04KV/src/flash-wear.su ./Flash-W25N04KV/src/flash-writer.cyclo ./Flash-W25N04KV/src/flash-writer.d ./Flash-W25N04KV/src/flash-writer.o ./Flash-W25N04KV/src/flash-writer.su ./Flash-W25N04KV/src/tests.cyclo ./Flash-W25N04KV/src/tests.d ./Flash-W25N04KV/src/tests.o ./Flash-W25N04KV/src/tests.su
 
 .PHONY: clean-Flash-2d-W25N04KV-2f-src
 
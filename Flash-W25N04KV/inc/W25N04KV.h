@@ -23,8 +23,62 @@
 #endif
 
 // Constants
-#define COM_TIMEOUT 100   /* Timeout to use for all communications (in ms) */
-#define MAX_CMD_LENGTH 64 /* Maximum command length for CLI, arbitrarily chosen */
+#define COM_TIMEOUT 100            /* Timeout to use for all communications (in ms) */
+#define MAX_CMD_LENGTH 64          /* Maximum command length for CLI, arbitrarily chosen */
+#define USE_AUTO_POLLING 1         /* Wait on the BUSY bit with QSPI auto-polling instead of spinning (0 to disable) */
+#define AUTO_POLL_INTERVAL 0x100   /* QSPI clock cycles between status register reads during auto-polling */
+#define BUSY_TIMEOUT 50            /* Maximum time to wait for the BUSY bit to clear (in ms), above max tBE of 10ms */
+#define PAGE_SIZE 2048             /* Size of the main area of each page (in bytes) */
+#define SPARE_SIZE 128             /* Size of the spare area following the main area of each page (in bytes) */
+#define MAPPED_CS_TIMEOUT 0x20     /* Idle QSPI clock cycles before chip select is released in memory-mapped mode */
+#define CONTINUOUS_DUMMY_CLOCKS 16 /* Dummy clocks after the ignored column address of reads in continuous mode */
+#define BUF_BIT (1 << 3)           /* BUF bit of register 2, set for buffer read mode and cleared for continuous mode */
+#define TUNE_BLOCK 4095            /* Block reserved for the QSPI clock calibration pattern and its persisted result */
+#define TUNE_PASSES 16             /* Matching reads of the calibration pattern needed for a clock setting to pass */
+#define TUNE_SLOWEST_PRESCALER 3   /* QSPI prescaler set by MX_QUADSPI_Init, 216MHz / (3 + 1) = 54MHz, always safe */
+#define TUNE_FASTEST_PRESCALER 2   /* Fastest QSPI prescaler tried, 72MHz (1 gives 108MHz, above the flash rating) */
+#define TUNE_MAGIC 0x434C4B54      /* Marks a valid persisted calibration result ("CLKT") */
+#define ERROR_RING_SIZE 32         /* Error records held until the logger task prints them, must be a power of 2 */
+#define ERROR_LOG_INTERVAL 100     /* Time between checks of the error ring by the logger task (in ms) */
+#define MANAGER_QUEUE_DEPTH 16     /* Requests of each class which may wait for the flash manager task at once */
+#define FLASH_REQUEST_PENDING -1   /* Status of a request the flash manager task has not served yet */
+#define BLOCK_COUNT 4096           /* Number of blocks in the flash */
+#define PAGES_PER_BLOCK 64         /* Number of pages in each block */
+#define BBT_BLOCK 4094             /* Block reserved for the persisted bad block table, written one page at a time */
+#define BBT_MAGIC 0x42425431       /* Marks a page holding a valid bad block table ("BBT1") */
+#define BAD_BLOCK_MARKER 0xFF      /* Spare byte 0 of page 0 in good blocks, other values mark factory bad blocks */
+#define STATUS_E_FAIL (1 << 2)     /* E-FAIL bit of register 3, set if the last erase failed */
+#define STATUS_P_FAIL (1 << 3)     /* P-FAIL bit of register 3, set if the last program failed */
+#define BBM_LUT_ENTRIES 20         /* Entries in the on-chip bad block management look-up table */
+#define BBM_SPARE_BLOCKS 20        /* Blocks below BBT_BLOCK reserved as replacements for blocks remapped in the LUT */
+#define BBM_LUT_ENABLE (1 << 15)   /* Set in the logical block of a LUT entry which is in use */
+#define BBM_LUT_INVALID (1 << 14)  /* Set in the logical block of a LUT entry which is in use but no longer valid */
+#define STATUS_LUT_FULL (1 << 6)   /* LUT-F bit of register 3, set once every LUT entry is in use */
+#define STATUS_ECC_SHIFT 4         /* Position of ECC-1 and ECC-0 in register 3, the ECC result of the last page read */
+#define ECC_WORST_BLOCKS 8         /* Blocks with the most ECC events listed by the ecc-stats command */
+#define ECC_E_BIT (1 << 4)         /* ECC-E bit of register 2, set to enable the on-chip ECC on programs and reads */
+#define DIRTY_BLOCK 4073           /* Block below the BBM spares reserved for the persisted dirty block table */
+#define DIRTY_MAGIC 0x44495254     /* Marks a page holding a valid dirty block table ("DIRT") */
+#define WEAR_BLOCK 4072            /* Block below DIRTY_BLOCK reserved for the persisted erase counts of every block */
+#define WEAR_MAGIC 0x57454152      /* Marks a page holding part of a valid erase count table ("WEAR") */
+#define WEAR_PERSIST_ERASES 64     /* Erases counted in RAM before the erase counts are persisted */
+#define WEAR_STATIC_THRESHOLD 256  /* Spread of erase counts above which cold data is moved onto a worn block */
+#define FTL_BLOCK 4070             /* First of the pair of blocks below WEAR_BLOCK holding the ping-ponged FTL map */
+#define FTL_MAGIC 0x46544C31       /* Marks a page written by the FTL, or part of a valid map checkpoint ("FTL1") */
+#define FTL_LOGICAL_PAGES 4096     /* Logical pages exposed by the FTL, must be a multiple of 512 */
+#define FTL_SPARE_BLOCKS 8         /* Blocks the FTL may hold beyond those needed for every logical page, for GC */
+#define FTL_UNMAPPED UINT32_MAX    /* Physical page of a logical page which has not been written */
+#define SUPER_BLOCK 4068           /* First of the pair of blocks below FTL_BLOCK holding the ping-ponged superblock */
+#define SUPER_MAGIC 0x53555052     /* Marks a page holding a copy of the superblock ("SUPR") */
+#define DATA_BLOCKS SUPER_BLOCK    /* Blocks from 0 available for data, the blocks from SUPER_BLOCK up are reserved */
+#define ERASE_AHEAD_BLOCKS 4       /* Good blocks after the write head kept erased by the erase-ahead task */
+#define ERASE_AHEAD_INTERVAL 50    /* Time between checks of the blocks ahead while the write head is still (in ms) */
+#define SEQUENCE_BLANK UINT32_MAX  /* Sequence number read from a page never stamped, never used by a writer */
+#define PACKETS_PER_PAGE 6         /* Fixed-size packets held in the main area of each page, see PageRead */
+#define PAGE_HEADER_VERSION 1      /* Marks a page whose spare area holds a PageHeader, erased pages read 0xFF */
+#define WARM_LOG_MAGIC 0x574C4F47  /* Marks a valid log writer state in the backup SRAM ("WLOG") */
+#define PACKED_NO_START 0xFFFF     /* First packet offset of a packed page in which no packet starts */
+#define RECORD_MAX_PAYLOAD 131072  /* Largest record payload, the bytes of a block, see RecordHeader */
 
 // Instruction Set
 typedef enum
@@ -44,8 +98,11 @@ typedef enum
     WRITE_BUFFER = 0x84,            /* Writes into the data buffer */
     QUAD_WRITE_BUFFER = 0x34,       /* Writes into the data buffer on 4 lines */
     WRITE_BUFFER_WITH_RESET = 0x02, /* Writes into the data buffer, clearing all bits not written to */
+    QUAD_WRITE_BUFFER_RESET = 0x32, /* Writes into the data buffer on 4 lines, clearing all bits not written to */
     WRITE_EXECUTE = 0x10,           /* Executes write of data buffer to a page */
     ERASE_BLOCK = 0xD8,             /* Erases a block */
+    BAD_BLOCK_MANAGEMENT = 0xA1,    /* Links a logical block to a physical block in the BBM look-up table */
+    READ_BBM_LUT = 0xA5,            /* Reads every entry of the BBM look-up table */
     RESET_DEVICE = 0xFF             /* Resets device software */
 } FlashOpCode;
 
@@ -64,7 +121,8 @@ static const FlashRegisterAddress REGISTERS[] = {REGISTER_ONE, REGISTER_TWO, REG
 typedef enum
 {
     TRANSMIT = 1,
-    RECEIVE = 2
+    RECEIVE = 2,
+    POLL_NOT_BUSY = 3 /* Register is read by the QSPI peripheral until BUSY is 0, asynchronous instructions only */
 } FlashDataMode;
 
 // Struct containing data of a flash instruction
@@ -81,6 +139,133 @@ typedef struct
     uint8_t dataLinesUsed;     // Number of QSPI lines used for transmit/receive of data
 } FlashInstruction;
 
+// Instruction which waits for the BUSY bit to clear, for use in instruction chains
+#define AWAIT_NOT_BUSY_STEP                                                                                            \
+    {                                                                                                                  \
+        .opCode = READ_REGISTER, .address = REGISTER_THREE, .addressSize = 1, .dataMode = POLL_NOT_BUSY,               \
+        .dataSize = 1,                                                                                                 \
+    }
+
+// Record of a failed instruction, held in the error ring until printed by the logger task
+typedef struct
+{
+    FlashOpCode opCode;       // Opcode of the instruction which failed
+    uint32_t address;         // Address sent with the instruction
+    HAL_StatusTypeDef status; // Status returned by the QSPI HAL
+    uint32_t tick;            // HAL tick at which the instruction failed
+} FlashError;
+
+// Contiguous piece of data, a list of which is written by a single scatter/gather write
+typedef struct
+{
+    const uint8_t *data; // Start of the segment
+    uint16_t size;       // Size of the segment in bytes
+} FlashSegment;
+
+// Receives a chunk of data streamed from the flash, along with the context given when streaming began
+typedef void (*FlashStreamSink)(const uint8_t *data, uint16_t size, void *context);
+
+// Callback run from interrupt context once an asynchronous instruction completes, status is 0 if successful
+typedef void (*FlashCallback)(int status);
+
+// Owner of allocated blocks whose data static wear leveling may move, see W25N04KV_LevelStaticWear
+typedef struct
+{
+    bool (*ownsBlock)(uint16_t blockAddress);                // Checks whether the owner can have a block moved
+    int (*blockMoved)(uint16_t fromBlock, uint16_t toBlock); // Points the owner at the copy, 0 if done and persisted
+} StaticWearOwner;
+
+// Class of request served by the flash manager task, lower values are served first
+typedef enum
+{
+    FLASH_REQUEST_READ = 0,    /* Reads part of a page, latency sensitive */
+    FLASH_REQUEST_PROGRAM = 1, /* Writes part of a page */
+    FLASH_REQUEST_ERASE = 2,   /* Erases a block, may be queued in bulk */
+    FLASH_REQUEST_CLASSES = 3  /* Number of request classes */
+} FlashRequestType;
+
+// Read, program, or erase request queued for the flash manager task
+typedef struct
+{
+    FlashRequestType type;  // Class of the request
+    uint32_t address;       // Page address for reads and programs, block address for erases
+    uint16_t columnAddress; // Position within the page to read or program from
+    uint8_t *dataBuf;       // Buffer to read into or program from, unused for erases
+    uint16_t dataSize;      // Size of data in bytes, unused for erases
+    TaskHandle_t requester; // Task notified once the request is served, set on submission
+    volatile int *status;   // Where the result is stored once served, FLASH_REQUEST_PENDING until then
+    uint32_t submitCycles;  // Cycle count at submission, set on submission
+} FlashRequest;
+
+// Queueing statistics of one request class, times are in microseconds
+typedef struct
+{
+    uint32_t depth;        // Requests currently queued
+    uint32_t maxDepth;     // Most requests queued at once
+    uint32_t served;       // Requests served since boot
+    uint32_t lastServed;   // Requests served across all classes when this class was last served, gives their order
+    uint64_t totalWait;    // Total time spent queued before being served
+    uint32_t maxWait;      // Longest time spent queued
+    uint64_t totalService; // Total time spent being served
+    uint32_t maxService;   // Longest time spent being served
+} FlashRequestStats;
+
+// Result of the on-chip ECC for a page read, from the ECC-1 and ECC-0 bits of status register 3
+typedef enum
+{
+    ECC_NONE = 0,               /* No bit errors */
+    ECC_CORRECTED = 1,          /* Bit errors were found and corrected */
+    ECC_UNCORRECTABLE = 2,      /* Bit errors could not be corrected, the data is not valid */
+    ECC_UNCORRECTABLE_PAGES = 3 /* Bit errors could not be corrected in more than one page, continuous read only */
+} FlashECCStatus;
+
+// Page read ECC events of one block since boot, counts saturate at UINT16_MAX
+typedef struct
+{
+    uint16_t corrected;     // Reads whose bit errors were corrected
+    uint16_t uncorrectable; // Reads whose bit errors could not be corrected
+} BlockECCStats;
+
+// Spread of erase counts across the good data blocks
+typedef struct
+{
+    uint16_t minErases;   // Fewest erases of any block
+    uint16_t minBlock;    // Block with the fewest erases
+    uint16_t maxErases;   // Most erases of any block
+    uint16_t maxBlock;    // Block with the most erases
+    uint32_t totalErases; // Sum of the erase counts, divide by blocks for the mean
+    uint16_t blocks;      // Number of good data blocks counted
+} WearStats;
+
+// Activity of the flash translation layer since boot
+typedef struct
+{
+    uint32_t mappedPages;    // Logical pages currently mapped to a physical page
+    uint16_t ownedBlocks;    // Blocks held by the FTL, including the active block
+    uint16_t activeBlock;    // Block pages are currently written to, BLOCK_COUNT if none
+    uint32_t collections;    // Blocks reclaimed by garbage collection
+    uint32_t relocatedPages; // Valid pages moved out of blocks being reclaimed
+    uint32_t leveledBlocks;  // Blocks moved onto a worn block by static wear leveling
+} FTLStats;
+
+// Entry of the on-chip bad block management look-up table
+typedef struct
+{
+    uint16_t logicalBlock;  // Block address which is redirected
+    uint16_t physicalBlock; // Block address accesses are redirected to
+    bool enabled;           // Entry is in use
+    bool invalid;           // Entry is in use but no longer valid
+} BBMEntry;
+
+// Result of QSPI clock calibration, persisted in the spare area of the calibration block
+typedef struct
+{
+    uint32_t magic;                             // TUNE_MAGIC if the result is valid
+    uint8_t prescaler;                          // Chosen QSPI clock prescaler, the clock is HCLK / (prescaler + 1)
+    uint8_t sampleShift;                        // 1 if data is sampled half a cycle late, 0 if not
+    uint8_t passed[TUNE_SLOWEST_PRESCALER + 1]; // Per prescaler, bit 0 set if passed unshifted and bit 1 if shifted
+} ClockTuning;
+
 //! Structs to parse pages
 // Track position of packets on Flash
 typedef struct
@@ -89,6 +274,21 @@ typedef struct
     uint32_t tail; // Byte address of buffer tail
 } CircularBuffer;
 
+// Ways of finding the head and tail of a circular buffer
+typedef enum
+{
+    SCAN_LINEAR, // Reads every page of the range, packets may be anywhere in it
+    SCAN_BINARY, // Binary searches the sequence numbers of a log written in order, in O(log n) page reads
+} HeadTailMode;
+
+// Ways of laying out the packets of a log in its pages
+typedef enum
+{
+    LAYOUT_SLOTTED, // Packets are kept in the PACKETS_PER_PAGE slots of each page, leaving the padding unused
+    LAYOUT_PACKED,  // Packets follow each other across the whole page, straddling the boundaries between pages
+    LAYOUT_RECORDS, // Variable length records follow each other like packed packets, each led by a RecordHeader
+} LogLayout;
+
 // Packet of data
 typedef struct
 {
@@ -96,12 +296,55 @@ typedef struct
     uint8_t pl[337]; // Payload of the packet (useful data)
 } Packet;
 
+// Metadata written to the spare area of each page of a log by W25N04KV_WriteLogPage
+typedef struct
+{
+    uint32_t sequence;    // Rises with every page written, SEQUENCE_BLANK if the page is erased
+    uint32_t timestamp;   // Tick count when the page was written (in ms since boot)
+    uint32_t crc;         // CRC-32 of the main area of the page
+    uint8_t validPackets; // Bitmap with 1 bit per packet slot, set if the slot holds a packet
+    uint8_t streamId;     // Stream the page's packets belong to, chosen by the writer
+    uint8_t version;      // PAGE_HEADER_VERSION if the page has a header
+    uint8_t layout;       // LAYOUT_PACKED or LAYOUT_RECORDS if the page is packed, left erased (0xFF) if it is slotted
+    uint16_t firstPacket; // Packed pages only, offset of the first packet or record starting in the page
+    uint16_t packetEnd;   // Packed pages only, offset of the end of the last packet or record ending in the page
+    uint16_t dataEnd;     // Packed pages only, bytes of the packet stream held by the page
+    uint16_t reserved;    // Left erased (0xFF)
+} PageHeader;
+
+// Header leading each record of a LAYOUT_RECORDS log, followed by its payload
+typedef struct
+{
+    uint32_t length; // Bytes of payload, up to RECORD_MAX_PAYLOAD
+    uint32_t crc;    // CRC-32 of the type, flags, and payload, see W25N04KV_RecordCRC
+    uint8_t type;    // Kind of record, chosen by the writer
+    uint8_t flags;   // Bits chosen by the writer
+    uint16_t check;  // Inverse of the low 16 bits of the length, so a corrupt length is caught before it is followed
+} RecordHeader;
+
+// Checkpoint of the circular log, committed to the pair of blocks from SUPER_BLOCK
+typedef struct
+{
+    uint32_t magic;        // SUPER_MAGIC
+    uint32_t commits;      // Commits made so far, the valid copy with the most is the newest
+    CircularBuffer log;    // Head and tail of the log when committed
+    uint32_t firstPage;    // First page of the range the log wraps around in
+    uint32_t endPage;      // Page after the last of the range
+    uint32_t nextSequence; // Sequence number of the next page written, pages from it on are rolled forward at mount
+    uint16_t badBlocks;    // Blocks in the bad block table
+    uint16_t dataBlocks;   // Good data blocks counted in the erase summary
+    uint16_t minErases;    // Fewest erases of any good data block
+    uint16_t maxErases;    // Most erases of any good data block
+    uint32_t totalErases;  // Sum of the erase counts of the good data blocks
+    uint32_t crc;          // CRC-32 of every field above, must be last
+} Superblock;
+
 // Page of packets
 typedef struct
 {
-    Packet packetArray[6]; // Array of all 6 packets within the page
-    uint8_t padding[20];   // Padding at end of each page
-} PageRead;                // Structure of bytes read from an entire page
+    Packet packetArray[PACKETS_PER_PAGE]; // Array of all 6 packets within the page
+    uint8_t padding[20];                  // Padding at end of each page
+} PageRead;                               // Structure of bytes read from an entire page
 
 union PageStructure {
     PageRead page;                   // Contains structured page data
@@ -116,16 +359,86 @@ extern osMessageQueueId_t cmdParamQueueHandle; // Size of 8 bytes, where each it
 
 /// @brief Issues an instruction via the QSPI peropheral
 /// @param instruction A struct containing the data of the instruction to be sent
-/// @return An error code, 0 if successful and 1 if failed
+/// @return An error code, 0 if successful and 1 if failed. Failures are recorded with W25N04KV_LogError.
 int W25N04KV_QSPIInstruct(FlashInstruction *instruction);
 
+/// @brief Records a failed instruction in the error ring without blocking, so it can be printed later by the logger
+/// task. Safe to call from any task or interrupt. The record is dropped if the ring is full.
+/// @param opCode Opcode of the instruction which failed
+/// @param address Address sent with the instruction
+/// @param status Status returned by the QSPI HAL
+void W25N04KV_LogError(FlashOpCode opCode, uint32_t address, HAL_StatusTypeDef status);
+
+/// @brief Removes the oldest record from the error ring. Only the logger task should call this.
+/// @param error Pointer to the struct filled with the record
+/// @return True if a record was removed, false if the ring is empty
+bool W25N04KV_PopError(FlashError *error);
+
+/// @brief Fetches the number of records dropped because the error ring was full.
+/// @return The number of records dropped since boot
+uint32_t W25N04KV_GetDroppedErrors(void);
+
+/// @brief Prints records from the error ring over UART as they arrive. Meant to be run as a low priority FreeRTOS task,
+/// so the UART is only written to when nothing else needs the CPU.
+/// @param argument Unused
+void W25N04KV_LogErrors(void *argument);
+
+/// @brief Converts a flash instruction into the command structure expected by the QSPI HAL.
+/// @param instruction A struct containing the data of the instruction to be encoded
+/// @param command Pointer to the QSPI command struct to be filled in
+void W25N04KV_EncodeCommand(FlashInstruction *instruction, QSPI_CommandTypeDef *command);
+
+/// @brief Converts a flash instruction into a QSPI command by copying a template pre-encoded at compile time and
+/// patching its address and data length. Falls back to W25N04KV_EncodeCommand if the instruction does not use the
+/// address size, lines, and dummy clocks the template of its opcode was built for.
+/// @param instruction A struct containing the data of the instruction to be encoded
+/// @param command Pointer to the QSPI command struct to be filled in
+void W25N04KV_BuildCommand(FlashInstruction *instruction, QSPI_CommandTypeDef *command);
+
+/// @brief Issues an instruction via the QSPI peripheral, moving its data phase with DMA instead of polling. Returns as
+/// soon as the transfer has started, and only one asynchronous instruction may be in flight at a time. The buffer of
+/// the instruction must remain valid until the transfer completes.
+/// @param instruction A struct containing the data of the instruction to be sent
+/// @param callback Function called from interrupt context on completion, before the calling task is notified. May be
+/// NULL.
+/// @return An error code, 0 if the transfer started and 1 if failed
+int W25N04KV_QSPIInstructAsync(FlashInstruction *instruction, FlashCallback callback);
+
+/// @brief Runs a chain of instructions back to back. Each instruction is started from the interrupt which completes
+/// the previous one, without returning to task context, and completion is only signalled once the whole chain is
+/// done or an instruction fails. Data phases are moved by DMA, and AWAIT_NOT_BUSY_STEP instructions are handled by
+/// auto-polling. The chain and its buffers must remain valid until it completes.
+/// @param chain Array of instructions to run in order
+/// @param length Number of instructions in the chain
+/// @param callback Function called from interrupt context once the chain completes, before the calling task is
+/// notified. May be NULL.
+/// @return An error code, 0 if the chain started and 1 if failed
+int W25N04KV_QSPIInstructChain(FlashInstruction *chain, uint8_t length, FlashCallback callback);
+
+/// @brief Blocks the calling task (without polling) until the asynchronous instruction or chain it started completes.
+/// Uses the task notification of the calling task.
+/// @param timeout Maximum time to wait (in ms), the transfer is aborted if exceeded
+/// @return An error code, 0 if the transfer was successful and 1 if failed or timed out
+int W25N04KV_AwaitAsync(uint32_t timeout);
+
+/// @brief Checks whether an asynchronous instruction is still in flight.
+/// @return True if a DMA transfer has been started but has not yet completed.
+bool W25N04KV_IsAsyncBusy(void);
+
 /// @brief Reads the value of a specified register.
 /// @param registerNo The register which is read (either 1, 2, or 3).
 /// @return The value of the register. If the register fails to be read, UINT8_MAX is returned.
 uint8_t W25N04KV_ReadRegister(int registerNo);
 
+/// @brief Writes a value to a specified register.
+/// @param registerNo The register which is written (either 1, 2, or 3).
+/// @param value The value to write to the register.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteRegister(int registerNo, uint8_t value);
+
 /// @brief Resets the flash memory device using a software reset command. Data stored should remain unaffected.
-void W25N04KV_ResetDeviceSoftware(void);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ResetDeviceSoftware(void);
 
 /// @brief Fetches the value of the write enable latch (WEL) of the flash.
 /// @return The value of the WEL bit, true if set and false if not.
@@ -135,90 +448,695 @@ bool W25N04KV_IsWEL(void);
 /// @return The value of the BUSY bit, true if set and false if not.
 bool W25N04KV_IsBusy(void);
 
+/// @brief Blocks until the BUSY bit of the flash is cleared. Uses auto-polling if USE_AUTO_POLLING is set and the
+/// scheduler is running, otherwise falls back to W25N04KV_SpinAwaitNotBusy.
+/// @return An error code, 0 if the BUSY bit cleared and 1 if it did not clear within BUSY_TIMEOUT
+int W25N04KV_AwaitNotBusy(void);
+
+/// @brief Blocks until the BUSY bit of the flash is cleared by repeatedly reading status register 3. Occupies the CPU
+/// and QSPI bus for the whole wait.
+/// @return An error code, 0 if the BUSY bit cleared and 1 if it did not clear within BUSY_TIMEOUT
+int W25N04KV_SpinAwaitNotBusy(void);
+
+/// @brief Blocks the calling task until the BUSY bit of the flash is cleared. Status register 3 is polled by the QSPI
+/// peripheral, and the task is woken from the status match interrupt, so no CPU time is used while waiting.
+/// @param timeout Maximum time to wait (in ms)
+/// @return An error code, 0 if the BUSY bit cleared and 1 if polling failed or timed out
+int W25N04KV_AwaitNotBusyAutoPoll(uint32_t timeout);
+
 /// @brief Reads and prints the JEDEC ID of the flash via UART
-void W25N04KV_ReadJEDECID(void);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadJEDECID(void);
 
 /// @brief Reads data from the flash memory's data buffer, starting at the specified column address and storing the read
 /// data.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_ReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
 
 /// @brief Reads data from the flash memory's data buffer. Functionally the same as W25N04KV_ReadBuffer for this flash,
 /// but may give access to higher clock rates in other WinBond flash devices.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_FastReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FastReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
 
 /// @brief Reads data from the flash memory's data buffer using 2 lines (IO0 and IO1), but sends address on IO0 only.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_FastDualReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FastDualReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
 
 /// @brief Reads data from the flash memory's data buffer using 2 lines (IO0 and IO1), also sending the address on 2
 /// lines.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_FastDualReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FastDualReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
 
 /// @brief Reads data from the flash memory's data buffer using 4 lines (IO0-IO3), but sends address on IO0 only.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_FastQuadReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FastQuadReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
 
 /// @brief Reads data from the flash memory's data buffer using 4 lines (IO0-IO3), also sending the address on 4 lines.
 /// @param columnAddress The starting column address.
 /// @param size The number of bytes to read.
 /// @param readResponse Pointer to the buffer to store the read data.
-void W25N04KV_FastQuadReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FastQuadReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse);
+
+/// @brief Maps the data buffer of the flash (main and spare area) into the address space of the MCU, by putting the
+/// QSPI peripheral into memory-mapped mode with FAST_QUAD_READ_IO as the read command. The buffer can then be read
+/// directly through the returned pointer, by memcpy, or by DMA, with each access fetched from the flash on demand. Any
+/// other instruction unmaps the buffer, and the data cache must not be enabled for the mapped region.
+/// @return Pointer to byte 0 of the data buffer, valid up to PAGE_SIZE + SPARE_SIZE bytes. NULL if mapping failed.
+const volatile uint8_t *W25N04KV_MapBuffer(void);
+
+/// @brief Leaves memory-mapped mode, allowing other instructions to be sent. Called automatically by every instruction.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_UnmapBuffer(void);
+
+/// @brief Reads a run of consecutive pages in a single quad read, using the continuous read mode of the flash (BUF=0)
+/// so pages are loaded without a READ_PAGE per page. The main area of each page (PAGE_SIZE bytes) is streamed in
+/// order and delivered to the sink in chunks, and buffer read mode (BUF=1) is restored afterwards.
+/// @param pageAddress The address of the first page to read, from 0 to 262143.
+/// @param pageCount The number of pages to read. A run past the last page is refused.
+/// @param chunkBuf Buffer which holds each chunk before it is passed to the sink.
+/// @param chunkSize The size of chunkBuf (in bytes), the last chunk may be smaller.
+/// @param sink Function called with each chunk in order. The QSPI clock is paused while it runs.
+/// @param context Pointer passed unchanged to the sink.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_StreamPages(uint32_t pageAddress, uint32_t pageCount, uint8_t *chunkBuf, uint16_t chunkSize,
+                         FlashStreamSink sink, void *context);
+
+/// @brief Switches the QSPI peripheral to a new clock prescaler and sample shift. Fails if an asynchronous instruction
+/// is in flight.
+/// @param prescaler The QSPI clock prescaler, the clock is HCLK / (prescaler + 1).
+/// @param sampleShift True to sample data half a cycle late, false to sample on the clock edge.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_SetClock(uint8_t prescaler, bool sampleShift);
+
+/// @brief Calibrates the QSPI clock by writing a known pattern to a page of TUNE_BLOCK, then reading it back on 4 lines
+/// TUNE_PASSES times at every prescaler from TUNE_SLOWEST_PRESCALER to TUNE_FASTEST_PRESCALER, both with and without
+/// sample shifting. The fastest prescaler which passes with both sample shifts is chosen, so the data is valid across
+/// the whole sampling window. The result is applied and persisted in the spare area of TUNE_BLOCK, which is erased.
+/// @param result Pointer to the struct filled with the result. May be NULL.
+/// @return An error code, 0 if successful and 1 if no setting passed (the clock is left at TUNE_SLOWEST_PRESCALER)
+int W25N04KV_TuneClock(ClockTuning *result);
+
+/// @brief Reads the calibration result persisted by W25N04KV_TuneClock. Must be called at the default clock.
+/// @param result Pointer to the struct filled with the result.
+/// @return An error code, 0 if a valid result was found and 1 if not
+int W25N04KV_LoadClockTuning(ClockTuning *result);
 
-/// @brief Reads an entire page of data from the specified page address into the data buffer.
+/// @brief Applies the persisted calibration result at boot, calibrating first if there is none.
+/// @return An error code, 0 if a calibrated clock is in use and 1 if the default clock is used
+int W25N04KV_InitClock(void);
+
+/// @brief Runs the flash manager, which owns the QSPI bus and serves read, program, and erase requests one at a time.
+/// Queued reads are served before queued programs, and programs before erases, so a read never waits behind more than
+/// the operation already on the bus. The bus is acquired for each request. Meant to be run as a FreeRTOS task, requests
+/// fail until it has started.
+/// @param argument Unused
+void W25N04KV_ManageFlash(void *argument);
+
+/// @brief Creates the mutex which gives one task at a time ownership of the QSPI bus. Must be called before the
+/// scheduler starts. Until then, any caller may issue instructions.
+void W25N04KV_InitBus(void);
+
+/// @brief Takes ownership of the QSPI bus for the calling task, waiting while the flash manager serves a request or
+/// another task owns it. Must be called before calling the driver directly from a task, and may be nested.
+void W25N04KV_AcquireBus(void);
+
+/// @brief Gives up ownership of the QSPI bus taken with W25N04KV_AcquireBus, once called as many times as it was taken.
+void W25N04KV_ReleaseBus(void);
+
+/// @brief Checks whether the caller may issue instructions, which is true for the task owning the bus, for interrupts,
+/// and for any caller before the scheduler starts. Instructions are refused and logged with HAL_BUSY otherwise.
+/// @return True if the caller may use the bus
+bool W25N04KV_OwnsBus(void);
+
+/// @brief Queues a request for the flash manager task, then blocks the calling task until it has been served. Uses the
+/// task notification of the calling task, waiting on it until the result has been stored, so a stray notification is
+/// ignored. A request from the task owning the bus is served directly instead, as the manager could not take the bus
+/// until it was released.
+/// @param request The request to queue, its requester, status, and submitCycles fields are filled in.
+/// @return An error code, 0 if the request was served successfully and 1 if failed
+int W25N04KV_SubmitRequest(FlashRequest *request);
+
+/// @brief Reads data from a page through the flash manager task, on 4 lines.
 /// @param pageAddress The address of the page to read, from 0 to 262143.
-void W25N04KV_ReadPage(uint32_t pageAddress);
+/// @param columnAddress The starting column address.
+/// @param data Pointer to the buffer to store the read data.
+/// @param size The number of bytes to read.
+/// @return An error code, 0 if successful and 1 if failed or the page held errors the ECC could not correct
+int W25N04KV_RequestRead(uint32_t pageAddress, uint16_t columnAddress, uint8_t *data, uint16_t size);
+
+/// @brief Programs data into a page through the flash manager task, on 4 lines. The page must be erased.
+/// @param pageAddress The address of the page to program, from 0 to 262143.
+/// @param columnAddress The starting column address.
+/// @param data Pointer to the buffer containing the data to write.
+/// @param size The number of bytes to write. The rest of the page is left erased.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_RequestProgram(uint32_t pageAddress, uint16_t columnAddress, uint8_t *data, uint16_t size);
+
+/// @brief Erases a block through the flash manager task.
+/// @param blockAddress The address of the block to erase, between 0 and 4095.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_RequestErase(uint16_t blockAddress);
+
+/// @brief Fetches the queueing statistics of a request class. Times are measured with the DWT cycle counter, so waits
+/// longer than about 19 seconds wrap around.
+/// @param type The request class
+/// @param stats Pointer to the struct filled with the statistics
+void W25N04KV_GetRequestStats(FlashRequestType type, FlashRequestStats *stats);
+
+/// @brief Runs the erase-ahead scheduler, which keeps the ERASE_AHEAD_BLOCKS good blocks after the write head erased,
+/// wrapping around the log's page range. Dirty blocks are only erased while no reads or programs are queued, with the
+/// bus held, so a writer holding the bus delays the erases rather than being delayed by them. Meant to be run as a low
+/// priority FreeRTOS task.
+/// @param argument Unused
+void W25N04KV_EraseAhead(void *argument);
+
+/// @brief Moves the write head of the circular log to a page, waking the erase-ahead task. Must be called before each
+/// page is programmed, and may be called with the bus held. If the page is the first of a block the task has not yet
+/// erased, the block is erased through the flash manager first, which only happens if the writer outruns the task.
+/// @param pageAddress The address of the page about to be programmed. Pages past the data blocks stop the log.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in. Only
+/// blocks of this range are erased ahead, so it must not hold blocks of another owner.
+/// @return An error code, 0 if the page can be programmed and 1 if its block is bad or could not be erased
+int W25N04KV_AdvanceWriteHead(uint32_t pageAddress, const uint32_t pageRange[2]);
+
+/// @brief Loads the bad block table persisted in BBT_BLOCK. If there is none, builds it by reading the factory bad
+/// block marker of every block, then persists it. Must be called before any block is erased, since erasing a block
+/// clears its marker.
+/// @return An error code, 0 if the table was loaded or built and 1 if failed
+int W25N04KV_MountBadBlocks(void);
+
+/// @brief Checks whether a block is marked bad in the bad block table. All blocks are good until the table is mounted.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @return True if the block is bad.
+bool W25N04KV_IsBadBlock(uint16_t blockAddress);
+
+/// @brief Marks a block bad in the bad block table and persists the table, so it is skipped from then on. Used when a
+/// program or erase of the block fails.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @return An error code, 0 if successful and 1 if the table could not be persisted
+int W25N04KV_MarkBadBlock(uint16_t blockAddress);
+
+/// @brief Finds the first good block at or after the given block, for allocators which must skip bad blocks.
+/// @param blockAddress The address of the block to start from, between 0 and 4095.
+/// @return The address of the first good block, BLOCK_COUNT if there is none.
+uint16_t W25N04KV_NextGoodBlock(uint16_t blockAddress);
+
+/// @brief Fetches the number of blocks marked bad in the bad block table.
+/// @return The number of bad blocks
+uint16_t W25N04KV_GetBadBlockCount(void);
+
+/// @brief Loads the dirty block table persisted in DIRTY_BLOCK. If there is none, every block is marked dirty, since
+/// its contents are unknown. Must be called after W25N04KV_MountBadBlocks, and before any page is programmed.
+/// @return An error code, 0 if the table was loaded or built and 1 if failed
+int W25N04KV_MountDirtyBlocks(void);
+
+/// @brief Checks whether a block has been programmed since it was last erased.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @return True if the block is dirty.
+bool W25N04KV_IsDirtyBlock(uint16_t blockAddress);
+
+/// @brief Marks a block dirty and persists the table, if it is not already dirty. Must be called before the data to
+/// program is loaded into the data buffer, as the update goes through the buffer. Every program made by the driver
+/// calls it, so the block is recorded before its page is programmed. A failed update is caught by the blank check of
+/// W25N04KV_EraseDevice.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_MarkDirtyBlock(uint16_t blockAddress);
+
+/// @brief Marks a block dirty in RAM only, the change is persisted with the next update. Called by
+/// W25N04KV_WriteExecute, which cannot persist the table without disturbing the loaded data buffer, to catch pages
+/// programmed without W25N04KV_MarkDirtyBlock.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_SetDirtyBlock(uint16_t blockAddress);
+
+/// @brief Marks a block clean in RAM only. Called by W25N04KV_EraseBlock once the erase has succeeded, the change is
+/// persisted with the next update.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_ClearDirtyBlock(uint16_t blockAddress);
+
+/// @brief Writes the dirty block table to the next page of DIRTY_BLOCK, erasing it once every page has been used.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_PersistDirtyBlocks(void);
+
+/// @brief Fetches the number of blocks marked dirty in the dirty block table.
+/// @return The number of dirty blocks
+uint16_t W25N04KV_GetDirtyBlockCount(void);
+
+/// @brief Loads the erase counts persisted in WEAR_BLOCK, or starts every count at 0 if there are none. Every block
+/// starts free. Must be called after W25N04KV_MountBadBlocks.
+/// @return An error code, 0 if the counts were loaded or started and 1 if failed
+int W25N04KV_MountWear(void);
+
+/// @brief Writes the erase counts of every block to the next snapshot of WEAR_BLOCK, erasing it once every snapshot
+/// has been used. Called every WEAR_PERSIST_ERASES erases, whichever path erased the block, and by
+/// W25N04KV_EraseDevice.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_PersistWear(void);
+
+/// @brief Adds an erase to the count of a block in RAM, persisting the counts every WEAR_PERSIST_ERASES erases. Called
+/// by W25N04KV_EraseBlock.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_CountErase(uint16_t blockAddress);
+
+/// @brief Fetches the number of times a block has been erased.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @return The erase count of the block, saturating at UINT16_MAX
+uint16_t W25N04KV_GetEraseCount(uint16_t blockAddress);
+
+/// @brief Finds the spread of erase counts across the good data blocks.
+/// @param stats Pointer to the struct filled with the spread.
+void W25N04KV_GetWearStats(WearStats *stats);
+
+/// @brief Allocates the least worn free good data block (dynamic wear leveling), erasing it first if it is dirty.
+/// Blocks which fail to erase are marked bad and skipped.
+/// @return The address of the allocated block, BLOCK_COUNT if every data block is allocated or bad.
+uint16_t W25N04KV_AllocateBlock(void);
+
+/// @brief Marks a block allocated without erasing it, for owners which rebuild the blocks they hold at boot.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_ClaimBlock(uint16_t blockAddress);
+
+/// @brief Returns a block to the allocator once its data is no longer needed. It is erased when next allocated.
+/// @param blockAddress The address of the block, between 0 and 4095.
+void W25N04KV_FreeBlock(uint16_t blockAddress);
+
+/// @brief Checks whether a block is allocated.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @return True if the block is allocated.
+bool W25N04KV_IsAllocatedBlock(uint16_t blockAddress);
+
+/// @brief Performs one step of static wear leveling for an owner of allocated blocks. If the most worn free block has
+/// been erased WEAR_STATIC_THRESHOLD times more than the owner's least worn block, the programmed pages of the owner's
+/// block are copied to the same pages of the free one. The owner's blockMoved callback then points it at the copy, and
+/// only once that succeeds is the old block freed. Called by the FTL each time it opens a new active block.
+/// @param owner Callbacks of the owner, only blocks it owns are moved.
+/// @param fromBlock Pointer set to the block whose data was moved, BLOCK_COUNT if nothing was moved.
+/// @param toBlock Pointer set to the block now holding the data, BLOCK_COUNT if nothing was moved.
+/// @return An error code, 0 if successful (whether or not data was moved) and 1 if the copy failed
+int W25N04KV_LevelStaticWear(const StaticWearOwner *owner, uint16_t *fromBlock, uint16_t *toBlock);
+
+/// @brief Loads the FTL map from its newest checkpoint in either block of the pair from FTL_BLOCK, then rolls forward
+/// through the pages written to the active block since. Blocks holding a valid page are taken from the allocator, so
+/// it must be called after W25N04KV_MountWear. Starts with an empty map if there is no checkpoint.
+/// @return An error code, 0 if the map was loaded or started and 1 if failed
+int W25N04KV_MountFTL(void);
+
+/// @brief Writes a logical page of the FTL. The data goes to the next free page of the active block, and the copy the
+/// logical page pointed at before is left to garbage collection, so no erase is needed. Once the FTL holds more than
+/// FTL_SPARE_BLOCKS blocks beyond those needed for every logical page, a block is reclaimed first. If the page fails to
+/// program, the active block is remapped to a spare keeping its earlier pages, or retired and marked bad once no spare
+/// is left, and the page is written again.
+/// @param logicalPage The logical page to write, from 0 to FTL_LOGICAL_PAGES - 1.
+/// @param data Pointer to the PAGE_SIZE bytes to write.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FTLWrite(uint32_t logicalPage, const uint8_t *data);
+
+/// @brief Reads the newest copy of a logical page of the FTL. Pages never written read as erased (0xFF).
+/// @param logicalPage The logical page to read, from 0 to FTL_LOGICAL_PAGES - 1.
+/// @param data Pointer to the buffer of PAGE_SIZE bytes to store the read data.
+/// @return An error code, 0 if successful and 1 if failed or the page held errors the ECC could not correct
+int W25N04KV_FTLRead(uint32_t logicalPage, uint8_t *data);
+
+/// @brief Unmaps a logical page of the FTL, so garbage collection no longer moves its copy. Only persisted by the next
+/// checkpoint, so the page may be mapped again if the device resets first. Garbage collection always checkpoints a
+/// trim before freeing a block, so the persisted map never points into a block which has been reused.
+/// @param logicalPage The logical page to unmap, from 0 to FTL_LOGICAL_PAGES - 1.
+/// @return An error code, 0 if successful and 1 if the page is out of range
+int W25N04KV_FTLTrim(uint32_t logicalPage);
+
+/// @brief Writes the FTL map to the next checkpoint of the block of the pair from FTL_BLOCK in use. Once every
+/// checkpoint of that block has been used, the other block is erased and written instead, so the newest checkpoint
+/// survives a power loss during the erase. Called whenever a new active block is opened.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FTLCheckpoint(void);
+
+/// @brief Reclaims the block held by the FTL with the fewest valid pages, other than the active block. Its valid pages
+/// are moved to the active block, opening a new one if they do not fit, and the block is freed once any trim made since
+/// the last checkpoint has been checkpointed. Called by
+/// W25N04KV_FTLWrite when the FTL holds too many blocks.
+/// @return An error code, 0 if successful or there was nothing to reclaim and 1 if failed
+int W25N04KV_FTLCollectGarbage(void);
+
+/// @brief Fetches the activity of the FTL since it was mounted.
+/// @param stats Pointer to the struct filled with the activity.
+void W25N04KV_GetFTLStats(FTLStats *stats);
+
+/// @brief Reads every entry of the on-chip bad block management look-up table.
+/// @param entries Array of BBM_LUT_ENTRIES entries filled in, in the order stored by the flash.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadBBMLUT(BBMEntry entries[BBM_LUT_ENTRIES]);
+
+/// @brief Adds an entry to the BBM look-up table, so the flash redirects every access to the logical block to the
+/// physical block instead. Entries cannot be removed.
+/// @param logicalBlock The address of the block to redirect, between 0 and 4095.
+/// @param physicalBlock The address of the block to use in its place, between 0 and 4095.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_LinkBlocks(uint16_t logicalBlock, uint16_t physicalBlock);
+
+/// @brief Counts the entries of the BBM look-up table which are not yet in use.
+/// @return The number of free entries, -1 if the table could not be read
+int W25N04KV_GetFreeBBMEntries(void);
+
+/// @brief Remaps a block which failed a program or erase to one of the BBM_SPARE_BLOCKS spare blocks below BBT_BLOCK,
+/// using the BBM look-up table. The spare is erased, and the first pages of the failed block are copied inside the
+/// flash to the same pages of the spare before it is linked, so they read the same afterwards. Blocks already linked
+/// are not linked again, as the table only uses the first entry for a block.
+/// @param blockAddress The address of the block which failed, between 0 and 4095.
+/// @param keepPages The number of pages from the start of the block to copy, e.g. the pages programmed before the one
+/// which failed. 0 for a block which failed to erase.
+/// @return An error code, 0 if successful and 1 if the block is already linked, or no free entry or spare block is left
+int W25N04KV_RemapBlock(uint16_t blockAddress, uint8_t keepPages);
+
+/// @brief Reads an entire page of data from the specified page address into the data buffer. The ECC result of the read
+/// is counted against the page's block.
+/// @param pageAddress The address of the page to read, from 0 to 262143.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadPage(uint32_t pageAddress);
+
+/// @brief Reads an entire page into the data buffer like W25N04KV_ReadPage, waiting for the page to load so the ECC
+/// result can be fetched from status register 3.
+/// @param pageAddress The address of the page to read, from 0 to 262143.
+/// @param ecc Pointer filled with the ECC result of the read. May be NULL.
+/// @return An error code, 0 if the page was loaded and 1 if failed. Uncorrectable data is not a failure, check ecc.
+int W25N04KV_ReadPageECC(uint32_t pageAddress, FlashECCStatus *ecc);
+
+/// @brief Counts the ECC result of a page read against its block. Called by W25N04KV_ReadPageECC.
+/// @param blockAddress The address of the block the page is in, between 0 and 4095.
+/// @param ecc The ECC result of the read.
+void W25N04KV_RecordECC(uint16_t blockAddress, FlashECCStatus ecc);
+
+/// @brief Fetches the ECC events counted against a block since boot.
+/// @param blockAddress The address of the block, between 0 and 4095.
+/// @param stats Pointer to the struct filled with the counts.
+void W25N04KV_GetBlockECCStats(uint16_t blockAddress, BlockECCStats *stats);
+
+/// @brief Finds the blocks with the most ECC events since boot, ranked by uncorrectable reads and then by corrected
+/// reads. Blocks without any events are not included.
+/// @param blocks Array filled with the addresses of the worst blocks, worst first.
+/// @param count The size of blocks.
+/// @return The number of blocks with events. Only the first count of them are filled in if there are more.
+uint16_t W25N04KV_GetWorstECCBlocks(uint16_t *blocks, uint16_t count);
 
 /// @brief Enables write operations for the flash memory, setting the Write Enable Latch (WEL) bit to 1.
-void W25N04KV_WriteEnable(void);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteEnable(void);
 
 /// @brief Disables write operations for the flash memory, setting the Write Enable Latch (WEL) bit to 0.
-void W25N04KV_WriteDisable(void);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteDisable(void);
 
 /// @brief Writes data into the data buffer at the specified column address. Data exceeding the buffer size is
 /// discarded.
 /// @param data Pointer to the buffer containing the data to write.
 /// @param size The number of bytes to write.
 /// @param columnAddress The starting column address.
-void W25N04KV_WriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress);
 
 /// @brief Writes data into the data buffer at the specified column address using 4 lines. Data exceeding the buffer
 /// size is discarded.
 /// @param data Pointer to the buffer containing the data to write.
 /// @param size The number of bytes to write.
 /// @param columnAddress The starting column address.
-void W25N04KV_QuadWriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_QuadWriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress);
+
+/// @brief Writes a list of segments into the data buffer on 4 lines, one after another at consecutive column addresses,
+/// in a single instruction. Each segment is read in place, so data need not be copied into a contiguous buffer first.
+/// Segments must end within the PAGE_SIZE + SPARE_SIZE bytes of the buffer.
+/// @param segments Array of segments to write in order, segments of size 0 are skipped.
+/// @param segmentCount The number of segments.
+/// @param columnAddress The column address the first segment is written to.
+/// @param resetBuffer Whether every byte of the buffer not written to is reset to 0xFF, rather than left as it was.
+/// Whole pages are loaded with a reset, only patches to a page already in the buffer keep the rest of it.
+/// @return An error code, 0 if successful and 1 if failed or the segments run past the end of the buffer
+int W25N04KV_QuadWriteBufferSegments(const FlashSegment *segments, uint8_t segmentCount, uint16_t columnAddress,
+                                     bool resetBuffer);
+
+/// @brief Describes a run of bytes held in a ring buffer as segments, splitting it in 2 if it wraps around the end.
+/// @param ring Pointer to the start of the ring buffer.
+/// @param ringSize The size of the ring buffer (in bytes).
+/// @param start Position of the first byte of the run within the ring.
+/// @param size The number of bytes in the run, at most ringSize.
+/// @param segments Array of 2 segments filled in.
+/// @return The number of segments used, 1 or 2. 0 if the run does not fit in the ring.
+uint8_t W25N04KV_RingSegments(const uint8_t *ring, uint16_t ringSize, uint16_t start, uint16_t size,
+                              FlashSegment segments[2]);
 
-/// @brief Commits the data written to the buffer to the specified page address.
+/// @brief Commits the data written to the buffer to the specified page address. Pages in bad blocks are not written.
 /// @param pageAddress The address of the page to write to, between 0 and 262143.
-void W25N04KV_WriteExecute(uint32_t pageAddress);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteExecute(uint32_t pageAddress);
+
+/// @brief Copies a page to another page inside the flash, without its data crossing the bus. The page is loaded into
+/// the data buffer, bytes of the buffer can be patched, e.g. a spare area tag, then the buffer is programmed.
+/// @param sourcePage The address of the page to copy, between 0 and 262143.
+/// @param destinationPage The address of the erased page to program, between 0 and 262143.
+/// @param patch Pointer to the bytes written over the loaded page, NULL to copy the page unchanged.
+/// @param patchSize Number of bytes to patch.
+/// @param patchColumn Column of the buffer the patch is written to, between 0 and 2175.
+/// @return An error code, 0 if successful and 1 if failed, the ECC could not correct the page, or the program failed
+int W25N04KV_CopyPage(uint32_t sourcePage, uint32_t destinationPage, const uint8_t *patch, uint16_t patchSize,
+                      uint16_t patchColumn);
+
+/// @brief Copies pages of a block with W25N04KV_CopyPage, so moving a block never transfers its data over the bus.
+/// Pages selected by the mask are copied in order to consecutive pages, which must all be in the destination block.
+/// @param sourceBlock The address of the block to copy pages from, between 0 and 4095.
+/// @param pageMask Bitmap of the pages to copy, bit 0 being the first page of the block.
+/// @param destinationPage The address of the erased page the first copy is programmed to, between 0 and 262143.
+/// @param relocated Pointer set to the number of pages copied. On failure, the page after them may be part-programmed.
+/// @return An error code, 0 if every page was copied and 1 if failed
+int W25N04KV_RelocateBlock(uint16_t sourceBlock, uint64_t pageMask, uint32_t destinationPage, uint8_t *relocated);
 
 /// @brief Erases the data buffer, setting all bytes to 0xFF.
-void W25N04KV_EraseBuffer(void);
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_EraseBuffer(void);
 
-/// @brief Erases a specific block in the flash memory.
+/// @brief Erases a specific block in the flash memory, waiting for the erase to finish. Bad blocks are not erased, so
+/// their markers are kept. The block is only recorded clean once the flash reports the erase succeeded.
 /// @param blockAddress The address of the block to erase, between 0 and 4095.
-void W25N04KV_EraseBlock(uint16_t blockAddress);
+/// @return An error code, 0 if successful and 1 if failed, including when the flash reports E-FAIL
+int W25N04KV_EraseBlock(uint16_t blockAddress);
+
+/// @brief Checks whether a page is erased, reading all of its main and spare areas. Used by scans of the reserved
+/// blocks to step past a page whose program was cut off by a power loss, which may hold no valid data but cannot be
+/// programmed again.
+/// @param pageAddress The address of the page to check, between 0 and 262143.
+/// @return True if every byte of the page reads 0xFF, false if not or if the page could not be read
+bool W25N04KV_IsBlankPage(uint32_t pageAddress);
+
+/// @brief Performs a full device erase, clearing all data in the main data array. Only blocks marked dirty in the dirty
+/// block table are erased, so the time taken scales with the data written. Bad blocks are skipped, and the bad block,
+/// dirty block, and erase count tables and the tune record are kept.
+/// @param blankCheck True to also read the first page of every clean block, erasing it if it holds data. Slower, but
+/// catches blocks written before the table was mounted.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_EraseDevice(bool blankCheck);
+
+/// @brief Writes a page's sequence number to the spare area of the data buffer, where the sequence of a PageHeader is
+/// kept. Writers of a log searched with SCAN_BINARY which do not use W25N04KV_WriteLogPage call it before
+/// W25N04KV_WriteExecute, numbering pages in the order they are written.
+/// @param sequence The sequence number of the page, rising with every page written and never SEQUENCE_BLANK.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_StampSequence(uint32_t sequence);
+
+/// @brief Loads a page into the data buffer and reads the sequence number stamped in its spare area.
+/// @param pageAddress The address of the page to read, between 0 and 262143.
+/// @param sequence Pointer set to the sequence number, SEQUENCE_BLANK if the page was never stamped.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadSequence(uint32_t pageAddress, uint32_t *sequence);
+
+/// @brief Computes the CRC-32 of a buffer, the same CRC as the one used to hash CLI commands.
+/// @param data Pointer to the buffer.
+/// @param size Size of the buffer in bytes.
+/// @return The CRC-32 of the buffer
+uint32_t W25N04KV_CRC32(const uint8_t *data, uint32_t size);
+
+/// @brief Programs a page of packets with a PageHeader in its spare area. The packet bitmap is filled in from the
+/// dummy byte of each packet, along with the timestamp and the CRC of the data.
+/// @param pageAddress The address of the erased page to program, between 0 and 262143.
+/// @param data Pointer to the PAGE_SIZE bytes of the page, laid out as a PageRead.
+/// @param sequence The sequence number of the page, rising with every page written and never SEQUENCE_BLANK.
+/// @param streamId The stream the page's packets belong to.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WriteLogPage(uint32_t pageAddress, const uint8_t *data, uint32_t sequence, uint8_t streamId);
+
+/// @brief Programs a page of a packed log with a PageHeader in its spare area, marking where its first packet or
+/// record starts so readers can resynchronise with the stream. The timestamp and the CRC of the data are filled in.
+/// @param pageAddress The address of the erased page to program, between 0 and 262143.
+/// @param data Pointer to the PAGE_SIZE bytes of the page, the first of which continue the last packet or record of
+/// the page before if it straddled the boundary.
+/// @param header Pointer to the page's header, with its sequence number, stream, layout, firstPacket (PACKED_NO_START
+/// if nothing starts in the page), packetEnd (0 if nothing ends in it), and dataEnd filled in.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_WritePackedPage(uint32_t pageAddress, const uint8_t *data, PageHeader *header);
+
+/// @brief Reads the packet at a byte address of a packed log, following it into the next page of the range if it
+/// straddles the boundary. An address at the end of a page's data moves to the first packet of the next page.
+/// @param address Pointer to the byte address of the packet, moved to the address of the packet after it, which
+/// wraps to the start of the range after its last page. If the packet's continuation was lost, it is moved to the
+/// first packet of the next page instead.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param packet Pointer to the packet read.
+/// @return An error code, 0 if successful and 1 if the packet could not be read
+int W25N04KV_ReadPackedPacket(uint32_t *address, const uint32_t pageRange[2], Packet *packet);
+
+/// @brief Computes the CRC-32 held in a record's header.
+/// @param type The type of the record.
+/// @param flags The flags of the record.
+/// @param payload Pointer to the record's payload.
+/// @param length Bytes of payload.
+/// @return The CRC of the type, flags, and payload
+uint32_t W25N04KV_RecordCRC(uint8_t type, uint8_t flags, const uint8_t *payload, uint32_t length);
+
+/// @brief Reads the record at a byte address of a LAYOUT_RECORDS log, following it through the pages it runs on into.
+/// An address at the end of a page's data moves to the first record starting after it. Records are iterated by
+/// calling it from the head until the address reaches the tail.
+/// @param address Pointer to the byte address of the record, moved to the address of the record after it. If the
+/// record's length is corrupt or its continuation was lost, it is moved to the first record of a later page instead.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param record Pointer to the header read.
+/// @param payload Pointer to the buffer for the payload, which is checked against the CRC. If NULL, or the payload is
+/// larger than the buffer, only the header is read, and the payload is skipped without being read.
+/// @param payloadSize Size of the payload buffer.
+/// @return An error code, 0 if successful and 1 if the record could not be read or its CRC did not match
+int W25N04KV_ReadRecord(uint32_t *address, const uint32_t pageRange[2], RecordHeader *record, uint8_t *payload,
+                        uint32_t payloadSize);
+
+/// @brief Finds the start of the first packet and the end of the last complete packet of a page, from its header, or
+/// failing that the dummy byte of each packet slot.
+/// @param pageAddress The page address, between 0 and 262143.
+/// @param first Pointer set to the offset of the first packet.
+/// @param end Pointer set to the offset of the end of the last complete packet.
+/// @return True if the page holds packets, false if not
+bool W25N04KV_FindPackets(uint32_t pageAddress, uint32_t *first, uint32_t *end);
+
+/// @brief Finds the byte address of the first packet or record starting in a page of a log. A page of a packed log
+/// which a long record fills without starting anything passes on to the first start of a later page of the range, so
+/// a head found there never lands in the middle of the record.
+/// @param pageAddress The page address, between 0 and 262143.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @return The byte address of the first start, or of the end of the data passed if no later page holds one
+uint32_t W25N04KV_FindLogStart(uint32_t pageAddress, const uint32_t pageRange[2]);
+
+/// @brief Reads only the header of a page, so its state can be decided without reading its data.
+/// @param pageAddress The address of the page to read, between 0 and 262143.
+/// @param header Pointer to the struct filled with the header. Its version is not PAGE_HEADER_VERSION if the page has
+/// no header, and its sequence is SEQUENCE_BLANK if the page is erased.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_ReadPageHeader(uint32_t pageAddress, PageHeader *header);
+
+/// @brief Reads a page of packets and its header, checking the data against the CRC in the header.
+/// @param pageAddress The address of the page to read, between 0 and 262143.
+/// @param data Pointer to the buffer of PAGE_SIZE bytes to store the page's data.
+/// @param header Pointer to the struct filled with the header.
+/// @return An error code, 0 if successful and 1 if failed, the page has no header, or the data does not match its CRC
+int W25N04KV_ReadLogPage(uint32_t pageAddress, uint8_t *data, PageHeader *header);
+
+/// @brief Moves a log's tail past the pages written since a known position, which carry sequence numbers from
+/// nextSequence on, stopping at the first page which does not. The head moves past any blocks erased since then.
+/// @param buf Pointer to the circular buffer struct, holding the known head and tail.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param nextSequence Pointer to the sequence number of the next page written after the known position, set to the
+/// sequence number following the newest page.
+void W25N04KV_RollForwardLog(CircularBuffer *buf, uint32_t pageRange[2], uint32_t *nextSequence);
+
+/// @brief Wraps a page of a log around to the start of its range, and moves it past bad blocks, as the writer does.
+/// @param pageAddress The page address, which may be the end of the range.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @return The page the writer programs next, the end of the range if it holds no good block
+uint32_t W25N04KV_WrapLogPage(uint32_t pageAddress, const uint32_t pageRange[2]);
+
+/// @brief Loads the newest copy of the superblock whose CRC matches, from either block of the pair from SUPER_BLOCK.
+/// @param super Pointer to the struct filled with the copy.
+/// @return An error code, 0 if a copy was loaded and 1 if neither block holds one
+int W25N04KV_LoadSuperblock(Superblock *super);
+
+/// @brief Commits a checkpoint of a log to the superblock, along with the bad block count and a summary of the erase
+/// counts. Each commit programs one page, and the other block of the pair is only erased once the active one is full.
+/// Writers call it periodically, as mount rolls forward through every page written since the last commit.
+/// @param buf Pointer to the circular buffer struct, holding the head and tail of the log.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param nextSequence The sequence number of the next page the writer will program.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_CommitSuperblock(const CircularBuffer *buf, const uint32_t pageRange[2], uint32_t nextSequence);
+
+/// @brief Finds a log's head and tail at boot. The superblock is loaded and rolled forward if it was committed for the
+/// same range, so mount takes a few page reads at any fill level. Otherwise the range is searched with SCAN_BINARY.
+/// @param buf Pointer to the circular buffer struct to store the head and tail.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param nextSequence Pointer set to the sequence number the writer should stamp on the next page.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_MountLog(CircularBuffer *buf, uint32_t pageRange[2], uint32_t *nextSequence);
+
+/// @brief Opens the log writer for a page range. The writer's state and unfinished page are kept in the backup SRAM,
+/// so after a watchdog or software reset it resumes from there without reading the flash beyond one page header.
+/// After a power loss, or if the state is for another range or stream, the log is mounted with W25N04KV_MountLog.
+/// The blocks of the range are claimed from the allocator in place of those of the log opened before.
+/// @param pageRange Array of two page addresses, the start and end of the page range the log wraps around in.
+/// @param streamId Stream stamped in the header of every page written.
+/// @param layout LAYOUT_SLOTTED to program a page every PACKETS_PER_PAGE packets, LAYOUT_PACKED to fill every byte
+/// of each page, with packets straddling the boundaries between pages, or LAYOUT_RECORDS to pack records instead.
+/// @param warm Pointer set to true if the writer resumed from the backup SRAM, false if the log was mounted.
+/// @return An error code, 0 if successful and 1 if failed or a block of the range is allocated to another owner
+int W25N04KV_OpenLog(uint32_t pageRange[2], uint8_t streamId, LogLayout layout, bool *warm);
+
+/// @brief Appends a packet to the unfinished page, which is programmed once no more packets fit. A packed packet
+/// which runs past the end of the page is carried on at the start of the next page. The writer moves the write head to
+/// each page before programming it, so blocks are erased ahead of it, and commits the superblock each time it fills
+/// one. A page which failed to program is kept and programmed again by the next append.
+/// @param packet Pointer to the packet, whose dummy byte must not be 0xFF. LAYOUT_RECORDS logs only take records.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_AppendPacket(const Packet *packet);
+
+/// @brief Appends a record to a LAYOUT_RECORDS log, running on through as many pages as it needs. The record's header
+/// is filled in from its type, flags, and payload.
+/// @param type Kind of record, chosen by the writer.
+/// @param flags Bits chosen by the writer.
+/// @param payload Pointer to the payload, may be NULL if the length is 0.
+/// @param length Bytes of payload, up to RECORD_MAX_PAYLOAD.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_AppendRecord(uint8_t type, uint8_t flags, const uint8_t *payload, uint32_t length);
+
+/// @brief Programs the unfinished page even though some of its packet slots are empty. The next packet appended
+/// starts a new page.
+/// @return An error code, 0 if successful and 1 if failed
+int W25N04KV_FlushLog(void);
+
+/// @brief Fetches the position of the log writer.
+/// @param buf Pointer to the circular buffer struct to store the head and tail of the packets programmed.
+/// @param pendingBytes Pointer set to the number of bytes appended to the unfinished page.
+void W25N04KV_GetLogPosition(CircularBuffer *buf, uint16_t *pendingBytes);
 
-/// @brief Performs a full device erase, clearing all data in the main data array.
-void W25N04KV_EraseDevice(void);
+/// @brief Invalidates the log writer state in the backup SRAM, so the next W25N04KV_OpenLog mounts the log, and hands
+/// the blocks of its range back to the allocator. Called by W25N04KV_EraseDevice, as the pages the state points at
+/// are erased.
+void W25N04KV_DiscardWarmLog(void);
 
 /// @brief Finds the head and tail positions in a circular buffer within the specified page range.
+/// SCAN_LINEAR reads every page of the range. SCAN_BINARY needs every page to be stamped with a sequence number, and
+/// the log to be written in order through the range, wrapping around to its start with erased blocks ahead of the
+/// newest page. It binary searches whole blocks, rounding the range out to block boundaries, and only scans the pages
+/// of the newest block.
 /// @param buf Pointer to the circular buffer struct.
-/// @param pageRange Array of two uint8_t values representing the start and end of the page range to search for head and
-/// tail.
-void W25N04KV_FindHeadTail(CircularBuffer *buf, uint8_t pageRange[2]);
+/// @param pageRange Array of two page addresses, the start and end of the page range to search for head and tail.
+/// The entire flash is searched if NULL.
+/// @param mode How to search the range.
+void W25N04KV_FindHeadTail(CircularBuffer *buf, uint32_t pageRange[2], HeadTailMode mode);
 
 #endif /* FLASH_H_ */
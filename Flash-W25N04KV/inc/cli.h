@@ -19,8 +19,32 @@ void W25N04KV_ListenCommands(void);
 
 // Testing functions
 void W25N04KV_ResetDeviceCmd(void);
+void W25N04KV_ClockTuneCmd(void);
+void W25N04KV_FlashStatsCmd(void);
+void W25N04KV_BadBlocksCmd(void);
+void W25N04KV_BBMLUTCmd(void);
+void W25N04KV_ECCStatsCmd(void);
+void W25N04KV_WearStatsCmd(void);
 void W25N04KV_TestRegistersCmd(void);
 void W25N04KV_TestDataCmd(void);
 void W25N04KV_TestHeadTailCmd(void);
+void W25N04KV_TestDMACmd(void);
+void W25N04KV_TestEncodeCmd(void);
+void W25N04KV_TestChainCmd(void);
+void W25N04KV_TestMapCmd(void);
+void W25N04KV_TestStreamCmd(void);
+void W25N04KV_TestManagerCmd(void);
+void W25N04KV_TestGatherCmd(void);
+void W25N04KV_TestECCCmd(void);
+void W25N04KV_TestEraseAheadCmd(void);
+void W25N04KV_TestDirtyCmd(void);
+void W25N04KV_TestWearCmd(void);
+void W25N04KV_TestFTLCmd(void);
+void W25N04KV_TestCopyCmd(void);
+void W25N04KV_TestPageHeaderCmd(void);
+void W25N04KV_TestSuperblockCmd(void);
+void W25N04KV_TestWarmLogCmd(void);
+void W25N04KV_TestPackedLogCmd(void);
+void W25N04KV_TestRecordLogCmd(void);
 
 #endif /* CLI_H_ */
\ No newline at end of file
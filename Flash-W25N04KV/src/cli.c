@@ -12,6 +12,7 @@
 //! Macros for CRC codes of different commands
 #define HELP_CMD 0x8875cac
 #define RESET_DEVICE_CMD 0xa730c915
+#define VERIFY_SUBCMD 0xa1252a43
 #define REGISTER_TEST_CMD 0x8f0add03
 
 #define DATA_TEST_CMD 0xe0220641
@@ -21,6 +22,32 @@
 #define QUAD_IO_SUBCMD 0xc52ddfae
 
 #define HEAD_TAIL_TEST 0x84c67266
+#define DMA_TEST_CMD 0xd820ca57
+#define ENCODE_TEST_CMD 0xea50c99
+#define CHAIN_TEST_CMD 0xce1a7925
+#define MAP_TEST_CMD 0xc8456a36
+#define STREAM_TEST_CMD 0xec7af400
+#define MANAGER_TEST_CMD 0x5d646fda
+#define GATHER_TEST_CMD 0xdd02f1e3
+#define ECC_TEST_CMD 0x97d109f
+#define ERASE_AHEAD_TEST_CMD 0xd53775b1
+#define DIRTY_TEST_CMD 0xd1538ffa
+#define WEAR_TEST_CMD 0x4181b553
+#define FTL_TEST_CMD 0xd4dd07e9
+#define COPY_TEST_CMD 0x8a03dd5f
+#define HEADER_TEST_CMD 0xf6e9b72e
+#define SUPER_TEST_CMD 0xb79ec4ca
+#define WARM_TEST_CMD 0x617d8db4
+#define PACKED_TEST_CMD 0xc96ee976
+#define RECORD_TEST_CMD 0xbeda5c77
+
+#define CLOCK_TUNE_CMD 0xfb3b1b78
+#define RUN_SUBCMD 0x5076a4c0
+#define FLASH_STATS_CMD 0xe3f48e20
+#define BAD_BLOCKS_CMD 0xf864eb1a
+#define BBM_LUT_CMD 0xb36ee22e
+#define ECC_STATS_CMD 0x3e90a73a
+#define WEAR_STATS_CMD 0xac0ad504
 
 //! Utility functions
 
@@ -128,10 +155,20 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 // Task which runs the CLI
 void W25N04KV_InitCLI(void)
 {
-    // Quick restart for the flash
+    // Quick restart for the flash, holding the bus so the manager waits until the mounts are done
     HAL_Delay(1000);
+    W25N04KV_AcquireBus();
     W25N04KV_ReadJEDECID();
     W25N04KV_ResetDeviceSoftware();
+    W25N04KV_MountBadBlocks();
+    W25N04KV_MountWear();
+    W25N04KV_MountDirtyBlocks();
+    W25N04KV_MountFTL();
+    if (W25N04KV_InitClock() != 0)
+    {
+        printf("Error: Calibrated QSPI clock not applied, using the default clock\r\n");
+    }
+    W25N04KV_ReleaseBus();
 
     // Begin listening for user input
     char receivedCommand[64]; // Buffer to track received command
@@ -192,6 +229,10 @@ void FLASH_RunCommand(char *cmdStr)
         FLASH_GetHelpCmd();
         break;
     case RESET_DEVICE_CMD:
+        // Only blank check clean blocks if asked to
+        uint32_t blankCheck = (paramCount >= 1 && crc32(params[0], strlen(params[0])) == VERIFY_SUBCMD);
+        osMessageQueuePut(cmdParamQueueHandle, &blankCheck, 0, 0);
+
         // Create a new thread to run the reset-device command
         const osThreadAttr_t resetTaskAttr = {.priority = osPriorityHigh};
         if (osThreadNew(W25N04KV_ResetDeviceCmd, NULL, &resetTaskAttr) == NULL)
@@ -259,6 +300,154 @@ void FLASH_RunCommand(char *cmdStr)
         if (osThreadNew(W25N04KV_TestHeadTailCmd, NULL, &headTailTaskAttr) == NULL)
             printf("Failed to generate head-tail-test task\r\n");
         break;
+    case DMA_TEST_CMD:
+        // Create a new thread to run the dma-test command
+        const osThreadAttr_t dmaTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestDMACmd, NULL, &dmaTaskAttr) == NULL)
+            printf("Failed to generate dma-test task\r\n");
+        break;
+    case ENCODE_TEST_CMD:
+        // Create a new thread to run the encode-test command
+        const osThreadAttr_t encodeTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestEncodeCmd, NULL, &encodeTaskAttr) == NULL)
+            printf("Failed to generate encode-test task\r\n");
+        break;
+    case CHAIN_TEST_CMD:
+        // Create a new thread to run the chain-test command
+        const osThreadAttr_t chainTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestChainCmd, NULL, &chainTaskAttr) == NULL)
+            printf("Failed to generate chain-test task\r\n");
+        break;
+    case MAP_TEST_CMD:
+        // Create a new thread to run the map-test command
+        const osThreadAttr_t mapTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestMapCmd, NULL, &mapTaskAttr) == NULL)
+            printf("Failed to generate map-test task\r\n");
+        break;
+    case STREAM_TEST_CMD:
+        // Create a new thread to run the stream-test command
+        const osThreadAttr_t streamTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestStreamCmd, NULL, &streamTaskAttr) == NULL)
+            printf("Failed to generate stream-test task\r\n");
+        break;
+    case CLOCK_TUNE_CMD:
+        // Only recalibrate if asked to, otherwise report the persisted result
+        uint32_t runTuning = (paramCount >= 1 && crc32(params[0], strlen(params[0])) == RUN_SUBCMD);
+        osMessageQueuePut(cmdParamQueueHandle, &runTuning, 0, 0);
+
+        // Create a new thread to run the clock-tune command
+        const osThreadAttr_t tuneTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_ClockTuneCmd, NULL, &tuneTaskAttr) == NULL)
+            printf("Failed to generate clock-tune task\r\n");
+        break;
+    case MANAGER_TEST_CMD:
+        // Create a new thread to run the manager-test command
+        const osThreadAttr_t managerTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestManagerCmd, NULL, &managerTaskAttr) == NULL)
+            printf("Failed to generate manager-test task\r\n");
+        break;
+    case GATHER_TEST_CMD:
+        // Create a new thread to run the gather-test command
+        const osThreadAttr_t gatherTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestGatherCmd, NULL, &gatherTaskAttr) == NULL)
+            printf("Failed to generate gather-test task\r\n");
+        break;
+    case ERASE_AHEAD_TEST_CMD:
+        // Create a new thread to run the erase-ahead-test command
+        const osThreadAttr_t eraseAheadTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestEraseAheadCmd, NULL, &eraseAheadTaskAttr) == NULL)
+            printf("Failed to generate erase-ahead-test task\r\n");
+        break;
+    case DIRTY_TEST_CMD:
+        // Create a new thread to run the dirty-test command
+        const osThreadAttr_t dirtyTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestDirtyCmd, NULL, &dirtyTestTaskAttr) == NULL)
+            printf("Failed to generate dirty-test task\r\n");
+        break;
+    case WEAR_TEST_CMD:
+        // Create a new thread to run the wear-test command
+        const osThreadAttr_t wearTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestWearCmd, NULL, &wearTestTaskAttr) == NULL)
+            printf("Failed to generate wear-test task\r\n");
+        break;
+    case FTL_TEST_CMD:
+        // Create a new thread to run the ftl-test command
+        const osThreadAttr_t ftlTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestFTLCmd, NULL, &ftlTestTaskAttr) == NULL)
+            printf("Failed to generate ftl-test task\r\n");
+        break;
+    case COPY_TEST_CMD:
+        // Create a new thread to run the copy-test command
+        const osThreadAttr_t copyTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestCopyCmd, NULL, &copyTestTaskAttr) == NULL)
+            printf("Failed to generate copy-test task\r\n");
+        break;
+    case HEADER_TEST_CMD:
+        // Create a new thread to run the header-test command
+        const osThreadAttr_t headerTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestPageHeaderCmd, NULL, &headerTestTaskAttr) == NULL)
+            printf("Failed to generate header-test task\r\n");
+        break;
+    case SUPER_TEST_CMD:
+        // Create a new thread to run the super-test command
+        const osThreadAttr_t superTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestSuperblockCmd, NULL, &superTestTaskAttr) == NULL)
+            printf("Failed to generate super-test task\r\n");
+        break;
+    case WARM_TEST_CMD:
+        // Create a new thread to run the warm-test command
+        const osThreadAttr_t warmTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestWarmLogCmd, NULL, &warmTestTaskAttr) == NULL)
+            printf("Failed to generate warm-test task\r\n");
+        break;
+    case PACKED_TEST_CMD:
+        // Create a new thread to run the packed-test command
+        const osThreadAttr_t packedTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestPackedLogCmd, NULL, &packedTestTaskAttr) == NULL)
+            printf("Failed to generate packed-test task\r\n");
+        break;
+    case RECORD_TEST_CMD:
+        // Create a new thread to run the record-test command
+        const osThreadAttr_t recordTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_TestRecordLogCmd, NULL, &recordTestTaskAttr) == NULL)
+            printf("Failed to generate record-test task\r\n");
+        break;
+    case ECC_TEST_CMD:
+        // Create a new thread to run the ecc-test command
+        const osThreadAttr_t eccTestTaskAttr = {.priority = osPriorityHigh, .stack_size = 1024 * 4};
+        if (osThreadNew(W25N04KV_TestECCCmd, NULL, &eccTestTaskAttr) == NULL)
+            printf("Failed to generate ecc-test task\r\n");
+        break;
+    case FLASH_STATS_CMD:
+        // Create a new thread to run the flash-stats command
+        const osThreadAttr_t statsTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_FlashStatsCmd, NULL, &statsTaskAttr) == NULL)
+            printf("Failed to generate flash-stats task\r\n");
+        break;
+    case BAD_BLOCKS_CMD:
+        // Create a new thread to run the bad-blocks command
+        const osThreadAttr_t badBlocksTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_BadBlocksCmd, NULL, &badBlocksTaskAttr) == NULL)
+            printf("Failed to generate bad-blocks task\r\n");
+        break;
+    case BBM_LUT_CMD:
+        // Create a new thread to run the bbm-lut command
+        const osThreadAttr_t lutTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_BBMLUTCmd, NULL, &lutTaskAttr) == NULL)
+            printf("Failed to generate bbm-lut task\r\n");
+        break;
+    case ECC_STATS_CMD:
+        // Create a new thread to run the ecc-stats command
+        const osThreadAttr_t eccStatsTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_ECCStatsCmd, NULL, &eccStatsTaskAttr) == NULL)
+            printf("Failed to generate ecc-stats task\r\n");
+        break;
+    case WEAR_STATS_CMD:
+        // Create a new thread to run the wear-stats command
+        const osThreadAttr_t wearStatsTaskAttr = {.priority = osPriorityHigh, .stack_size = 512 * 4};
+        if (osThreadNew(W25N04KV_WearStatsCmd, NULL, &wearStatsTaskAttr) == NULL)
+            printf("Failed to generate wear-stats task\r\n");
+        break;
     default:
         printf("Invalid Command \"%s\" (CRC32: 0x%x)\r\n", cmdStr, cmdHash);
     }
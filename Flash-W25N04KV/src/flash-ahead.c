@@ -0,0 +1,167 @@
+/*
+ * flash-ahead.c
+ *
+ * Contains the erase-ahead task, which keeps the blocks after the write
+ * head of a circular log erased, so a writer crossing into a new block
+ * only waits for its program and not for an erase. Erases are only made
+ * while no reads or programs are waiting for the flash manager, so
+ * foreground writes are never delayed by more than an erase already on
+ * the bus. The task holds the bus for each erase, so a writer, which must
+ * hold the bus to program, never writes to a block between the check and
+ * the erase. The head is only locked while it is read or moved, never
+ * while the bus is awaited, as the writer moves it with the bus held.
+ *
+ * Blocks ahead of the head hold the oldest data of the log, which is lost
+ * once they are erased, as it would be when the writer reached them. They
+ * are taken from the log's own page range, wrapping around as the log does,
+ * so blocks of other owners are never erased.
+ */
+
+#include "W25N04KV.h"
+
+//! Erase-Ahead State
+
+static osSemaphoreId_t headMoved = NULL;               // Released when the write head moves
+static osMutexId_t writeHeadMutex = NULL;              // Held while the head is moved or read
+static volatile uint16_t writeHeadBlock = BLOCK_COUNT; // Block being written, BLOCK_COUNT if no log is being written
+static uint32_t writeRange[2] = {0, 0};                // Page range of the log being written
+static uint32_t headMoves = 0;                         // Times the head has moved, so a stale pick is caught
+
+// Steps to the next good block of the log's range, wrapping around to its start after the last
+static uint16_t FLASH_NextRangeBlock(uint16_t blockAddress)
+{
+    uint32_t pageRange[2] = {writeRange[0], writeRange[1]};
+    uint32_t page = W25N04KV_WrapLogPage((blockAddress + 1) * PAGES_PER_BLOCK, pageRange);
+
+    return (page < pageRange[1]) ? page / PAGES_PER_BLOCK : BLOCK_COUNT;
+}
+
+// Finds the first dirty block of those kept erased ahead of the head, BLOCK_COUNT if they are all erased. Called with
+// the head locked
+static uint16_t FLASH_NextDirtyBlock(void)
+{
+    uint16_t block = writeHeadBlock;
+
+    for (int i = 0; i < ERASE_AHEAD_BLOCKS && block < DATA_BLOCKS; i++)
+    {
+        block = FLASH_NextRangeBlock(block);
+        if (block < DATA_BLOCKS && block != writeHeadBlock && W25N04KV_IsDirtyBlock(block))
+        {
+            return block;
+        }
+    }
+
+    return BLOCK_COUNT;
+}
+
+// Checks whether reads or programs are waiting for the flash manager
+static bool FLASH_IsForegroundPending(void)
+{
+    FlashRequestStats readStats, programStats;
+    W25N04KV_GetRequestStats(FLASH_REQUEST_READ, &readStats);
+    W25N04KV_GetRequestStats(FLASH_REQUEST_PROGRAM, &programStats);
+
+    return readStats.depth > 0 || programStats.depth > 0;
+}
+
+//! Erase-Ahead Task
+
+// Erases dirty blocks of the log ahead of the write head, one at a time, whenever the bus is otherwise idle
+void W25N04KV_EraseAhead(void *argument)
+{
+    writeHeadMutex = osMutexNew(NULL);
+    headMoved = osSemaphoreNew(1, 0, NULL);
+
+    /* Infinite loop */
+    for (;;)
+    {
+        // Sleep until the head moves, checking again periodically in case an erase failed
+        osSemaphoreAcquire(headMoved, ERASE_AHEAD_INTERVAL);
+
+        // Block is picked again after each erase, as the head may have moved on
+        for (;;)
+        {
+            osMutexAcquire(writeHeadMutex, osWaitForever);
+            uint32_t moves = headMoves;
+            uint16_t block = FLASH_NextDirtyBlock();
+            osMutexRelease(writeHeadMutex);
+            if (block >= DATA_BLOCKS)
+            {
+                break;
+            }
+
+            // Foreground requests are let through before each erase
+            while (FLASH_IsForegroundPending())
+            {
+                osDelay(1);
+            }
+
+            // Once the bus is held nothing more is written to the block, but while it was awaited the head may have
+            // moved onto the block, or the log been closed and its blocks handed to another owner
+            W25N04KV_AcquireBus();
+            osMutexAcquire(writeHeadMutex, osWaitForever);
+            bool stale = headMoves != moves;
+            osMutexRelease(writeHeadMutex);
+            int error = stale ? 0 : W25N04KV_RequestErase(block); // Served in place, as the task holds the bus
+            W25N04KV_ReleaseBus();
+            if (error != 0)
+            {
+                break; // Failed erase is tried again at the next check
+            }
+        }
+    }
+
+    // In case we accidentally exit from task loop
+    osThreadTerminate(NULL);
+}
+
+//! Write Head
+
+// Records the block being written and wakes the task, erasing the block first if the task has not reached it yet
+int W25N04KV_AdvanceWriteHead(uint32_t pageAddress, const uint32_t pageRange[2])
+{
+    uint16_t block = pageAddress / PAGES_PER_BLOCK;
+    bool erase = false;
+    int error = 0;
+
+    if (writeHeadMutex != NULL)
+    {
+        osMutexAcquire(writeHeadMutex, osWaitForever);
+    }
+
+    // Pages past the data blocks stop the log, so nothing more is erased
+    headMoves++;
+    writeHeadBlock = (block < DATA_BLOCKS) ? block : BLOCK_COUNT;
+    writeRange[0] = pageRange[0];
+    writeRange[1] = pageRange[1];
+    if (block < DATA_BLOCKS)
+    {
+        // First page of a block can only be programmed once the block has been erased
+        if (W25N04KV_IsBadBlock(block))
+        {
+            error = 1;
+        }
+        else
+        {
+            erase = pageAddress % PAGES_PER_BLOCK == 0 && W25N04KV_IsDirtyBlock(block);
+        }
+    }
+
+    if (writeHeadMutex != NULL)
+    {
+        osMutexRelease(writeHeadMutex);
+    }
+
+    // Head is released before the erase, as the task may hold the bus the erase waits for. It never picks the block
+    // under the head, so the block cannot be erased twice
+    if (erase)
+    {
+        error = W25N04KV_RequestErase(block);
+    }
+    if (headMoved != NULL)
+    {
+        osSemaphoreRelease(headMoved);
+    }
+
+    return error;
+}
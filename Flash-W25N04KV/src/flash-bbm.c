@@ -0,0 +1,164 @@
+/*
+ * flash-bbm.c
+ *
+ * Contains code which manages the on-chip bad block management (BBM)
+ * look-up table. Once a block is linked to a replacement in the table,
+ * the flash redirects every access to it, so no software indirection is
+ * needed. Replacements are taken from spare blocks reserved below the
+ * bad block table.
+ *
+ * Pages programmed before a failure are copied to the same pages of the
+ * replacement before it is linked, while the failed block can still be
+ * read, so owners addressing the block by page keep their data.
+ */
+
+#include "W25N04KV.h"
+
+#define BBM_SPARE_FIRST (BBT_BLOCK - BBM_SPARE_BLOCKS) // First spare block used as a replacement
+
+//! Look-up Table Instructions
+
+// Reads the 4 byte entries of the table, each a logical then a physical block address (MSB first)
+int W25N04KV_ReadBBMLUT(BBMEntry entries[BBM_LUT_ENTRIES])
+{
+    uint8_t lutResponse[BBM_LUT_ENTRIES * 4];
+    FlashInstruction readBBMLUT = {
+        .opCode = READ_BBM_LUT,
+        .dummyClocks = 8,
+        .dataMode = RECEIVE,
+        .dataBuf = lutResponse,
+        .dataSize = sizeof(lutResponse),
+    };
+
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_QSPIInstruct(&readBBMLUT) != 0)
+    {
+        return 1;
+    }
+
+    for (int i = 0; i < BBM_LUT_ENTRIES; i++)
+    {
+        uint16_t logical = (lutResponse[i * 4] << 8) | lutResponse[i * 4 + 1];
+        uint16_t physical = (lutResponse[i * 4 + 2] << 8) | lutResponse[i * 4 + 3];
+        entries[i].logicalBlock = logical & (BLOCK_COUNT - 1);
+        entries[i].physicalBlock = physical & (BLOCK_COUNT - 1);
+        entries[i].enabled = (logical & BBM_LUT_ENABLE) != 0;
+        entries[i].invalid = (logical & BBM_LUT_INVALID) != 0;
+    }
+
+    return 0;
+}
+
+// Sends the logical then physical block address (MSB first) to add an entry to the table
+int W25N04KV_LinkBlocks(uint16_t logicalBlock, uint16_t physicalBlock)
+{
+    uint8_t link[4] = {logicalBlock >> 8, logicalBlock & 0xFF, physicalBlock >> 8, physicalBlock & 0xFF};
+    FlashInstruction badBlockManagement = {
+        .opCode = BAD_BLOCK_MANAGEMENT,
+        .dataMode = TRANSMIT,
+        .dataBuf = link,
+        .dataSize = sizeof(link),
+    };
+
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteEnable() != 0 ||
+        W25N04KV_QSPIInstruct(&badBlockManagement) != 0)
+    {
+        return 1;
+    }
+
+    return W25N04KV_AwaitNotBusy();
+}
+
+//! Remapping
+
+// Counts entries which are not in use
+int W25N04KV_GetFreeBBMEntries(void)
+{
+    BBMEntry entries[BBM_LUT_ENTRIES];
+    if (W25N04KV_ReadBBMLUT(entries) != 0)
+    {
+        return -1;
+    }
+
+    int freeEntries = 0;
+    for (int i = 0; i < BBM_LUT_ENTRIES; i++)
+    {
+        freeEntries += entries[i].enabled ? 0 : 1;
+    }
+
+    return freeEntries;
+}
+
+// Erases a spare and copies the first pages of a failed block to the same pages of it. A page the ECC cannot correct
+// is left erased, as the rest are still worth keeping. Fails only if the spare itself fails
+static int FLASH_CopyToSpare(uint16_t blockAddress, uint16_t spare, uint8_t keepPages)
+{
+    FlashECCStatus ecc;
+
+    if (W25N04KV_EraseBlock(spare) != 0)
+    {
+        return 1;
+    }
+
+    W25N04KV_MarkDirtyBlock(spare);
+    for (uint8_t page = 0; page < keepPages; page++)
+    {
+        if (W25N04KV_ReadPageECC(blockAddress * PAGES_PER_BLOCK + page, &ecc) != 0 || ecc >= ECC_UNCORRECTABLE)
+        {
+            continue;
+        }
+
+        // P-FAIL is cleared as each program starts, so a failure left by the original block is not seen here
+        if (W25N04KV_WriteEnable() != 0 || W25N04KV_WriteExecute(spare * PAGES_PER_BLOCK + page) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0 || (W25N04KV_ReadRegister(3) & STATUS_P_FAIL))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Links a failed block to the first spare block which is good and not already a replacement, once the pages to keep
+// have been copied to it
+int W25N04KV_RemapBlock(uint16_t blockAddress, uint8_t keepPages)
+{
+    BBMEntry entries[BBM_LUT_ENTRIES];
+    if (W25N04KV_ReadBBMLUT(entries) != 0 || (W25N04KV_ReadRegister(3) & STATUS_LUT_FULL))
+    {
+        return 1;
+    }
+
+    // Block already linked has failed in its replacement, a second entry for it would be ignored
+    for (int i = 0; i < BBM_LUT_ENTRIES; i++)
+    {
+        if (entries[i].enabled && entries[i].logicalBlock == blockAddress)
+        {
+            return 1;
+        }
+    }
+
+    for (uint16_t spare = BBM_SPARE_FIRST; spare < BBT_BLOCK; spare++)
+    {
+        bool used = W25N04KV_IsBadBlock(spare) || spare == blockAddress;
+        for (int i = 0; i < BBM_LUT_ENTRIES && !used; i++)
+        {
+            used = entries[i].enabled && entries[i].physicalBlock == spare;
+        }
+        if (used)
+        {
+            continue;
+        }
+
+        // Spare which fails while being prepared is retired, and the next one is tried
+        if (FLASH_CopyToSpare(blockAddress, spare, keepPages) != 0)
+        {
+            W25N04KV_MarkBadBlock(spare);
+            continue;
+        }
+
+        // Accesses to the failed block now reach the spare
+        return W25N04KV_LinkBlocks(blockAddress, spare);
+    }
+
+    return 1; // No spare block left
+}
@@ -0,0 +1,173 @@
+/*
+ * flash-bbt.c
+ *
+ * Contains code which tracks bad blocks. The factory bad block markers
+ * are read once into a bitmap, which is persisted in a reserved block so
+ * later boots skip the scan. Blocks which fail a program or erase are
+ * added to the bitmap, and bad blocks are never erased or written.
+ *
+ * Each update of the table is written to the next page of the reserved
+ * block, and the last page holding a valid table is the current one. An
+ * update cut off by a power loss leaves a page which is not blank, so the
+ * next update is written after it.
+ */
+
+#include "W25N04KV.h"
+
+//! Bad Block Table State
+
+static uint8_t badBlocks[BLOCK_COUNT / 8]; // Bitmap with 1 bit per block, set if the block is bad
+static int tablePage = -1;                 // Page of BBT_BLOCK holding the current table, -1 if not persisted
+static int nextTablePage = 0;              // Page of BBT_BLOCK the next update is written to, after every page used
+
+// Checks a block's bit in the bitmap
+bool W25N04KV_IsBadBlock(uint16_t blockAddress)
+{
+    return (badBlocks[blockAddress / 8] >> (blockAddress % 8)) & 1;
+}
+
+//! Persistence
+
+// Writes the table to the page after the current one, erasing the block once every page has been used
+static int FLASH_PersistBadBlocks(void)
+{
+    uint32_t magic = BBT_MAGIC;
+    FlashSegment table[] = {
+        {.data = (uint8_t *)&magic, .size = sizeof(magic)},
+        {.data = badBlocks, .size = sizeof(badBlocks)},
+    };
+
+    int page = nextTablePage;
+    if (page >= PAGES_PER_BLOCK)
+    {
+        if (W25N04KV_EraseBlock(BBT_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+        tablePage = -1;
+        page = 0;
+    }
+
+    // Page is used even if the program fails, so it is never programmed twice
+    nextTablePage = page + 1;
+    if (W25N04KV_QuadWriteBufferSegments(table, 2, 0, true) != 0 ||
+        W25N04KV_WriteExecute(BBT_BLOCK * PAGES_PER_BLOCK + page) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    tablePage = page;
+    return 0;
+}
+
+// Loads the table from the last page of BBT_BLOCK which holds one, stepping past pages cut off by a power loss
+static int FLASH_LoadBadBlocks(void)
+{
+    uint32_t magic;
+
+    for (int page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        uint32_t pageAddress = BBT_BLOCK * PAGES_PER_BLOCK + page;
+        W25N04KV_ReadPage(pageAddress);
+        if (W25N04KV_FastQuadReadIO(0, sizeof(magic), (uint8_t *)&magic) == 0 && magic == BBT_MAGIC)
+        {
+            tablePage = page;
+        }
+        else if (W25N04KV_IsBlankPage(pageAddress))
+        {
+            break; // Pages after the last one written are erased
+        }
+        nextTablePage = page + 1;
+    }
+
+    if (tablePage < 0)
+    {
+        return 1; // No table persisted
+    }
+
+    W25N04KV_ReadPage(BBT_BLOCK * PAGES_PER_BLOCK + tablePage);
+    return W25N04KV_FastQuadReadIO(sizeof(magic), sizeof(badBlocks), badBlocks);
+}
+
+//! Bad Block Table
+
+// Loads the persisted table, or scans every block's factory marker on the first boot
+int W25N04KV_MountBadBlocks(void)
+{
+    memset(badBlocks, 0, sizeof(badBlocks));
+    tablePage = -1;
+    nextTablePage = 0;
+    if (FLASH_LoadBadBlocks() == 0)
+    {
+        return 0;
+    }
+
+    // Factory markers are only intact in blocks which have never been erased
+    printf("Scanning for bad blocks...\r\n");
+    for (uint16_t block = 0; block < BLOCK_COUNT; block++)
+    {
+        uint8_t marker = BAD_BLOCK_MARKER;
+        if (W25N04KV_ReadPage(block * PAGES_PER_BLOCK) != 0 || W25N04KV_FastQuadReadIO(PAGE_SIZE, 1, &marker) != 0)
+        {
+            return 1;
+        }
+        if (marker != BAD_BLOCK_MARKER)
+        {
+            badBlocks[block / 8] |= 1 << (block % 8);
+        }
+    }
+
+    // Table cannot be persisted in a bad block, so it is rebuilt every boot instead
+    if (W25N04KV_IsBadBlock(BBT_BLOCK))
+    {
+        return 0;
+    }
+
+    // Reserved block starts with the first table written
+    if (W25N04KV_EraseBlock(BBT_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+    nextTablePage = 0;
+    return FLASH_PersistBadBlocks();
+}
+
+// Sets a block's bit in the bitmap, then persists the updated table
+int W25N04KV_MarkBadBlock(uint16_t blockAddress)
+{
+    if (W25N04KV_IsBadBlock(blockAddress))
+    {
+        return 0; // Already marked
+    }
+
+    badBlocks[blockAddress / 8] |= 1 << (blockAddress % 8);
+    if (W25N04KV_IsBadBlock(BBT_BLOCK))
+    {
+        return 1;
+    }
+
+    return FLASH_PersistBadBlocks();
+}
+
+// Walks forward from a block until a good one is found
+uint16_t W25N04KV_NextGoodBlock(uint16_t blockAddress)
+{
+    while (blockAddress < BLOCK_COUNT && W25N04KV_IsBadBlock(blockAddress))
+    {
+        blockAddress++;
+    }
+
+    return blockAddress;
+}
+
+// Counts set bits in the bitmap
+uint16_t W25N04KV_GetBadBlockCount(void)
+{
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < sizeof(badBlocks); i++)
+    {
+        count += __builtin_popcount(badBlocks[i]);
+    }
+
+    return count;
+}
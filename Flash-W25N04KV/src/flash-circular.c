@@ -0,0 +1,690 @@
+/*
+ * flash-circular.c
+ *
+ * Contains code which finds the head and tail of a circular buffer of
+ * packets. A linear scan reads every page of the range. A log written in
+ * order can instead be searched: each page is stamped with a sequence
+ * number in its spare area, so the written pages form a single run of
+ * rising numbers (wrapping around the range) with erased blocks ahead of
+ * the newest page. The run's boundaries are binary searched a block at a
+ * time, and only the pages of the newest block are scanned.
+ *
+ * Pages written with W25N04KV_WriteLogPage carry a PageHeader in their
+ * spare area, whose sequence number is the one searched, and whose bitmap
+ * says which packet slots are in use. Either way, a page's packets are
+ * found from its header, or failing that the dummy byte of each packet,
+ * rather than reading all 2048 bytes.
+ *
+ * Packed logs have no slots. Packets follow each other through the page
+ * and straddle into the next, and each header holds the offset of the
+ * first packet starting in its page, so readers can resynchronise with
+ * the packet stream at any page.
+ */
+
+#include "W25N04KV.h"
+
+#define PAGE_HEADER_COLUMN (PAGE_SIZE + 16)                      // Kept clear of the table tags from spare byte 4
+#define LOG_BLOCK_BYTES ((uint32_t)PAGES_PER_BLOCK * PAGE_SIZE) // Byte addresses spanned by each block
+
+//! Sequence Numbers
+
+// Writes a page's sequence number to the spare area of the data buffer, to be programmed along with its packets
+int W25N04KV_StampSequence(uint32_t sequence)
+{
+    FlashSegment stamp = {.data = (uint8_t *)&sequence, .size = sizeof(sequence)};
+
+    return W25N04KV_QuadWriteBufferSegments(&stamp, 1, PAGE_HEADER_COLUMN, false);
+}
+
+// Loads a page and reads the sequence number in its spare area, SEQUENCE_BLANK if it was never stamped
+int W25N04KV_ReadSequence(uint32_t pageAddress, uint32_t *sequence)
+{
+    *sequence = SEQUENCE_BLANK;
+    if (W25N04KV_ReadPage(pageAddress) != 0)
+    {
+        return 1;
+    }
+
+    return W25N04KV_FastQuadReadIO(PAGE_HEADER_COLUMN, sizeof(*sequence), (uint8_t *)sequence);
+}
+
+//! Page Headers
+
+// Updates a CRC-32 (LSB first, as crc32 in cli.c) with a buffer, a nibble at a time from a 16 entry table
+static uint32_t FLASH_UpdateCRC32(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+    static const uint32_t nibbleTable[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ nibbleTable[crc & 0xF];
+        crc = (crc >> 4) ^ nibbleTable[crc & 0xF];
+    }
+
+    return crc;
+}
+
+// Computes the CRC-32 of a buffer
+uint32_t W25N04KV_CRC32(const uint8_t *data, uint32_t size)
+{
+    return ~FLASH_UpdateCRC32(0xFFFFFFFF, data, size);
+}
+
+// Programs a page of packets along with its header, filling in the header's timestamp and CRC
+static int FLASH_ProgramLogPage(uint32_t pageAddress, const uint8_t *data, PageHeader *header)
+{
+    uint8_t headerPad[PAGE_HEADER_COLUMN - PAGE_SIZE];
+    memset(headerPad, 0xFF, sizeof(headerPad));
+    header->timestamp = xTaskGetTickCount();
+    header->crc = W25N04KV_CRC32(data, PAGE_SIZE);
+    header->version = PAGE_HEADER_VERSION;
+    FlashSegment page[] = {
+        {.data = data, .size = PAGE_SIZE},
+        {.data = headerPad, .size = sizeof(headerPad)},
+        {.data = (uint8_t *)header, .size = sizeof(*header)},
+    };
+
+    W25N04KV_MarkDirtyBlock(pageAddress / PAGES_PER_BLOCK);
+    if (W25N04KV_QuadWriteBufferSegments(page, 3, 0, true) != 0 || W25N04KV_WriteExecute(pageAddress) != 0 ||
+        W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    return (W25N04KV_ReadRegister(3) & STATUS_P_FAIL) ? 1 : 0;
+}
+
+// Programs a page of packets in slots, filling in the packet bitmap from the dummy byte of each slot
+int W25N04KV_WriteLogPage(uint32_t pageAddress, const uint8_t *data, uint32_t sequence, uint8_t streamId)
+{
+    PageHeader header = {
+        .sequence = sequence,
+        .validPackets = 0,
+        .streamId = streamId,
+        .layout = 0xFF,
+        .firstPacket = 0xFFFF,
+        .packetEnd = 0xFFFF,
+        .dataEnd = 0xFFFF,
+        .reserved = 0xFFFF,
+    };
+    for (int i = 0; i < PACKETS_PER_PAGE; i++)
+    {
+        header.validPackets |= (data[i * sizeof(Packet)] != 0xFF) ? (1 << i) : 0;
+    }
+
+    return FLASH_ProgramLogPage(pageAddress, data, &header);
+}
+
+// Programs a page of a packed log, whose header marks where its first packet starts and where its data ends
+int W25N04KV_WritePackedPage(uint32_t pageAddress, const uint8_t *data, PageHeader *header)
+{
+    header->validPackets = 0xFF;
+    header->reserved = 0xFFFF;
+    return FLASH_ProgramLogPage(pageAddress, data, header);
+}
+
+// Loads a page and reads only its header
+int W25N04KV_ReadPageHeader(uint32_t pageAddress, PageHeader *header)
+{
+    memset(header, 0xFF, sizeof(*header));
+    if (W25N04KV_ReadPage(pageAddress) != 0)
+    {
+        return 1;
+    }
+
+    return W25N04KV_FastQuadReadIO(PAGE_HEADER_COLUMN, sizeof(*header), (uint8_t *)header);
+}
+
+// Reads a page of packets and its header, checking the data against the CRC in the header
+int W25N04KV_ReadLogPage(uint32_t pageAddress, uint8_t *data, PageHeader *header)
+{
+    FlashECCStatus ecc;
+
+    if (W25N04KV_ReadPageECC(pageAddress, &ecc) != 0 || ecc >= ECC_UNCORRECTABLE ||
+        W25N04KV_FastQuadReadIO(0, PAGE_SIZE, data) != 0 ||
+        W25N04KV_FastQuadReadIO(PAGE_HEADER_COLUMN, sizeof(*header), (uint8_t *)header) != 0)
+    {
+        return 1;
+    }
+
+    // Pages only stamped with a sequence number, or never written, have no header to check against
+    if (header->version != PAGE_HEADER_VERSION || W25N04KV_CRC32(data, PAGE_SIZE) != header->crc)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+//! Packets
+
+// Checks whether a page's header is that of a packed log, whose packets or records straddle page boundaries
+static bool FLASH_IsPackedPage(const PageHeader *header)
+{
+    return header->version == PAGE_HEADER_VERSION &&
+           (header->layout == LAYOUT_PACKED || header->layout == LAYOUT_RECORDS);
+}
+
+// Finds the start of the first packet and the end of the last packet in the page loaded into the data buffer, as
+// offsets into the page. Uses the page's header, or the dummy byte of each packet with short quad reads if it has none
+static bool FLASH_FindLoadedPackets(const PageHeader *header, uint32_t *first, uint32_t *end)
+{
+    bool found = false;
+
+    // Packed page's last packet or record may run on into the next page, so its data ends with the last one to end
+    if (FLASH_IsPackedPage(header))
+    {
+        if (header->dataEnd == 0 || header->dataEnd > PAGE_SIZE)
+        {
+            return false;
+        }
+        *first = (header->firstPacket < header->dataEnd) ? header->firstPacket : header->dataEnd;
+        *end = (header->packetEnd > 0 && header->packetEnd <= header->dataEnd) ? header->packetEnd : header->dataEnd;
+        return true;
+    }
+
+    // Check the bitmap, or the dummy byte of every packet
+    for (int i = 0; i < PACKETS_PER_PAGE; i++)
+    {
+        uint8_t dummy = 0xFF;
+        bool used = (header->version == PAGE_HEADER_VERSION)
+                        ? (header->validPackets >> i) & 1
+                        : W25N04KV_FastQuadReadIO(i * sizeof(Packet), 1, &dummy) == 0 && dummy != 0xFF;
+        if (!used)
+        {
+            continue;
+        }
+
+        if (!found)
+        {
+            *first = i * sizeof(Packet);
+            found = true;
+        }
+        *end = (i + 1) * sizeof(Packet);
+    }
+
+    return found;
+}
+
+// Loads a page's header, then finds its first and last packets
+bool W25N04KV_FindPackets(uint32_t pageAddress, uint32_t *first, uint32_t *end)
+{
+    PageHeader header;
+
+    if (W25N04KV_ReadPageHeader(pageAddress, &header) != 0)
+    {
+        return false;
+    }
+
+    return FLASH_FindLoadedPackets(&header, first, end);
+}
+
+// Finds the first packet or record starting in a page or the pages after it, passing the pages a long record fills
+// without starting anything, which would otherwise alias to the start of the next page in the middle of the record.
+// Stops at a page holding nothing or older than those passed, returning the end of the data passed by then
+static uint32_t FLASH_NextStart(uint32_t pageAddress, uint32_t address, uint32_t sequence, const uint32_t pageRange[2])
+{
+    PageHeader header;
+    uint32_t first = 0;
+    uint32_t end = 0;
+
+    for (uint32_t i = 0; i < pageRange[1] - pageRange[0] && pageAddress < pageRange[1]; i++)
+    {
+        if (W25N04KV_ReadPageHeader(pageAddress, &header) != 0 || !FLASH_FindLoadedPackets(&header, &first, &end) ||
+            (FLASH_IsPackedPage(&header) && header.sequence < sequence))
+        {
+            return address;
+        }
+        if (!FLASH_IsPackedPage(&header) || first < header.dataEnd)
+        {
+            return pageAddress * PAGE_SIZE + first;
+        }
+
+        uint32_t next = W25N04KV_WrapLogPage(pageAddress + 1, pageRange);
+        address = (header.dataEnd < PAGE_SIZE) ? pageAddress * PAGE_SIZE + header.dataEnd : next * PAGE_SIZE;
+        sequence = header.sequence;
+        pageAddress = next;
+    }
+
+    return address;
+}
+
+// Finds the byte address of the first packet or record starting in a page of a log, or after it in a packed log
+uint32_t W25N04KV_FindLogStart(uint32_t pageAddress, const uint32_t pageRange[2])
+{
+    return FLASH_NextStart(pageAddress, pageAddress * PAGE_SIZE, 0, pageRange);
+}
+
+// Wraps a page of a log around to the start of its range, and moves it past bad blocks as the writer skips them.
+// Returns the end of the range if it holds no good block
+uint32_t W25N04KV_WrapLogPage(uint32_t pageAddress, const uint32_t pageRange[2])
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pageAddress >= pageRange[1])
+        {
+            pageAddress = pageRange[0];
+        }
+        uint16_t block = pageAddress / PAGES_PER_BLOCK;
+        if (!W25N04KV_IsBadBlock(block))
+        {
+            return pageAddress;
+        }
+
+        pageAddress = W25N04KV_NextGoodBlock(block) * PAGES_PER_BLOCK;
+        if (pageAddress < pageRange[1])
+        {
+            return pageAddress;
+        }
+    }
+
+    return pageRange[1];
+}
+
+//! Packed Streams
+
+// Position in the stream of a packed log, in a page which is loaded into the data buffer along with its header
+typedef struct
+{
+    uint32_t page;     // Page holding the position
+    uint32_t offset;   // Offset of the position in the page
+    PageHeader header; // Header of the page
+    bool lost;         // Set if a straddling packet or record was cut off, the position is then the next start
+} StreamPosition;
+
+// Loads a page of the stream and its header, which must have the same layout as the stream
+static int FLASH_LoadStreamPage(StreamPosition *pos, uint32_t pageAddress, const uint32_t pageRange[2])
+{
+    uint8_t layout = pos->header.layout;
+
+    pos->page = pageAddress;
+    pos->offset = 0;
+    if (pageAddress >= pageRange[1] || W25N04KV_ReadPageHeader(pageAddress, &pos->header) != 0 ||
+        !FLASH_IsPackedPage(&pos->header) || pos->header.layout != layout)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Loads the page holding a byte address of the stream. An address at the end of a page's data moves on to the first
+// start of a later page, passing pages which a long record fills without starting anything
+static int FLASH_SeekStream(StreamPosition *pos, uint32_t address, LogLayout layout, const uint32_t pageRange[2])
+{
+    pos->header.layout = layout;
+    pos->lost = false;
+    if (FLASH_LoadStreamPage(pos, address / PAGE_SIZE, pageRange) != 0)
+    {
+        return 1;
+    }
+
+    pos->offset = address % PAGE_SIZE;
+    for (uint32_t i = 0; pos->offset >= pos->header.dataEnd; i++)
+    {
+        if (i >= pageRange[1] - pageRange[0] ||
+            FLASH_LoadStreamPage(pos, W25N04KV_WrapLogPage(pos->page + 1, pageRange), pageRange) != 0)
+        {
+            return 1;
+        }
+        pos->offset = (pos->header.firstPacket < pos->header.dataEnd) ? pos->header.firstPacket : pos->header.dataEnd;
+    }
+
+    return 0;
+}
+
+// Byte address of the first start after the page of a position, for when the rest of the page cannot be followed
+static uint32_t FLASH_SkipStreamPage(const StreamPosition *pos, const uint32_t pageRange[2])
+{
+    uint32_t next = W25N04KV_WrapLogPage(pos->page + 1, pageRange);
+    uint32_t end = (pos->header.dataEnd < PAGE_SIZE) ? pos->page * PAGE_SIZE + pos->header.dataEnd : next * PAGE_SIZE;
+
+    return FLASH_NextStart(next, end, pos->header.sequence, pageRange);
+}
+
+// Byte address of a position in the stream. An offset at the end of its page moves on to the start of the next page of
+// the log, as the address after the page is outside the range or in a bad block once the log wraps or skips
+static uint32_t FLASH_StreamAddress(const StreamPosition *pos, const uint32_t pageRange[2])
+{
+    if (pos->lost && pos->offset >= pos->header.dataEnd)
+    {
+        return FLASH_SkipStreamPage(pos, pageRange); // Page which lost its continuation starts nothing either
+    }
+    if (pos->offset < PAGE_SIZE)
+    {
+        return pos->page * PAGE_SIZE + pos->offset;
+    }
+
+    return W25N04KV_WrapLogPage(pos->page + 1, pageRange) * PAGE_SIZE;
+}
+
+// Reads bytes of the stream, following them through the pages they run on into. Each of those pages must hold the
+// rest of the bytes before its first start, or be filled by them, otherwise the rest was lost with the writer's page
+// and the position moves to the page's first start. Data may be NULL to skip the bytes without reading them
+static int FLASH_ReadStream(StreamPosition *pos, uint8_t *data, uint32_t size, const uint32_t pageRange[2])
+{
+    for (;;)
+    {
+        uint32_t part = (pos->header.dataEnd - pos->offset < size) ? pos->header.dataEnd - pos->offset : size;
+        if (data != NULL && part > 0)
+        {
+            if (W25N04KV_FastQuadReadIO(pos->offset, part, data) != 0)
+            {
+                return 1;
+            }
+            data += part;
+        }
+        pos->offset += part;
+        size -= part;
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        if (FLASH_LoadStreamPage(pos, W25N04KV_WrapLogPage(pos->page + 1, pageRange), pageRange) != 0)
+        {
+            return 1;
+        }
+        uint16_t first = pos->header.firstPacket;
+        uint16_t dataEnd = pos->header.dataEnd;
+        bool continued = (first == PACKED_NO_START) ? dataEnd == size || (dataEnd == PAGE_SIZE && size > PAGE_SIZE)
+                                                    : first == size;
+        if (!continued)
+        {
+            pos->offset = (first < dataEnd) ? first : dataEnd;
+            pos->lost = true;
+            return 1;
+        }
+    }
+}
+
+// Reads the packet at a byte address of a packed log, following it into the next page when it straddles the boundary
+int W25N04KV_ReadPackedPacket(uint32_t *address, const uint32_t pageRange[2], Packet *packet)
+{
+    StreamPosition pos;
+
+    if (FLASH_SeekStream(&pos, *address, LAYOUT_PACKED, pageRange) != 0)
+    {
+        return 1;
+    }
+
+    int error = FLASH_ReadStream(&pos, (uint8_t *)packet, sizeof(Packet), pageRange);
+    if (error == 0 || pos.lost)
+    {
+        *address = FLASH_StreamAddress(&pos, pageRange);
+    }
+
+    return error;
+}
+
+//! Records
+
+// Computes the CRC of a record's type, flags, and payload
+uint32_t W25N04KV_RecordCRC(uint8_t type, uint8_t flags, const uint8_t *payload, uint32_t length)
+{
+    uint8_t kind[2] = {type, flags};
+    return ~FLASH_UpdateCRC32(FLASH_UpdateCRC32(0xFFFFFFFF, kind, sizeof(kind)), payload, length);
+}
+
+// Reads the header of the record at a byte address, then its payload if it fits the buffer given
+int W25N04KV_ReadRecord(uint32_t *address, const uint32_t pageRange[2], RecordHeader *record, uint8_t *payload,
+                        uint32_t payloadSize)
+{
+    StreamPosition pos;
+
+    if (FLASH_SeekStream(&pos, *address, LAYOUT_RECORDS, pageRange) != 0)
+    {
+        return 1;
+    }
+
+    if (FLASH_ReadStream(&pos, (uint8_t *)record, sizeof(*record), pageRange) != 0)
+    {
+        *address = pos.lost ? FLASH_StreamAddress(&pos, pageRange) : *address;
+        return 1;
+    }
+
+    // Corrupt length cannot be followed, so the rest of the page is skipped
+    if (record->length > RECORD_MAX_PAYLOAD || record->check != (uint16_t)~record->length)
+    {
+        *address = FLASH_SkipStreamPage(&pos, pageRange);
+        return 1;
+    }
+
+    bool fits = payload != NULL && record->length <= payloadSize;
+    int error = FLASH_ReadStream(&pos, fits ? payload : NULL, record->length, pageRange);
+    if (error == 0 || pos.lost)
+    {
+        *address = FLASH_StreamAddress(&pos, pageRange);
+    }
+    if (error == 0 && fits && W25N04KV_RecordCRC(record->type, record->flags, payload, record->length) != record->crc)
+    {
+        return 1;
+    }
+
+    return error;
+}
+
+//! Binary Search
+
+// Checks whether a page belongs to the run of pages stamped from a sequence number onwards
+static bool FLASH_IsInRun(uint32_t sequence, uint32_t firstSequence)
+{
+    return sequence != SEQUENCE_BLANK && sequence >= firstSequence;
+}
+
+// Finds the first good block of a range whose first page is (or is not) in a run. Blocks must all be in the run, then
+// all out of it (or the reverse), and bad blocks are skipped by the writer so they are skipped by the search too
+static uint16_t FLASH_SearchBlocks(uint16_t firstBlock, uint16_t endBlock, uint32_t firstSequence, bool inRun)
+{
+    uint16_t low = firstBlock;
+    uint16_t high = endBlock;
+
+    while (low < high)
+    {
+        uint16_t middle = low + (high - low) / 2;
+        uint16_t good = W25N04KV_NextGoodBlock(middle);
+        if (good >= high)
+        {
+            high = middle; // Only bad blocks from the middle on, so the block looked for is before them
+            continue;
+        }
+
+        uint32_t sequence;
+        W25N04KV_ReadSequence(good * PAGES_PER_BLOCK, &sequence);
+        if (FLASH_IsInRun(sequence, firstSequence) == inRun)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = good + 1;
+        }
+    }
+
+    uint16_t found = W25N04KV_NextGoodBlock(low);
+    return (found < endBlock) ? found : endBlock;
+}
+
+// Finds the last good block before a block, firstBlock if there is none
+static uint16_t FLASH_PreviousGoodBlock(uint16_t blockAddress, uint16_t firstBlock)
+{
+    while (blockAddress > firstBlock)
+    {
+        blockAddress--;
+        if (!W25N04KV_IsBadBlock(blockAddress))
+        {
+            return blockAddress;
+        }
+    }
+
+    return firstBlock;
+}
+
+// Binary searches the blocks of a range for the oldest and newest pages of a log stamped with sequence numbers
+static void FLASH_SearchHeadTail(CircularBuffer *buf, const uint32_t pageRange[2])
+{
+    uint16_t firstBlock = pageRange[0] / PAGES_PER_BLOCK;
+    uint16_t endBlock = (pageRange[1] + PAGES_PER_BLOCK - 1) / PAGES_PER_BLOCK;
+    uint32_t sequence;
+    uint32_t first = 0;
+    uint32_t end = 0;
+
+    // Empty log starts at the beginning of the range
+    buf->head = firstBlock * LOG_BLOCK_BYTES;
+    buf->tail = buf->head;
+
+    uint16_t startBlock = W25N04KV_NextGoodBlock(firstBlock);
+    if (startBlock >= endBlock)
+    {
+        return;
+    }
+
+    // Run holding the newest page starts at the first block, unless the blocks there were erased ahead of the writer
+    W25N04KV_ReadSequence(startBlock * PAGES_PER_BLOCK, &sequence);
+    bool startWritten = sequence != SEQUENCE_BLANK;
+    uint16_t runBlock = startBlock;
+    if (!startWritten)
+    {
+        runBlock = FLASH_SearchBlocks(startBlock, endBlock, 0, true);
+        if (runBlock >= endBlock)
+        {
+            return;
+        }
+        W25N04KV_ReadSequence(runBlock * PAGES_PER_BLOCK, &sequence);
+    }
+    uint32_t runSequence = sequence;
+
+    // Newest block is the last one whose first page continues the run
+    uint16_t pastBlock = FLASH_SearchBlocks(runBlock, endBlock, runSequence, false);
+    uint16_t newestBlock = FLASH_PreviousGoodBlock(pastBlock, runBlock);
+
+    // Pages of a block are programmed in order, so only the newest block is scanned page by page
+    uint32_t newestPage = newestBlock * PAGES_PER_BLOCK;
+    for (int page = 1; page < PAGES_PER_BLOCK; page++)
+    {
+        W25N04KV_ReadSequence(newestBlock * PAGES_PER_BLOCK + page, &sequence);
+        if (!FLASH_IsInRun(sequence, runSequence))
+        {
+            break;
+        }
+        newestPage = newestBlock * PAGES_PER_BLOCK + page;
+    }
+
+    // Older pages left from before the writer wrapped around follow the erased blocks ahead of the newest page
+    uint16_t headBlock = runBlock;
+    if (startWritten)
+    {
+        uint16_t oldBlock = FLASH_SearchBlocks(pastBlock, endBlock, 0, true);
+        headBlock = (oldBlock < endBlock) ? oldBlock : startBlock;
+    }
+
+    uint32_t headPage = headBlock * PAGES_PER_BLOCK;
+    buf->head = W25N04KV_FindLogStart(headPage, pageRange);
+    buf->tail = newestPage * PAGE_SIZE + (W25N04KV_FindPackets(newestPage, &first, &end) ? end : PAGE_SIZE);
+}
+
+//! Head and Tail
+
+// Finds the head and tail of the flash and stores it into a circular buffer
+void W25N04KV_FindHeadTail(CircularBuffer *buf, uint32_t pageRange[2], HeadTailMode mode)
+{
+    uint32_t fullRange[2] = {0, BLOCK_COUNT * PAGES_PER_BLOCK};
+
+    // Use entire range if not specified
+    if (pageRange == NULL)
+    {
+        pageRange = fullRange;
+    }
+
+    if (mode == SCAN_BINARY)
+    {
+        FLASH_SearchHeadTail(buf, pageRange);
+        return;
+    }
+
+    bool headFound = false; // Tracks whether head has been found
+    uint32_t first = 0;
+    uint32_t end = 0;
+
+    for (uint32_t p = pageRange[0]; p < pageRange[1]; p++)
+    {
+        // Bad blocks hold no packets
+        if (W25N04KV_IsBadBlock(p / PAGES_PER_BLOCK) || !W25N04KV_FindPackets(p, &first, &end))
+        {
+            continue;
+        }
+
+        if (!headFound)
+        {
+            buf->head = W25N04KV_FindLogStart(p, pageRange);
+            headFound = true;
+        }
+        buf->tail = p * 2048 + end;
+    }
+}
+
+//! Roll Forward
+
+// Moves the tail past the pages written since a known position, which are stamped from the next sequence number on.
+// Blocks the writer erased since then held the oldest pages, so the head moves past them
+void W25N04KV_RollForwardLog(CircularBuffer *buf, uint32_t pageRange[2], uint32_t *nextSequence)
+{
+    uint32_t knownSequence = *nextSequence;
+    bool wasEmpty = buf->head == buf->tail;
+    uint32_t first = 0;
+    uint32_t end = 0;
+    PageHeader header;
+
+    // Pages are programmed whole, so the next page written follows the one holding the tail
+    uint32_t page = W25N04KV_WrapLogPage((buf->tail + PAGE_SIZE - 1) / PAGE_SIZE, pageRange);
+    uint32_t firstNewPage = pageRange[1];
+    for (uint32_t i = 0; i < pageRange[1] - pageRange[0] && page < pageRange[1]; i++)
+    {
+        if (W25N04KV_ReadPageHeader(page, &header) != 0 || header.sequence == SEQUENCE_BLANK ||
+            header.sequence < *nextSequence)
+        {
+            break;
+        }
+
+        buf->tail = page * PAGE_SIZE + (FLASH_FindLoadedPackets(&header, &first, &end) ? end : PAGE_SIZE);
+        firstNewPage = (firstNewPage == pageRange[1]) ? page : firstNewPage;
+        *nextSequence = header.sequence + 1;
+        page = W25N04KV_WrapLogPage(page + 1, pageRange);
+    }
+
+    // Log which was empty starts at the first new page
+    if (wasEmpty)
+    {
+        if (firstNewPage < pageRange[1])
+        {
+            buf->head = W25N04KV_FindLogStart(firstNewPage, pageRange);
+        }
+        return;
+    }
+
+    // Head stays in its block while the block still holds pages from before the known position
+    uint32_t headPage = W25N04KV_WrapLogPage(buf->head / PAGE_SIZE, pageRange);
+    for (uint32_t i = 0; i < BLOCK_COUNT && headPage < pageRange[1]; i++)
+    {
+        if (W25N04KV_ReadPageHeader(headPage, &header) != 0 ||
+            (header.sequence != SEQUENCE_BLANK && header.sequence < knownSequence))
+        {
+            break;
+        }
+        if (headPage / PAGES_PER_BLOCK == firstNewPage / PAGES_PER_BLOCK)
+        {
+            headPage = firstNewPage; // Every older page was erased, so the oldest left is the first new one
+            break;
+        }
+        headPage = W25N04KV_WrapLogPage((headPage / PAGES_PER_BLOCK + 1) * PAGES_PER_BLOCK, pageRange);
+    }
+
+    if (headPage != buf->head / PAGE_SIZE && headPage < pageRange[1])
+    {
+        buf->head = W25N04KV_FindLogStart(headPage, pageRange);
+    }
+}
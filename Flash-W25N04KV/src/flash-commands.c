@@ -0,0 +1,140 @@
+/*
+ * flash-commands.c
+ *
+ * Contains a table of QSPI commands pre-encoded at compile time, one for each
+ * opcode in the format used by the library. Instructions matching a template
+ * only need their address and data length patched before being sent.
+ */
+
+#include "W25N04KV.h"
+
+//! Compile-time encoding
+
+// Maps address size (in bytes) and lines used to QSPI address mode and size
+#define TEMPLATE_ADDRESS_MODE(size, lines)                                                                             \
+    (((size) == 0)    ? QSPI_ADDRESS_NONE                                                                              \
+     : ((lines) == 4) ? QSPI_ADDRESS_4_LINES                                                                           \
+     : ((lines) == 2) ? QSPI_ADDRESS_2_LINES                                                                           \
+                      : QSPI_ADDRESS_1_LINE)
+#define TEMPLATE_ADDRESS_SIZE(size)                                                                                    \
+    (((size) == 2)   ? QSPI_ADDRESS_16_BITS                                                                            \
+     : ((size) == 3) ? QSPI_ADDRESS_24_BITS                                                                            \
+     : ((size) == 4) ? QSPI_ADDRESS_32_BITS                                                                            \
+                     : QSPI_ADDRESS_8_BITS)
+// Data mode used if data is sent, replaced with QSPI_DATA_NONE for instructions without data
+#define TEMPLATE_DATA_MODE(lines)                                                                                      \
+    (((lines) == 4) ? QSPI_DATA_4_LINES : ((lines) == 2) ? QSPI_DATA_2_LINES : QSPI_DATA_1_LINE)
+
+// Builds a template for an opcode, given the instruction fields it is valid for
+#define TEMPLATE(op, addrSize, addrLines, dummy, dataLines)                                                            \
+    {                                                                                                                  \
+        .addressSize = (addrSize),                                                                                     \
+        .addressLinesUsed = (addrLines),                                                                               \
+        .dummyClocks = (dummy),                                                                                        \
+        .dataLinesUsed = (dataLines),                                                                                  \
+        .command =                                                                                                     \
+            {                                                                                                          \
+                .Instruction = (op),                                                                                   \
+                .AddressSize = TEMPLATE_ADDRESS_SIZE(addrSize),                                                        \
+                .DummyCycles = (dummy),                                                                                \
+                .InstructionMode = QSPI_INSTRUCTION_1_LINE,                                                            \
+                .AddressMode = TEMPLATE_ADDRESS_MODE(addrSize, addrLines),                                             \
+                .AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,                                                        \
+                .DataMode = TEMPLATE_DATA_MODE(dataLines),                                                             \
+            },                                                                                                         \
+    }
+
+// Pre-encoded command, and the instruction fields it was encoded from
+typedef struct
+{
+    uint16_t addressSize;
+    uint32_t addressLinesUsed;
+    uint8_t dummyClocks;
+    uint8_t dataLinesUsed;
+    QSPI_CommandTypeDef command;
+} CommandTemplate;
+
+//! Command Templates
+
+// One template for every opcode, using the same fields as the instruction functions
+static const CommandTemplate COMMAND_TEMPLATES[] = {
+    TEMPLATE(GET_JEDEC, 0, 0, 8, 0),
+    TEMPLATE(READ_REGISTER, 1, 0, 0, 0),
+    TEMPLATE(WRITE_REGISTER, 1, 0, 0, 0),
+    TEMPLATE(READ_PAGE, 3, 0, 0, 0),
+    TEMPLATE(READ_BUFFER, 2, 0, 8, 0),
+    TEMPLATE(FAST_READ_BUFFER, 2, 0, 8, 0),
+    TEMPLATE(FAST_DUAL_READ_BUFFER, 2, 0, 8, 2),
+    TEMPLATE(FAST_DUAL_READ_IO, 2, 2, 4, 2),
+    TEMPLATE(FAST_QUAD_READ_BUFFER, 2, 0, 8, 4),
+    TEMPLATE(FAST_QUAD_READ_IO, 2, 4, 4, 4),
+    TEMPLATE(WRITE_ENABLE, 0, 0, 0, 0),
+    TEMPLATE(WRITE_DISABLE, 0, 0, 0, 0),
+    TEMPLATE(WRITE_BUFFER, 2, 0, 0, 0),
+    TEMPLATE(QUAD_WRITE_BUFFER, 2, 0, 0, 4),
+    TEMPLATE(WRITE_BUFFER_WITH_RESET, 2, 0, 0, 0),
+    TEMPLATE(QUAD_WRITE_BUFFER_RESET, 2, 0, 0, 4),
+    TEMPLATE(WRITE_EXECUTE, 3, 0, 0, 0),
+    TEMPLATE(ERASE_BLOCK, 3, 0, 0, 0),
+    TEMPLATE(BAD_BLOCK_MANAGEMENT, 0, 0, 0, 0),
+    TEMPLATE(READ_BBM_LUT, 0, 0, 8, 0),
+    TEMPLATE(RESET_DEVICE, 0, 0, 0, 0),
+};
+
+// Position of each opcode's template in COMMAND_TEMPLATES plus 1, 0 if the opcode has no template
+static const uint8_t TEMPLATE_INDEX[256] = {
+    [GET_JEDEC] = 1,
+    [READ_REGISTER] = 2,
+    [WRITE_REGISTER] = 3,
+    [READ_PAGE] = 4,
+    [READ_BUFFER] = 5,
+    [FAST_READ_BUFFER] = 6,
+    [FAST_DUAL_READ_BUFFER] = 7,
+    [FAST_DUAL_READ_IO] = 8,
+    [FAST_QUAD_READ_BUFFER] = 9,
+    [FAST_QUAD_READ_IO] = 10,
+    [WRITE_ENABLE] = 11,
+    [WRITE_DISABLE] = 12,
+    [WRITE_BUFFER] = 13,
+    [QUAD_WRITE_BUFFER] = 14,
+    [WRITE_BUFFER_WITH_RESET] = 15,
+    [QUAD_WRITE_BUFFER_RESET] = 16,
+    [WRITE_EXECUTE] = 17,
+    [ERASE_BLOCK] = 18,
+    [BAD_BLOCK_MANAGEMENT] = 19,
+    [READ_BBM_LUT] = 20,
+    [RESET_DEVICE] = 21,
+};
+
+//! Command Building
+
+// Copies the template of an instruction and patches its address and length
+void W25N04KV_BuildCommand(FlashInstruction *instruction, QSPI_CommandTypeDef *command)
+{
+    uint8_t index = TEMPLATE_INDEX[(uint8_t)instruction->opCode];
+
+    // Encode from scratch if the opcode has no template
+    if (index == 0)
+    {
+        W25N04KV_EncodeCommand(instruction, command);
+        return;
+    }
+
+    // Encode from scratch if the instruction differs from the format the template was built for
+    const CommandTemplate *template = &COMMAND_TEMPLATES[index - 1];
+    if (instruction->addressSize != template->addressSize ||
+        instruction->addressLinesUsed != template->addressLinesUsed ||
+        instruction->dummyClocks != template->dummyClocks || instruction->dataLinesUsed != template->dataLinesUsed)
+    {
+        W25N04KV_EncodeCommand(instruction, command);
+        return;
+    }
+
+    *command = template->command;
+    command->Address = (instruction->addressSize > 0) ? instruction->address : QSPI_ADDRESS_NONE;
+    command->NbData = instruction->dataSize;
+    if (instruction->dataSize == 0)
+    {
+        command->DataMode = QSPI_DATA_NONE;
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * flash-copy.c
+ *
+ * Contains code which copies pages without moving their data over the
+ * bus. A page is loaded into the flash's data buffer with READ_PAGE, then
+ * programmed to another page with WRITE_EXECUTE, so only the instructions
+ * and any spare area bytes patched in between are sent. The ECC corrects
+ * the data as it is loaded, and regenerates its parity as it is programmed.
+ */
+
+#include "W25N04KV.h"
+
+//! Page Copy
+
+// Loads a page into the data buffer, patches part of the buffer if asked to, then programs the buffer to another page
+int W25N04KV_CopyPage(uint32_t sourcePage, uint32_t destinationPage, const uint8_t *patch, uint16_t patchSize,
+                      uint16_t patchColumn)
+{
+    FlashECCStatus ecc;
+
+    if (patch != NULL && patchColumn + patchSize > PAGE_SIZE + SPARE_SIZE)
+    {
+        return 1;
+    }
+
+    // Destination is recorded dirty before the source is loaded, as the update goes through the data buffer. Data the
+    // ECC could not correct is not copied, as the new parity would hide the errors
+    W25N04KV_MarkDirtyBlock(destinationPage / PAGES_PER_BLOCK);
+    if (W25N04KV_ReadPageECC(sourcePage, &ecc) != 0 || ecc >= ECC_UNCORRECTABLE)
+    {
+        return 1;
+    }
+
+    // Random load leaves the rest of the loaded page in the buffer untouched, and also sets the WEL bit
+    if (patch != NULL && patchSize > 0)
+    {
+        FlashSegment patchSegment = {.data = patch, .size = patchSize};
+        if (W25N04KV_QuadWriteBufferSegments(&patchSegment, 1, patchColumn, false) != 0)
+        {
+            return 1;
+        }
+    }
+    else if (W25N04KV_WriteEnable() != 0)
+    {
+        return 1;
+    }
+
+    if (W25N04KV_WriteExecute(destinationPage) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    return (W25N04KV_ReadRegister(3) & STATUS_P_FAIL) ? 1 : 0;
+}
+
+//! Block Relocation
+
+// Copies the pages of a block selected by a mask, in order, to consecutive pages starting from a destination page
+int W25N04KV_RelocateBlock(uint16_t sourceBlock, uint64_t pageMask, uint32_t destinationPage, uint8_t *relocated)
+{
+    *relocated = 0;
+
+    for (int page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        if (!((pageMask >> page) & 1))
+        {
+            continue;
+        }
+
+        // Pages of a block are programmed in order, so the copies cannot run past the end of the destination block
+        uint32_t destination = destinationPage + *relocated;
+        if (destination / PAGES_PER_BLOCK != destinationPage / PAGES_PER_BLOCK)
+        {
+            return 1;
+        }
+        if (W25N04KV_CopyPage(sourceBlock * PAGES_PER_BLOCK + page, destination, NULL, 0, 0) != 0)
+        {
+            return 1;
+        }
+        (*relocated)++;
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * flash-dirty.c
+ *
+ * Contains code which tracks blocks programmed since they were last
+ * erased. The bitmap is persisted in a reserved block, the same way as the
+ * bad block table, so a device reset only erases blocks holding data.
+ *
+ * Programs made by the driver record their block before the data buffer
+ * is loaded, so a block holding data is never missed and the update never
+ * disturbs the page being programmed. Pages programmed directly with
+ * WRITE_EXECUTE are recorded in RAM, and persisted with the next update.
+ * Blocks are only recorded clean in RAM once an erase has succeeded, which
+ * is persisted with the next update of the table.
+ *
+ * An update cut off by a power loss leaves a page which is not blank, so
+ * the next update is written after it.
+ */
+
+#include "W25N04KV.h"
+
+//! Dirty Block Table State
+
+static uint8_t dirtyBlocks[BLOCK_COUNT / 8]; // Bitmap with 1 bit per block, set if programmed since its last erase
+static int tablePage = -1;                   // Page of DIRTY_BLOCK holding the current table, -1 if not persisted
+static int nextTablePage = 0;                // Page of DIRTY_BLOCK the next update is written to, after every page used
+static bool unpersistedMarks = false;        // Set once a block is marked dirty in RAM only, until the next update
+
+// Checks a block's bit in the bitmap
+bool W25N04KV_IsDirtyBlock(uint16_t blockAddress)
+{
+    return (dirtyBlocks[blockAddress / 8] >> (blockAddress % 8)) & 1;
+}
+
+// Reserved tables are never erased by a device reset, so they are not tracked
+static bool FLASH_IsTrackedBlock(uint16_t blockAddress)
+{
+    return blockAddress != DIRTY_BLOCK && blockAddress != BBT_BLOCK && blockAddress != WEAR_BLOCK;
+}
+
+//! Persistence
+
+// Writes the table to the page after the current one, erasing the block once every page has been used
+int W25N04KV_PersistDirtyBlocks(void)
+{
+    uint32_t magic = DIRTY_MAGIC;
+    FlashSegment table[] = {
+        {.data = (uint8_t *)&magic, .size = sizeof(magic)},
+        {.data = dirtyBlocks, .size = sizeof(dirtyBlocks)},
+    };
+
+    // Table cannot be persisted in a bad block, so every block is treated as dirty next boot
+    if (W25N04KV_IsBadBlock(DIRTY_BLOCK))
+    {
+        return 1;
+    }
+
+    int page = nextTablePage;
+    if (page >= PAGES_PER_BLOCK)
+    {
+        if (W25N04KV_EraseBlock(DIRTY_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+        tablePage = -1;
+        page = 0;
+    }
+
+    // Page is used even if the program fails, so it is never programmed twice
+    nextTablePage = page + 1;
+    if (W25N04KV_QuadWriteBufferSegments(table, 2, 0, true) != 0 ||
+        W25N04KV_WriteExecute(DIRTY_BLOCK * PAGES_PER_BLOCK + page) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    tablePage = page;
+    unpersistedMarks = false;
+    return 0;
+}
+
+// Loads the table from the last page of DIRTY_BLOCK which holds one, stepping past pages cut off by a power loss
+static int FLASH_LoadDirtyBlocks(void)
+{
+    uint32_t magic;
+
+    for (int page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        uint32_t pageAddress = DIRTY_BLOCK * PAGES_PER_BLOCK + page;
+        W25N04KV_ReadPage(pageAddress);
+        if (W25N04KV_FastQuadReadIO(0, sizeof(magic), (uint8_t *)&magic) == 0 && magic == DIRTY_MAGIC)
+        {
+            tablePage = page;
+        }
+        else if (W25N04KV_IsBlankPage(pageAddress))
+        {
+            break; // Pages after the last one written are erased
+        }
+        nextTablePage = page + 1;
+    }
+
+    if (tablePage < 0)
+    {
+        return 1; // No table persisted
+    }
+
+    W25N04KV_ReadPage(DIRTY_BLOCK * PAGES_PER_BLOCK + tablePage);
+    return W25N04KV_FastQuadReadIO(sizeof(magic), sizeof(dirtyBlocks), dirtyBlocks);
+}
+
+//! Dirty Block Table
+
+// Loads the persisted table, or treats every block as dirty on the first boot
+int W25N04KV_MountDirtyBlocks(void)
+{
+    tablePage = -1;
+    nextTablePage = 0;
+    unpersistedMarks = false;
+    if (FLASH_LoadDirtyBlocks() == 0)
+    {
+        return 0;
+    }
+
+    // Contents of every block are unknown until it is first erased
+    memset(dirtyBlocks, 0xFF, sizeof(dirtyBlocks));
+    if (W25N04KV_IsBadBlock(DIRTY_BLOCK))
+    {
+        return 0;
+    }
+
+    // Reserved block starts with the first table written
+    if (W25N04KV_EraseBlock(DIRTY_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+    nextTablePage = 0;
+    return W25N04KV_PersistDirtyBlocks();
+}
+
+// Sets a block's bit and persists the table, along with any blocks only marked in RAM since the last update
+void W25N04KV_MarkDirtyBlock(uint16_t blockAddress)
+{
+    if (!FLASH_IsTrackedBlock(blockAddress) || (W25N04KV_IsDirtyBlock(blockAddress) && !unpersistedMarks))
+    {
+        return;
+    }
+
+    dirtyBlocks[blockAddress / 8] |= 1 << (blockAddress % 8);
+    if (tablePage >= 0)
+    {
+        W25N04KV_PersistDirtyBlocks(); // A lost update is caught by the blank check of a device reset
+    }
+}
+
+// Sets a block's bit, without persisting it
+void W25N04KV_SetDirtyBlock(uint16_t blockAddress)
+{
+    if (FLASH_IsTrackedBlock(blockAddress) && !W25N04KV_IsDirtyBlock(blockAddress))
+    {
+        dirtyBlocks[blockAddress / 8] |= 1 << (blockAddress % 8);
+        unpersistedMarks = true;
+    }
+}
+
+// Clears a block's bit, without persisting it
+void W25N04KV_ClearDirtyBlock(uint16_t blockAddress)
+{
+    dirtyBlocks[blockAddress / 8] &= ~(1 << (blockAddress % 8));
+}
+
+// Counts set bits in the bitmap
+uint16_t W25N04KV_GetDirtyBlockCount(void)
+{
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < sizeof(dirtyBlocks); i++)
+    {
+        count += __builtin_popcount(dirtyBlocks[i]);
+    }
+
+    return count;
+}
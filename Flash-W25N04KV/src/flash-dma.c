@@ -0,0 +1,231 @@
+/*
+ * flash-dma.c
+ *
+ * Contains code which issues QSPI instructions without blocking the CPU.
+ * Data phases are moved by DMA and status polling is done by the QSPI
+ * peripheral, with completion signalled from the QSPI interrupt through
+ * a callback and a task notification.
+ *
+ * Instructions are run as chains, where each step is started from the
+ * interrupt which completes the previous one.
+ */
+
+#include "W25N04KV.h"
+
+//! Asynchronous Transfer State
+
+static volatile bool asyncBusy = false;     // Tracks whether a DMA transfer is in flight
+static volatile int asyncStatus = 0;        // Result of the last asynchronous instruction
+static TaskHandle_t asyncTask = NULL;       // Task to notify once the transfer completes
+static FlashCallback asyncCallback = NULL;  // Callback to run once the transfer completes
+static FlashInstruction *chainSteps = NULL; // Instructions in the chain being run
+static uint8_t chainLength = 0;             // Number of instructions in the chain
+static volatile uint8_t chainIndex = 0;     // Position of the instruction currently on the bus
+
+// Records the result of a transfer, runs the callback, then wakes the waiting task
+static void W25N04KV_CompleteAsync(int status)
+{
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+    asyncStatus = status;
+    asyncBusy = false;
+    // Callback always runs before the waiting task is woken
+    if (asyncCallback != NULL)
+    {
+        asyncCallback(status);
+    }
+    if (asyncTask != NULL)
+    {
+        vTaskNotifyGiveFromISR(asyncTask, &higherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// Starts the current step of the chain without waiting for it to complete
+static int W25N04KV_StartStep(void)
+{
+    FlashInstruction *instruction = &chainSteps[chainIndex];
+    QSPI_CommandTypeDef sCommand;
+    W25N04KV_BuildCommand(instruction, &sCommand);
+
+    // Status register is read by the peripheral until BUSY bit (bit 0) reads as 0
+    if (instruction->dataMode == POLL_NOT_BUSY)
+    {
+        QSPI_AutoPollingTypeDef sConfig = {
+            .Match = 0x00,
+            .Mask = 0x01,
+            .MatchMode = QSPI_MATCH_MODE_AND,
+            .StatusBytesSize = 1,
+            .Interval = AUTO_POLL_INTERVAL,
+            .AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE,
+        };
+        return (HAL_QSPI_AutoPolling_IT(&hqspi, &sCommand, &sConfig) != HAL_OK) ? 1 : 0;
+    }
+
+    // Without a data phase, completion is signalled by the transfer complete interrupt
+    if (instruction->dataBuf == NULL || instruction->dataSize == 0)
+    {
+        sCommand.DataMode = QSPI_DATA_NONE;
+        sCommand.NbData = 0;
+        return (HAL_QSPI_Command_IT(&hqspi, &sCommand) != HAL_OK) ? 1 : 0;
+    }
+
+    // Send command, then move data phase with DMA
+    if (HAL_QSPI_Command_IT(&hqspi, &sCommand) != HAL_OK)
+    {
+        return 1; // Command failed
+    }
+
+    if (instruction->dataMode == TRANSMIT)
+    {
+        return (HAL_QSPI_Transmit_DMA(&hqspi, instruction->dataBuf) != HAL_OK) ? 1 : 0;
+    }
+    else if (instruction->dataMode == RECEIVE)
+    {
+        return (HAL_QSPI_Receive_DMA(&hqspi, instruction->dataBuf) != HAL_OK) ? 1 : 0;
+    }
+
+    return 1; // No valid data mode
+}
+
+// Starts the next step of the chain, or completes the chain if it is finished or failed
+static void W25N04KV_StepComplete(int status)
+{
+    // Ignore interrupts not caused by an asynchronous instruction
+    if (!asyncBusy)
+    {
+        return;
+    }
+
+    if (status == 0 && chainIndex + 1 < chainLength)
+    {
+        chainIndex++;
+        if (W25N04KV_StartStep() == 0)
+        {
+            return; // Next step started
+        }
+        status = 1; // Next step failed to start
+    }
+
+    // Record the step which failed, the logger task prints it once the interrupt has returned
+    if (status != 0)
+    {
+        W25N04KV_LogError(chainSteps[chainIndex].opCode, chainSteps[chainIndex].address, HAL_ERROR);
+    }
+
+    W25N04KV_CompleteAsync(status);
+}
+
+//! Asynchronous Operations
+
+// Runs a chain of instructions from interrupts, signalling completion once at the end
+int W25N04KV_QSPIInstructChain(FlashInstruction *chain, uint8_t length, FlashCallback callback)
+{
+    // Only one chain may use the peripheral at a time, started by the task owning the bus
+    if (asyncBusy || chain == NULL || length == 0)
+    {
+        return 1;
+    }
+    if (!W25N04KV_OwnsBus())
+    {
+        W25N04KV_LogError(chain[0].opCode, chain[0].address, HAL_BUSY);
+        return 1;
+    }
+
+    // Indirect commands cannot be sent while the data buffer is memory-mapped
+    if (W25N04KV_UnmapBuffer() != 0)
+    {
+        return 1;
+    }
+
+    asyncTask = xTaskGetCurrentTaskHandle();
+    asyncCallback = callback;
+    chainSteps = chain;
+    chainLength = length;
+    chainIndex = 0;
+    asyncBusy = true;
+
+    if (W25N04KV_StartStep() != 0)
+    {
+        asyncBusy = false;
+        W25N04KV_LogError(chain[0].opCode, chain[0].address, HAL_ERROR);
+        return 1; // First step failed to start
+    }
+
+    return 0; // Chain started
+}
+
+// Issues a command to the flash via QSPI, moving data with DMA
+int W25N04KV_QSPIInstructAsync(FlashInstruction *instruction, FlashCallback callback)
+{
+    return W25N04KV_QSPIInstructChain(instruction, 1, callback);
+}
+
+// Waits for the notification sent once the asynchronous instruction completes
+int W25N04KV_AwaitAsync(uint32_t timeout)
+{
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout)) == 0)
+    {
+        // Transfer timed out, release the peripheral
+        if (asyncBusy)
+        {
+            W25N04KV_LogError(chainSteps[chainIndex].opCode, chainSteps[chainIndex].address, HAL_TIMEOUT);
+        }
+        HAL_QSPI_Abort(&hqspi);
+        asyncBusy = false;
+        return 1;
+    }
+
+    return asyncStatus;
+}
+
+// Checks if a DMA transfer is still in flight
+bool W25N04KV_IsAsyncBusy(void)
+{
+    return asyncBusy;
+}
+
+// Waits for the BUSY bit to clear, letting the QSPI peripheral poll status register 3
+int W25N04KV_AwaitNotBusyAutoPoll(uint32_t timeout)
+{
+    static FlashInstruction awaitNotBusy = AWAIT_NOT_BUSY_STEP;
+
+    if (W25N04KV_QSPIInstructChain(&awaitNotBusy, 1, NULL) != 0)
+    {
+        return 1; // Polling failed to start
+    }
+
+    return W25N04KV_AwaitAsync(timeout);
+}
+
+//! QSPI Interrupt Callbacks
+
+// Called by the HAL once a command without a data phase has been sent
+void HAL_QSPI_CmdCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+    W25N04KV_StepComplete(0);
+}
+
+// Called by the HAL once a DMA receive completes
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+    W25N04KV_StepComplete(0);
+}
+
+// Called by the HAL once a DMA transmit completes
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+    W25N04KV_StepComplete(0);
+}
+
+// Called by the HAL if a transfer fails
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi)
+{
+    W25N04KV_StepComplete(1);
+}
+
+// Called by the HAL once auto-polling reads a matching status register
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi)
+{
+    W25N04KV_StepComplete(0);
+}
@@ -0,0 +1,81 @@
+/*
+ * flash-ecc.c
+ *
+ * Contains code which tracks the results of the on-chip ECC. Every page
+ * read is counted against its block, so blocks whose bit errors are
+ * growing can be found and retired before their data is lost.
+ */
+
+#include "W25N04KV.h"
+
+//! ECC Statistics State
+
+static BlockECCStats blockECC[BLOCK_COUNT]; // Events of each block since boot
+
+// Ranks blocks by uncorrectable reads, then by corrected reads
+static bool FLASH_IsWorseECC(const BlockECCStats *a, const BlockECCStats *b)
+{
+    if (a->uncorrectable != b->uncorrectable)
+    {
+        return a->uncorrectable > b->uncorrectable;
+    }
+
+    return a->corrected > b->corrected;
+}
+
+//! ECC Statistics
+
+// Increments the counter of the block matching the result, reads without bit errors are not counted
+void W25N04KV_RecordECC(uint16_t blockAddress, FlashECCStatus ecc)
+{
+    BlockECCStats *stats = &blockECC[blockAddress % BLOCK_COUNT];
+    if (ecc == ECC_CORRECTED && stats->corrected < UINT16_MAX)
+    {
+        stats->corrected++;
+    }
+    else if ((ecc == ECC_UNCORRECTABLE || ecc == ECC_UNCORRECTABLE_PAGES) && stats->uncorrectable < UINT16_MAX)
+    {
+        stats->uncorrectable++;
+    }
+}
+
+// Copies the counters of a block
+void W25N04KV_GetBlockECCStats(uint16_t blockAddress, BlockECCStats *stats)
+{
+    *stats = blockECC[blockAddress % BLOCK_COUNT];
+}
+
+// Keeps the worst blocks seen so far in order, inserting each block with events into place. Every block with events
+// is counted, including those which did not make the list
+uint16_t W25N04KV_GetWorstECCBlocks(uint16_t *blocks, uint16_t count)
+{
+    uint16_t found = 0;
+    uint16_t listed = 0;
+
+    for (uint16_t block = 0; block < BLOCK_COUNT; block++)
+    {
+        const BlockECCStats *stats = &blockECC[block];
+        if (stats->corrected == 0 && stats->uncorrectable == 0)
+        {
+            continue;
+        }
+        found++;
+
+        // Shift better blocks down until this block's place is found, dropping the last if the list is full
+        uint16_t i = (listed < count) ? listed++ : count;
+        while (i > 0 && FLASH_IsWorseECC(stats, &blockECC[blocks[i - 1]]))
+        {
+            if (i < count)
+            {
+                blocks[i] = blocks[i - 1];
+            }
+            i--;
+        }
+        if (i < count)
+        {
+            blocks[i] = block;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,610 @@
+/*
+ * flash-ftl.c
+ *
+ * Contains the flash translation layer (FTL), which exposes logical pages
+ * that can be rewritten without erasing. Every write goes to the next page
+ * of an active block taken from the wear-leveling allocator, and a map in
+ * RAM points each logical page at its newest copy. Older copies are left
+ * in place until garbage collection moves the valid pages out of the block
+ * with the fewest, copying them inside the flash, and frees it.
+ *
+ * Each page written holds FTL_MAGIC and its logical page in the spare
+ * area. The map is checkpointed to one of a pair of reserved blocks
+ * whenever a new active block is opened, so mount loads the newest
+ * checkpoint and only has to roll forward through the pages of the active
+ * block. Once one block of the pair is full, the other is erased and
+ * written instead, so the newest checkpoint survives a power loss.
+ *
+ * Each new active block is also a chance for static wear leveling to move
+ * the FTL's least worn block, which keeps its page offsets, so the map is
+ * repointed and checkpointed before the old block is freed.
+ *
+ * A block whose page fails to program is remapped to a spare, keeping the
+ * pages before it. Once no spare is left, its valid pages are moved to a
+ * new active block and it is marked bad.
+ */
+
+#include "W25N04KV.h"
+
+#define FTL_MAX_BLOCKS (FTL_LOGICAL_PAGES / PAGES_PER_BLOCK + FTL_SPARE_BLOCKS) // Blocks held before GC runs
+#define FTL_ENTRIES_PER_PAGE (PAGE_SIZE / sizeof(uint32_t))                     // Map entries in each checkpoint page
+#define FTL_CHECKPOINT_PAGES (FTL_LOGICAL_PAGES / FTL_ENTRIES_PER_PAGE)          // Pages in each checkpoint
+#define FTL_CHECKPOINTS (PAGES_PER_BLOCK / FTL_CHECKPOINT_PAGES) // Checkpoints held by each block of the pair
+#define FTL_TAG_COLUMN (PAGE_SIZE + 4)                           // Kept clear of the bad block marker in spare byte 0
+#define FTL_PROGRAM_ATTEMPTS 3                                   // Programs of a page before a write gives up
+
+// Spare area tag of every page written by the FTL, and of every checkpoint page
+typedef struct
+{
+    uint32_t magic; // FTL_MAGIC if the page was written by the FTL
+    uint32_t value; // Logical page of a data page, or the active block of a checkpoint page
+    uint32_t count; // Checkpoint count of a checkpoint page, so the newer block of the pair is found, unused otherwise
+} FTLTag;
+
+//! FTL State
+
+static uint32_t pageMap[FTL_LOGICAL_PAGES];    // Physical page holding each logical page, FTL_UNMAPPED if none
+static uint8_t validPages[BLOCK_COUNT];        // Pages of each block holding the newest copy of a logical page
+static uint8_t ftlBlocks[BLOCK_COUNT / 8];     // Bitmap with 1 bit per block, set if the block is held by the FTL
+static uint16_t activeBlock = BLOCK_COUNT;     // Block pages are written to, BLOCK_COUNT if none is open
+static uint8_t activePage = PAGES_PER_BLOCK;   // Next page of the active block to be written
+static int checkpointBlock = -1;               // Block of the pair (0 or 1) written to, -1 if neither has been yet
+static int nextCheckpoint = 0;                 // Checkpoint of that block written next, after any cut off
+static uint32_t checkpoints = 0;               // Count of the newest checkpoint
+static bool mapStale = false;                  // Set once a trim is made, until the map is checkpointed
+static FTLStats ftlStats;                      // Activity since boot, counts are filled in on request
+
+// Checks a block's bit in the ownership bitmap
+static bool FLASH_IsFTLBlock(uint16_t blockAddress)
+{
+    return (ftlBlocks[blockAddress / 8] >> (blockAddress % 8)) & 1;
+}
+
+// Adds a block to the FTL, both in its own bitmap and the allocator's
+static void FLASH_TakeFTLBlock(uint16_t blockAddress)
+{
+    ftlBlocks[blockAddress / 8] |= 1 << (blockAddress % 8);
+    W25N04KV_ClaimBlock(blockAddress);
+    ftlStats.ownedBlocks++;
+}
+
+// Hands a block back to the allocator, to be erased when next allocated
+static void FLASH_ReleaseFTLBlock(uint16_t blockAddress)
+{
+    ftlBlocks[blockAddress / 8] &= ~(1 << (blockAddress % 8));
+    W25N04KV_FreeBlock(blockAddress);
+    ftlStats.ownedBlocks--;
+}
+
+//! Checkpoints
+
+// Writes the map as the checkpoint after the current one, moving to the other block of the pair once it is full
+int W25N04KV_FTLCheckpoint(void)
+{
+    uint8_t markerPad[FTL_TAG_COLUMN - PAGE_SIZE];
+    memset(markerPad, 0xFF, sizeof(markerPad));
+    FTLTag tag = {.magic = FTL_MAGIC, .value = activeBlock, .count = checkpoints + 1};
+
+    // Other block is only erased once the one written to is full, so the newest checkpoint is never lost
+    int block = checkpointBlock;
+    int next = nextCheckpoint;
+    if (block < 0 || next >= FTL_CHECKPOINTS || W25N04KV_IsBadBlock(FTL_BLOCK + block))
+    {
+        block = (block == 0) ? 1 : 0;
+        if (W25N04KV_IsBadBlock(FTL_BLOCK + block))
+        {
+            block = 1 - block; // Only one good block left, so its checkpoint is lost if power fails during the erase
+        }
+        if (W25N04KV_IsBadBlock(FTL_BLOCK + block) || W25N04KV_EraseBlock(FTL_BLOCK + block) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1; // Map cannot be persisted, so it is lost on reset
+        }
+        next = 0;
+    }
+
+    // Checkpoint is used up even if it is cut off, so its pages are never written twice
+    checkpointBlock = block;
+    nextCheckpoint = next + 1;
+
+    for (int page = 0; page < FTL_CHECKPOINT_PAGES; page++)
+    {
+        FlashSegment map[] = {
+            {.data = (uint8_t *)&pageMap[page * FTL_ENTRIES_PER_PAGE], .size = PAGE_SIZE},
+            {.data = markerPad, .size = sizeof(markerPad)},
+            {.data = (uint8_t *)&tag, .size = sizeof(tag)},
+        };
+        uint32_t pageAddress = (FTL_BLOCK + block) * PAGES_PER_BLOCK + next * FTL_CHECKPOINT_PAGES + page;
+        W25N04KV_MarkDirtyBlock(FTL_BLOCK + block);
+        if (W25N04KV_QuadWriteBufferSegments(map, 3, 0, true) != 0 || W25N04KV_WriteExecute(pageAddress) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+    }
+
+    checkpoints = tag.count;
+    mapStale = false;
+    return 0;
+}
+
+// Finds the last checkpoint of a block of the pair whose pages were all written, -1 if there is none. Checkpoints are
+// written in order, so the scan stops at the first one left erased, stepping past any cut off
+static int FLASH_FindFTLCheckpoint(int block, uint32_t *count, int *next)
+{
+    FTLTag tag;
+    int found = -1;
+
+    *next = 0;
+    if (W25N04KV_IsBadBlock(FTL_BLOCK + block))
+    {
+        return -1;
+    }
+
+    for (int slot = 0; slot < FTL_CHECKPOINTS; slot++)
+    {
+        uint32_t firstPage = (FTL_BLOCK + block) * PAGES_PER_BLOCK + slot * FTL_CHECKPOINT_PAGES;
+        if (W25N04KV_IsBlankPage(firstPage))
+        {
+            break;
+        }
+
+        bool complete = true;
+        for (int page = 0; page < FTL_CHECKPOINT_PAGES && complete; page++)
+        {
+            W25N04KV_ReadPage(firstPage + page);
+            complete = W25N04KV_FastQuadReadIO(FTL_TAG_COLUMN, sizeof(tag), (uint8_t *)&tag) == 0 &&
+                       tag.magic == FTL_MAGIC;
+        }
+        *next = slot + 1;
+        if (complete)
+        {
+            found = slot;
+            *count = tag.count;
+        }
+    }
+
+    return found;
+}
+
+// Loads the map from the newest complete checkpoint in either block of the pair, along with its active block
+static int FLASH_LoadFTLCheckpoint(void)
+{
+    FTLTag tag;
+    uint32_t counts[2] = {0, 0};
+    int slots[2];
+    int nexts[2];
+    int newest = -1;
+
+    for (int block = 0; block < 2; block++)
+    {
+        slots[block] = FLASH_FindFTLCheckpoint(block, &counts[block], &nexts[block]);
+        if (slots[block] >= 0 && (newest < 0 || counts[block] > counts[newest]))
+        {
+            newest = block;
+        }
+    }
+
+    if (newest < 0)
+    {
+        return 1; // No checkpoint persisted
+    }
+
+    // Checkpoints carry on after the newest, in its block until it is full
+    checkpointBlock = newest;
+    nextCheckpoint = nexts[newest];
+    checkpoints = counts[newest];
+    for (int page = 0; page < FTL_CHECKPOINT_PAGES; page++)
+    {
+        W25N04KV_ReadPage((FTL_BLOCK + newest) * PAGES_PER_BLOCK + slots[newest] * FTL_CHECKPOINT_PAGES + page);
+        if (W25N04KV_FastQuadReadIO(0, PAGE_SIZE, (uint8_t *)&pageMap[page * FTL_ENTRIES_PER_PAGE]) != 0 ||
+            W25N04KV_FastQuadReadIO(FTL_TAG_COLUMN, sizeof(tag), (uint8_t *)&tag) != 0)
+        {
+            return 1;
+        }
+    }
+    activeBlock = (tag.value < DATA_BLOCKS) ? tag.value : BLOCK_COUNT;
+
+    return 0;
+}
+
+// Maps the pages written to the active block since the checkpoint, which are all newer than it
+static void FLASH_RollForwardFTL(void)
+{
+    FTLTag tag;
+
+    activePage = 0;
+    for (int page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        uint32_t physicalPage = activeBlock * PAGES_PER_BLOCK + page;
+        W25N04KV_ReadPage(physicalPage);
+        if (W25N04KV_FastQuadReadIO(FTL_TAG_COLUMN, sizeof(tag), (uint8_t *)&tag) != 0 || tag.magic != FTL_MAGIC)
+        {
+            break; // Pages of a block are written in order, so the rest are erased
+        }
+        if (tag.value < FTL_LOGICAL_PAGES)
+        {
+            pageMap[tag.value] = physicalPage;
+        }
+        activePage = page + 1;
+    }
+}
+
+//! Mounting
+
+// Loads the last checkpoint and rolls forward, then rebuilds the valid page counts and blocks held from the map
+int W25N04KV_MountFTL(void)
+{
+    // Blocks held before a remount go back to the allocator, they are taken again if still in the map
+    for (uint16_t block = 0; block < BLOCK_COUNT; block++)
+    {
+        if (FLASH_IsFTLBlock(block))
+        {
+            W25N04KV_FreeBlock(block);
+        }
+    }
+
+    memset(pageMap, 0xFF, sizeof(pageMap));
+    memset(validPages, 0, sizeof(validPages));
+    memset(ftlBlocks, 0, sizeof(ftlBlocks));
+    ftlStats = (FTLStats){0};
+    activeBlock = BLOCK_COUNT;
+    activePage = PAGES_PER_BLOCK;
+    checkpointBlock = -1;
+    nextCheckpoint = 0;
+    checkpoints = 0;
+    mapStale = false;
+
+    if (FLASH_LoadFTLCheckpoint() != 0)
+    {
+        // Pair starts with the first checkpoint written, unless the map cannot be persisted at all
+        checkpointBlock = -1;
+        nextCheckpoint = 0;
+        if (W25N04KV_IsBadBlock(FTL_BLOCK) && W25N04KV_IsBadBlock(FTL_BLOCK + 1))
+        {
+            return 0;
+        }
+        return W25N04KV_FTLCheckpoint();
+    }
+
+    if (activeBlock != BLOCK_COUNT)
+    {
+        FLASH_RollForwardFTL();
+        FLASH_TakeFTLBlock(activeBlock);
+    }
+
+    // Blocks left without a valid page are not taken, so they return to the allocator
+    for (uint32_t logicalPage = 0; logicalPage < FTL_LOGICAL_PAGES; logicalPage++)
+    {
+        uint32_t physicalPage = pageMap[logicalPage];
+        if (physicalPage == FTL_UNMAPPED)
+        {
+            continue;
+        }
+
+        uint16_t block = physicalPage / PAGES_PER_BLOCK;
+        if (!FLASH_IsFTLBlock(block))
+        {
+            FLASH_TakeFTLBlock(block);
+        }
+        validPages[block]++;
+    }
+
+    return 0;
+}
+
+//! Static Wear Leveling
+
+// Blocks full of older copies may be moved, the active block is still being written
+static bool FLASH_IsMovableFTLBlock(uint16_t blockAddress)
+{
+    return FLASH_IsFTLBlock(blockAddress) && blockAddress != activeBlock;
+}
+
+// Points the logical pages held by a block at the same pages of the block its data was copied to, then checkpoints the
+// map, so the old block is never read again after a reset once it has been freed
+static int FLASH_MoveFTLBlock(uint16_t fromBlock, uint16_t toBlock)
+{
+    int32_t offset = ((int32_t)toBlock - fromBlock) * PAGES_PER_BLOCK;
+
+    for (uint32_t logicalPage = 0; logicalPage < FTL_LOGICAL_PAGES; logicalPage++)
+    {
+        if (pageMap[logicalPage] != FTL_UNMAPPED && pageMap[logicalPage] / PAGES_PER_BLOCK == fromBlock)
+        {
+            pageMap[logicalPage] += offset;
+        }
+    }
+    if (W25N04KV_FTLCheckpoint() != 0)
+    {
+        // Checkpointed map still points at the old block, so it is kept
+        for (uint32_t logicalPage = 0; logicalPage < FTL_LOGICAL_PAGES; logicalPage++)
+        {
+            if (pageMap[logicalPage] != FTL_UNMAPPED && pageMap[logicalPage] / PAGES_PER_BLOCK == toBlock)
+            {
+                pageMap[logicalPage] -= offset;
+            }
+        }
+        return 1;
+    }
+
+    validPages[toBlock] = validPages[fromBlock];
+    validPages[fromBlock] = 0;
+    ftlBlocks[toBlock / 8] |= 1 << (toBlock % 8);
+    ftlBlocks[fromBlock / 8] &= ~(1 << (fromBlock % 8));
+    return 0;
+}
+
+static const StaticWearOwner FTL_WEAR_OWNER = {
+    .ownsBlock = FLASH_IsMovableFTLBlock,
+    .blockMoved = FLASH_MoveFTLBlock,
+};
+
+//! Writing
+
+// Takes a new active block from the allocator, checkpointing the map so only that block needs rolling forward
+static int FLASH_OpenFTLBlock(void)
+{
+    uint16_t block = W25N04KV_AllocateBlock();
+    if (block == BLOCK_COUNT)
+    {
+        return 1;
+    }
+
+    FLASH_TakeFTLBlock(block);
+    activeBlock = block;
+    activePage = 0;
+
+    return W25N04KV_FTLCheckpoint();
+}
+
+// Drops the copy a logical page points at, if any, from its block's valid count
+static void FLASH_UnmapPage(uint32_t logicalPage)
+{
+    uint32_t physicalPage = pageMap[logicalPage];
+    if (physicalPage != FTL_UNMAPPED)
+    {
+        validPages[physicalPage / PAGES_PER_BLOCK]--;
+        pageMap[logicalPage] = FTL_UNMAPPED;
+    }
+}
+
+// Moves the valid pages of a block into the active block without reading them out, opening a new active block first
+// if they do not all fit, so the block is never left half moved
+static int FLASH_MoveValidPages(uint16_t blockAddress)
+{
+    uint32_t logicalPages[PAGES_PER_BLOCK]; // Logical page held by each page of the block, FTL_UNMAPPED if stale
+
+    if ((activeBlock == BLOCK_COUNT || PAGES_PER_BLOCK - activePage < validPages[blockAddress]) &&
+        FLASH_OpenFTLBlock() != 0)
+    {
+        return 1;
+    }
+
+    // Newest copies held by the block are found from the map, so no page is read to find them
+    uint64_t pageMask = 0;
+    for (int page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        logicalPages[page] = FTL_UNMAPPED;
+    }
+    for (uint32_t logicalPage = 0; logicalPage < FTL_LOGICAL_PAGES; logicalPage++)
+    {
+        uint32_t physicalPage = pageMap[logicalPage];
+        if (physicalPage != FTL_UNMAPPED && physicalPage / PAGES_PER_BLOCK == blockAddress)
+        {
+            logicalPages[physicalPage % PAGES_PER_BLOCK] = logicalPage;
+            pageMask |= (uint64_t)1 << (physicalPage % PAGES_PER_BLOCK);
+        }
+    }
+
+    // Copies keep their spare area tags, so they are mapped again by the roll forward after a reset
+    uint8_t relocated;
+    uint32_t firstPage = activeBlock * PAGES_PER_BLOCK + activePage;
+    int status = W25N04KV_RelocateBlock(blockAddress, pageMask, firstPage, &relocated);
+    uint8_t copy = 0;
+    for (int page = 0; page < PAGES_PER_BLOCK && copy < relocated; page++)
+    {
+        if (logicalPages[page] == FTL_UNMAPPED)
+        {
+            continue;
+        }
+        FLASH_UnmapPage(logicalPages[page]);
+        pageMap[logicalPages[page]] = firstPage + copy;
+        validPages[activeBlock]++;
+        copy++;
+    }
+    activePage += relocated;
+    ftlStats.relocatedPages += relocated;
+    if (status != 0)
+    {
+        activePage++; // Page which failed is used up, so it is never written twice
+        return 1;
+    }
+
+    return 0;
+}
+
+// Keeps the pages written to the active block before one failed to program, by remapping the block to a spare through
+// the BBM look-up table. Once no spare is left, they are moved to a new active block and the failed one is marked bad
+static int FLASH_RecoverActiveBlock(uint8_t failedPage)
+{
+    // Spare holds the same pages at the same offsets, so the map is unchanged and writing resumes at the failed page
+    if (W25N04KV_RemapBlock(activeBlock, failedPage) == 0)
+    {
+        activePage = failedPage;
+        return 0;
+    }
+
+    // Checkpoint of the new active block still points at the failed one, which is never reused once marked bad
+    uint16_t failedBlock = activeBlock;
+    if (FLASH_OpenFTLBlock() != 0 || FLASH_MoveValidPages(failedBlock) != 0)
+    {
+        return 1;
+    }
+    FLASH_ReleaseFTLBlock(failedBlock);
+    W25N04KV_MarkBadBlock(failedBlock);
+    return 0;
+}
+
+// Writes a page and its tag to the next page of the active block, then points the logical page at it. A page which
+// fails to program is written again once the active block has been recovered
+static int FLASH_ProgramFTLPage(uint32_t logicalPage, const uint8_t *data)
+{
+    uint8_t markerPad[FTL_TAG_COLUMN - PAGE_SIZE];
+    memset(markerPad, 0xFF, sizeof(markerPad));
+    FTLTag tag = {.magic = FTL_MAGIC, .value = logicalPage};
+    FlashSegment page[] = {
+        {.data = data, .size = PAGE_SIZE},
+        {.data = markerPad, .size = sizeof(markerPad)},
+        {.data = (uint8_t *)&tag, .size = sizeof(tag)},
+    };
+
+    for (int attempt = 0; attempt < FTL_PROGRAM_ATTEMPTS; attempt++)
+    {
+        if (activeBlock == BLOCK_COUNT || activePage >= PAGES_PER_BLOCK)
+        {
+            return 1; // No room left in the active block
+        }
+
+        // Page is used up even if the program fails, so a failed page is never written twice. Buffer is loaded again
+        // on each attempt, as recovering the block reads pages through it
+        uint8_t offset = activePage;
+        uint32_t physicalPage = activeBlock * PAGES_PER_BLOCK + offset;
+        activePage++;
+        W25N04KV_MarkDirtyBlock(activeBlock);
+        if (W25N04KV_QuadWriteBufferSegments(page, 3, 0, true) != 0 || W25N04KV_WriteExecute(physicalPage) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+
+        if (!(W25N04KV_ReadRegister(3) & STATUS_P_FAIL))
+        {
+            FLASH_UnmapPage(logicalPage);
+            pageMap[logicalPage] = physicalPage;
+            validPages[activeBlock]++;
+            return 0;
+        }
+        if (FLASH_RecoverActiveBlock(offset) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 1;
+}
+
+// Writes a logical page out of place, reclaiming a block first once the FTL holds too many
+int W25N04KV_FTLWrite(uint32_t logicalPage, const uint8_t *data)
+{
+    if (logicalPage >= FTL_LOGICAL_PAGES)
+    {
+        return 1;
+    }
+
+    if (activeBlock == BLOCK_COUNT || activePage >= PAGES_PER_BLOCK)
+    {
+        if (FLASH_OpenFTLBlock() != 0)
+        {
+            return 1;
+        }
+        // Emptiest block is moved into the fresh active block, which always has room for it
+        if (ftlStats.ownedBlocks > FTL_MAX_BLOCKS && W25N04KV_FTLCollectGarbage() != 0)
+        {
+            return 1;
+        }
+
+        // A failed move leaves the data where it was, so the write carries on
+        uint16_t fromBlock, toBlock;
+        W25N04KV_LevelStaticWear(&FTL_WEAR_OWNER, &fromBlock, &toBlock);
+        ftlStats.leveledBlocks += (toBlock != BLOCK_COUNT) ? 1 : 0;
+    }
+
+    return FLASH_ProgramFTLPage(logicalPage, data);
+}
+
+// Reads the newest copy of a logical page, or erased data if it has never been written
+int W25N04KV_FTLRead(uint32_t logicalPage, uint8_t *data)
+{
+    if (logicalPage >= FTL_LOGICAL_PAGES)
+    {
+        return 1;
+    }
+
+    uint32_t physicalPage = pageMap[logicalPage];
+    if (physicalPage == FTL_UNMAPPED)
+    {
+        memset(data, 0xFF, PAGE_SIZE);
+        return 0;
+    }
+
+    FlashECCStatus ecc;
+    if (W25N04KV_ReadPageECC(physicalPage, &ecc) != 0 || ecc >= ECC_UNCORRECTABLE)
+    {
+        return 1;
+    }
+    return W25N04KV_FastQuadReadIO(0, PAGE_SIZE, data);
+}
+
+// Unmaps a logical page, so its copy no longer counts as valid
+int W25N04KV_FTLTrim(uint32_t logicalPage)
+{
+    if (logicalPage >= FTL_LOGICAL_PAGES)
+    {
+        return 1;
+    }
+
+    mapStale = mapStale || pageMap[logicalPage] != FTL_UNMAPPED;
+    FLASH_UnmapPage(logicalPage);
+    return 0;
+}
+
+//! Garbage Collection
+
+// Moves the valid pages of the block with the fewest into the active block, then frees it once the map it leaves behind
+// is persisted
+int W25N04KV_FTLCollectGarbage(void)
+{
+    uint16_t victim = BLOCK_COUNT;
+    for (uint16_t block = 0; block < DATA_BLOCKS; block++)
+    {
+        if (FLASH_IsFTLBlock(block) && block != activeBlock &&
+            (victim == BLOCK_COUNT || validPages[block] < validPages[victim]))
+        {
+            victim = block;
+        }
+    }
+    if (victim == BLOCK_COUNT)
+    {
+        return 0; // Nothing to reclaim
+    }
+
+    if (FLASH_MoveValidPages(victim) != 0)
+    {
+        return 1;
+    }
+
+    // Copies written since the last checkpoint are rolled forward, but a trim made since would be lost, leaving the
+    // checkpointed map pointing into the victim once it has been reused
+    if (mapStale && W25N04KV_FTLCheckpoint() != 0)
+    {
+        return 1;
+    }
+
+    FLASH_ReleaseFTLBlock(victim);
+    ftlStats.collections++;
+    return 0;
+}
+
+//! Statistics
+
+// Copies the activity counts, counting the mapped pages
+void W25N04KV_GetFTLStats(FTLStats *stats)
+{
+    *stats = ftlStats;
+    stats->activeBlock = activeBlock;
+    stats->mappedPages = 0;
+    for (uint32_t logicalPage = 0; logicalPage < FTL_LOGICAL_PAGES; logicalPage++)
+    {
+        stats->mappedPages += (pageMap[logicalPage] != FTL_UNMAPPED) ? 1 : 0;
+    }
+}
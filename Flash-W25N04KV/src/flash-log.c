@@ -0,0 +1,104 @@
+/*
+ * flash-log.c
+ *
+ * Contains code which defers error reporting out of the driver. Failed
+ * instructions are recorded in a lock-free ring, which may be written to
+ * from any task or interrupt, and a low priority task prints the records.
+ * Drivers never wait on the UART.
+ */
+
+#include "W25N04KV.h"
+
+//! Error Ring State
+
+// Slot of the error ring, published once its record has been written
+typedef struct
+{
+    FlashError error;           // Record held in the slot
+    volatile uint32_t sequence; // Ticket of the record plus 1 once published
+} ErrorSlot;
+
+static ErrorSlot errorRing[ERROR_RING_SIZE];
+static volatile uint32_t errorHead = 0;     // Ticket of the next slot to be claimed by a writer
+static volatile uint32_t errorTail = 0;     // Ticket of the next slot to be read by the logger task
+static volatile uint32_t droppedErrors = 0; // Records lost because the ring was full
+
+//! Error Ring Operations
+
+// Claims a slot with an exclusive load and store, retrying if another task or interrupt claimed it first
+void W25N04KV_LogError(FlashOpCode opCode, uint32_t address, HAL_StatusTypeDef status)
+{
+    uint32_t ticket;
+    do
+    {
+        ticket = __LDREXW(&errorHead);
+        if (ticket - errorTail >= ERROR_RING_SIZE)
+        {
+            __CLREX();
+            // Ring is full, count the record so the loss is still reported
+            uint32_t dropped;
+            do
+            {
+                dropped = __LDREXW(&droppedErrors);
+            } while (__STREXW(dropped + 1, &droppedErrors) != 0);
+            return;
+        }
+    } while (__STREXW(ticket + 1, &errorHead) != 0);
+
+    ErrorSlot *slot = &errorRing[ticket % ERROR_RING_SIZE];
+    slot->error.opCode = opCode;
+    slot->error.address = address;
+    slot->error.status = status;
+    slot->error.tick = HAL_GetTick();
+    __DMB(); // Record must be complete before it is published
+    slot->sequence = ticket + 1;
+}
+
+// Reads the oldest slot if its writer has published it
+bool W25N04KV_PopError(FlashError *error)
+{
+    ErrorSlot *slot = &errorRing[errorTail % ERROR_RING_SIZE];
+    if (slot->sequence != errorTail + 1)
+    {
+        return false; // Ring is empty, or the oldest slot is still being written
+    }
+
+    *error = slot->error;
+    __DMB(); // Record must be copied before the slot is handed back to writers
+    errorTail = errorTail + 1;
+
+    return true;
+}
+
+// Number of records lost because the ring was full
+uint32_t W25N04KV_GetDroppedErrors(void)
+{
+    return droppedErrors;
+}
+
+//! Logger Task
+
+// Prints every record in the ring, then sleeps until the next check
+void W25N04KV_LogErrors(void *argument)
+{
+    FlashError error;
+    uint32_t reportedDrops = 0;
+
+    for (;;)
+    {
+        while (W25N04KV_PopError(&error))
+        {
+            printf("Error: Instruction 0x%02X at address %u failed with HAL status %u (tick %u)\r\n", error.opCode,
+                   error.address, error.status, error.tick);
+        }
+
+        uint32_t dropped = W25N04KV_GetDroppedErrors();
+        if (dropped != reportedDrops)
+        {
+            printf("Error: %u errors dropped, error ring was full\r\n", dropped - reportedDrops);
+            reportedDrops = dropped;
+        }
+
+        osDelay(ERROR_LOG_INTERVAL);
+    }
+}
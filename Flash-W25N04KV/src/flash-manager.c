@@ -0,0 +1,308 @@
+/*
+ * flash-manager.c
+ *
+ * Contains the flash manager task, which owns the QSPI bus. Other tasks
+ * queue read, program, and erase requests instead of calling the driver,
+ * so operations never interleave on the data buffer. Each class of request
+ * has its own queue, and the queues are checked in priority order between
+ * operations so reads are not held up by bulk erases.
+ *
+ * Tasks which call the driver directly, such as the CLI and its tests,
+ * must acquire the bus first, and the manager acquires it for each request
+ * it serves. Instructions issued by a task which does not own the bus are
+ * refused, so a sequence of instructions is never interleaved with another.
+ */
+
+#include "W25N04KV.h"
+
+//! Manager State
+
+static osMessageQueueId_t requestQueues[FLASH_REQUEST_CLASSES]; // Queue of requests for each class
+static osSemaphoreId_t pendingRequests = NULL;                  // Counts requests queued across all classes
+static FlashRequestStats requestStats[FLASH_REQUEST_CLASSES];   // Statistics of each class, updated by the manager
+static uint32_t servedRequests = 0;                             // Requests served across all classes
+static osMutexId_t busMutex = NULL;                             // Held by the task using the bus, NULL until created
+
+// Converts a number of CPU cycles to microseconds
+static uint32_t FLASH_CyclesToMicros(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+// Waits for a program or erase to finish. If the flash reports that it failed, the block is remapped to a spare in the
+// BBM look-up table keeping the pages before the failed one, or marked bad once the table is full
+static int FLASH_AwaitResult(uint16_t blockAddress, uint8_t keepPages, uint8_t failBit)
+{
+    if (W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    uint8_t statusRegister = W25N04KV_ReadRegister(3);
+    if (statusRegister == UINT8_MAX)
+    {
+        return 1;
+    }
+    if (statusRegister & failBit)
+    {
+        if (W25N04KV_RemapBlock(blockAddress, keepPages) != 0)
+        {
+            W25N04KV_MarkBadBlock(blockAddress);
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+// Runs a request on the bus, waiting for programs and erases to finish
+static int FLASH_ServeRequest(FlashRequest *request)
+{
+    FlashECCStatus ecc;
+    FlashSegment data = {.data = request->dataBuf, .size = request->dataSize};
+
+    switch (request->type)
+    {
+    case FLASH_REQUEST_READ:
+        // Data the ECC could not correct is never handed back as if it were valid
+        if (W25N04KV_ReadPageECC(request->address, &ecc) != 0 || ecc >= ECC_UNCORRECTABLE)
+        {
+            return 1;
+        }
+        return W25N04KV_FastQuadReadIO(request->columnAddress, request->dataSize, request->dataBuf);
+    case FLASH_REQUEST_PROGRAM:
+        // Buffer is reset as it is loaded, so bytes outside the request are left erased rather than programmed stale
+        W25N04KV_MarkDirtyBlock(request->address / PAGES_PER_BLOCK);
+        if (W25N04KV_QuadWriteBufferSegments(&data, 1, request->columnAddress, true) != 0 ||
+            W25N04KV_WriteExecute(request->address) != 0)
+        {
+            return 1;
+        }
+        return FLASH_AwaitResult(request->address / PAGES_PER_BLOCK, request->address % PAGES_PER_BLOCK,
+                                 STATUS_P_FAIL);
+    case FLASH_REQUEST_ERASE:
+        // Erase waits for the result itself, and leaves E-FAIL set if it failed so the block is remapped
+        if (W25N04KV_EraseBlock(request->address) == 0)
+        {
+            return 0;
+        }
+        FLASH_AwaitResult(request->address, 0, STATUS_E_FAIL);
+        return 1;
+    default:
+        return 1; // Unknown request
+    }
+}
+
+// Adds the wait and service times of a served request to the statistics of its class
+static void FLASH_RecordRequest(FlashRequestType type, uint32_t waitCycles, uint32_t serviceCycles)
+{
+    FlashRequestStats *stats = &requestStats[type];
+    uint32_t wait = FLASH_CyclesToMicros(waitCycles);
+    uint32_t service = FLASH_CyclesToMicros(serviceCycles);
+
+    stats->served++;
+    stats->lastServed = ++servedRequests;
+    stats->totalWait += wait;
+    stats->totalService += service;
+    stats->maxWait = (wait > stats->maxWait) ? wait : stats->maxWait;
+    stats->maxService = (service > stats->maxService) ? service : stats->maxService;
+}
+
+//! Manager Task
+
+// Serves one request at a time, always taking the highest priority request queued
+void W25N04KV_ManageFlash(void *argument)
+{
+    // Wait and service times are measured with the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55; // Unlock DWT registers
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (int type = 0; type < FLASH_REQUEST_CLASSES; type++)
+    {
+        requestQueues[type] = osMessageQueueNew(MANAGER_QUEUE_DEPTH, sizeof(FlashRequest), NULL);
+    }
+    pendingRequests = osSemaphoreNew(FLASH_REQUEST_CLASSES * MANAGER_QUEUE_DEPTH, 0, NULL);
+
+    /* Infinite loop */
+    for (;;)
+    {
+        // Sleep until any request is queued
+        if (osSemaphoreAcquire(pendingRequests, osWaitForever) != osOK)
+        {
+            continue;
+        }
+
+        // Queues are checked in priority order, so a read queued behind erases is served next
+        FlashRequest request;
+        int type;
+        for (type = 0; type < FLASH_REQUEST_CLASSES; type++)
+        {
+            if (osMessageQueueGet(requestQueues[type], &request, NULL, 0) == osOK)
+            {
+                break;
+            }
+        }
+        if (type == FLASH_REQUEST_CLASSES)
+        {
+            continue; // Semaphore released without a request
+        }
+
+        // Bus is held for the whole request, so a task calling the driver directly is never interleaved with it
+        W25N04KV_AcquireBus();
+        uint32_t startCycles = DWT->CYCCNT;
+        int status = FLASH_ServeRequest(&request);
+        FLASH_RecordRequest(type, startCycles - request.submitCycles, DWT->CYCCNT - startCycles);
+        W25N04KV_ReleaseBus();
+
+        // Result is stored before the requester is woken, and marks the request served. Requester cannot run between
+        // the two, so it never returns, or exits, before it is notified
+        vTaskSuspendAll();
+        *request.status = status;
+        xTaskNotifyGive(request.requester);
+        xTaskResumeAll();
+    }
+
+    // In case we accidentally exit from task loop
+    osThreadTerminate(NULL);
+}
+
+//! Requests
+
+// Queues a request and waits for the manager to serve it
+int W25N04KV_SubmitRequest(FlashRequest *request)
+{
+    if (request->type >= FLASH_REQUEST_CLASSES)
+    {
+        return 1;
+    }
+
+    // Manager would wait forever for a bus the caller already holds, so the request is served in its place
+    if (busMutex != NULL && osMutexGetOwner(busMutex) == osThreadGetId())
+    {
+        uint32_t startCycles = DWT->CYCCNT;
+        int status = FLASH_ServeRequest(request);
+        FLASH_RecordRequest(request->type, 0, DWT->CYCCNT - startCycles);
+        return status;
+    }
+
+    // Manager has not started yet
+    if (pendingRequests == NULL)
+    {
+        return 1;
+    }
+
+    volatile int status = FLASH_REQUEST_PENDING;
+    request->requester = xTaskGetCurrentTaskHandle();
+    request->status = &status;
+    request->submitCycles = DWT->CYCCNT;
+
+    osMessageQueueId_t queue = requestQueues[request->type];
+    if (osMessageQueuePut(queue, request, 0, osWaitForever) != osOK)
+    {
+        return 1;
+    }
+    FlashRequestStats *stats = &requestStats[request->type];
+    uint32_t depth = osMessageQueueGetCount(queue);
+    stats->maxDepth = (depth > stats->maxDepth) ? depth : stats->maxDepth;
+    osSemaphoreRelease(pendingRequests);
+
+    // Manager notifies this task once the request has been served, but a notification left over from a request which
+    // returned before it was given, or given by another task, does not mean this one was served
+    while (status == FLASH_REQUEST_PENDING)
+    {
+        ulTaskNotifyTake(pdTRUE, osWaitForever);
+    }
+
+    return status;
+}
+
+// Reads part of a page through the manager
+int W25N04KV_RequestRead(uint32_t pageAddress, uint16_t columnAddress, uint8_t *data, uint16_t size)
+{
+    FlashRequest request = {
+        .type = FLASH_REQUEST_READ,
+        .address = pageAddress,
+        .columnAddress = columnAddress,
+        .dataBuf = data,
+        .dataSize = size,
+    };
+
+    return W25N04KV_SubmitRequest(&request);
+}
+
+// Programs part of a page through the manager
+int W25N04KV_RequestProgram(uint32_t pageAddress, uint16_t columnAddress, uint8_t *data, uint16_t size)
+{
+    FlashRequest request = {
+        .type = FLASH_REQUEST_PROGRAM,
+        .address = pageAddress,
+        .columnAddress = columnAddress,
+        .dataBuf = data,
+        .dataSize = size,
+    };
+
+    return W25N04KV_SubmitRequest(&request);
+}
+
+// Erases a block through the manager
+int W25N04KV_RequestErase(uint16_t blockAddress)
+{
+    FlashRequest request = {
+        .type = FLASH_REQUEST_ERASE,
+        .address = blockAddress,
+    };
+
+    return W25N04KV_SubmitRequest(&request);
+}
+
+//! Bus Ownership
+
+// Creates the bus mutex. Called before the scheduler starts, so every task sees it
+void W25N04KV_InitBus(void)
+{
+    const osMutexAttr_t busMutexAttr = {
+        .name = "FlashBus",
+        .attr_bits = osMutexRecursive | osMutexPrioInherit,
+    };
+    busMutex = osMutexNew(&busMutexAttr);
+}
+
+// Waits until no other task owns the bus, then takes it for the calling task
+void W25N04KV_AcquireBus(void)
+{
+    if (busMutex != NULL)
+    {
+        osMutexAcquire(busMutex, osWaitForever);
+    }
+}
+
+// Hands the bus back once the calling task has released it as many times as it acquired it
+void W25N04KV_ReleaseBus(void)
+{
+    if (busMutex != NULL)
+    {
+        osMutexRelease(busMutex);
+    }
+}
+
+// Checks whether the calling context may issue instructions. Interrupts only continue instructions the owner started,
+// and no task can contend for the bus before the scheduler starts
+bool W25N04KV_OwnsBus(void)
+{
+    if (busMutex == NULL || __get_IPSR() != 0 || osKernelGetState() != osKernelRunning)
+    {
+        return true;
+    }
+
+    return osMutexGetOwner(busMutex) == osThreadGetId();
+}
+
+//! Statistics
+
+// Copies the statistics of a class, along with its current queue depth
+void W25N04KV_GetRequestStats(FlashRequestType type, FlashRequestStats *stats)
+{
+    *stats = requestStats[type];
+    stats->depth = (requestQueues[type] != NULL) ? osMessageQueueGetCount(requestQueues[type]) : 0;
+}
@@ -7,10 +7,30 @@
 
 #include "W25N04KV.h"
 
+// Ends the instruction on the peripheral, raising chip select. HAL_QSPI_Abort does nothing once HAL_QSPI_Command has
+// handed the handle back as ready, so the abort is requested directly, then TC and BUSY are waited out and TC cleared,
+// otherwise every later instruction would be refused as busy
+static int FLASH_AbortTransfer(void)
+{
+    uint32_t tickstart = HAL_GetTick();
+
+    SET_BIT(hqspi.Instance->CR, QUADSPI_CR_ABORT);
+    while (__HAL_QSPI_GET_FLAG(&hqspi, QSPI_FLAG_TC) == RESET || __HAL_QSPI_GET_FLAG(&hqspi, QSPI_FLAG_BUSY) != RESET)
+    {
+        if (HAL_GetTick() - tickstart > COM_TIMEOUT)
+        {
+            return 1;
+        }
+    }
+    __HAL_QSPI_CLEAR_FLAG(&hqspi, QSPI_FLAG_TC);
+
+    return 0;
+}
+
 //! Read instructions
 
 // Read buffer on 4 lines
-void W25N04KV_FastQuadReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_FastQuadReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction fastQuadReadBuffer = {
         .opCode = FAST_QUAD_READ_BUFFER,
@@ -23,15 +43,16 @@ void W25N04KV_FastQuadReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t
         .dataLinesUsed = 4,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&fastQuadReadBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to read data buffer on 4 lines\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&fastQuadReadBuffer);
 }
 
 // Read buffer on 4 lines, also send address on 4 lines
-void W25N04KV_FastQuadReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_FastQuadReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction fastQuadReadIO = {
         .opCode = FAST_QUAD_READ_IO,
@@ -45,17 +66,18 @@ void W25N04KV_FastQuadReadIO(uint16_t columnAddress, uint16_t size, uint8_t *rea
         .dataLinesUsed = 4,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&fastQuadReadIO) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to send address and read data buffer on 4 lines\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&fastQuadReadIO);
 }
 
 //! Write instructions
 
 // Write to the flash memory's data buffer on 4 lines
-void W25N04KV_QuadWriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress)
+int W25N04KV_QuadWriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress)
 {
     FlashInstruction quadWriteBuffer = {
         .opCode = QUAD_WRITE_BUFFER,
@@ -67,10 +89,263 @@ void W25N04KV_QuadWriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddre
         .dataLinesUsed = 4,
     };
 
-    W25N04KV_AwaitNotBusy();
-    W25N04KV_WriteEnable();
-    if (W25N04KV_QSPIInstruct(&quadWriteBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteEnable() != 0)
+    {
+        return 1;
+    }
+
+    return W25N04KV_QSPIInstruct(&quadWriteBuffer);
+}
+
+// Write a list of segments to the data buffer on 4 lines as a single instruction, reading each segment in place.
+// Random loads keep whatever the buffer held before, so whole pages reset it to stop stale bytes being programmed
+int W25N04KV_QuadWriteBufferSegments(const FlashSegment *segments, uint8_t segmentCount, uint16_t columnAddress,
+                                     bool resetBuffer)
+{
+    // Data length of the instruction is the total of all segments
+    uint32_t totalSize = 0;
+    for (uint8_t i = 0; i < segmentCount; i++)
+    {
+        totalSize += segments[i].size;
+    }
+    if (totalSize == 0 || columnAddress + totalSize > PAGE_SIZE + SPARE_SIZE)
+    {
+        return 1; // Bytes past the end of the spare area would be clocked out with nowhere to go
+    }
+
+    FlashOpCode opCode = resetBuffer ? QUAD_WRITE_BUFFER_RESET : QUAD_WRITE_BUFFER;
+    FlashInstruction quadWriteBuffer = {
+        .opCode = opCode,
+        .address = columnAddress,
+        .addressSize = 2,
+        .dataMode = TRANSMIT,
+        .dataSize = totalSize,
+        .dataLinesUsed = 4,
+    };
+    QSPI_CommandTypeDef sCommand;
+    W25N04KV_BuildCommand(&quadWriteBuffer, &sCommand);
+
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteEnable() != 0)
     {
-        printf("Error: Failed to write to data buffer on 4 lines\r\n");
+        return 1;
     }
+    HAL_StatusTypeDef status = HAL_QSPI_Command(&hqspi, &sCommand, COM_TIMEOUT);
+    if (status != HAL_OK)
+    {
+        W25N04KV_LogError(opCode, columnAddress, status);
+        return 1;
+    }
+
+    // Feed the FIFO from each segment in turn. The HAL only transmits from a single buffer, so the FIFO is written
+    // directly to keep every segment in one instruction.
+    __IO uint8_t *dataRegister = (__IO uint8_t *)&hqspi.Instance->DR;
+    uint32_t tickstart = HAL_GetTick();
+    for (uint8_t i = 0; i < segmentCount; i++)
+    {
+        for (uint16_t j = 0; j < segments[i].size; j++)
+        {
+            while (__HAL_QSPI_GET_FLAG(&hqspi, QSPI_FLAG_FT) == RESET)
+            {
+                if (HAL_GetTick() - tickstart > COM_TIMEOUT)
+                {
+                    FLASH_AbortTransfer();
+                    W25N04KV_LogError(opCode, columnAddress, HAL_TIMEOUT);
+                    return 1;
+                }
+            }
+            *dataRegister = segments[i].data[j];
+        }
+    }
+
+    // Wait for the last bytes to leave the FIFO
+    while (__HAL_QSPI_GET_FLAG(&hqspi, QSPI_FLAG_TC) == RESET)
+    {
+        if (HAL_GetTick() - tickstart > COM_TIMEOUT)
+        {
+            FLASH_AbortTransfer();
+            W25N04KV_LogError(opCode, columnAddress, HAL_TIMEOUT);
+            return 1;
+        }
+    }
+    __HAL_QSPI_CLEAR_FLAG(&hqspi, QSPI_FLAG_TC);
+
+    return 0;
+}
+
+// Split a run of bytes in a ring buffer into the segments before and after the end of the ring
+uint8_t W25N04KV_RingSegments(const uint8_t *ring, uint16_t ringSize, uint16_t start, uint16_t size,
+                              FlashSegment segments[2])
+{
+    if (start >= ringSize || size > ringSize)
+    {
+        return 0;
+    }
+
+    // Run fits before the end of the ring
+    if (size <= ringSize - start)
+    {
+        segments[0] = (FlashSegment){.data = &ring[start], .size = size};
+        return 1;
+    }
+
+    // Run wraps, continuing from the start of the ring
+    segments[0] = (FlashSegment){.data = &ring[start], .size = ringSize - start};
+    segments[1] = (FlashSegment){.data = ring, .size = size - (ringSize - start)};
+    return 2;
+}
+
+//! Memory-mapped instructions
+
+// Map the data buffer into the MCU's address space, read on 4 lines with address sent on 4 lines
+const volatile uint8_t *W25N04KV_MapBuffer(void)
+{
+    // Buffer is already mapped
+    if (HAL_QSPI_GetState(&hqspi) == HAL_QSPI_STATE_BUSY_MEM_MAPPED)
+    {
+        return (const volatile uint8_t *)QSPI_BASE;
+    }
+
+    FlashInstruction fastQuadReadIO = {
+        .opCode = FAST_QUAD_READ_IO,
+        .addressSize = 2,
+        .addressLinesUsed = 4,
+        .dummyClocks = 4,
+        .dataMode = RECEIVE,
+        .dataSize = PAGE_SIZE + SPARE_SIZE,
+        .dataLinesUsed = 4,
+    };
+    QSPI_CommandTypeDef sCommand;
+    W25N04KV_BuildCommand(&fastQuadReadIO, &sCommand);
+
+    // Release chip select when the CPU stops reading, so the flash is not held selected
+    QSPI_MemoryMappedTypeDef sConfig = {
+        .TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE,
+        .TimeOutPeriod = MAPPED_CS_TIMEOUT,
+    };
+
+    if (W25N04KV_AwaitNotBusy() != 0)
+    {
+        return NULL;
+    }
+    HAL_StatusTypeDef status = HAL_QSPI_MemoryMapped(&hqspi, &sCommand, &sConfig);
+    if (status != HAL_OK)
+    {
+        W25N04KV_LogError(FAST_QUAD_READ_IO, 0, status);
+        return NULL;
+    }
+
+    return (const volatile uint8_t *)QSPI_BASE;
+}
+
+// Leave memory-mapped mode so indirect instructions can be sent
+int W25N04KV_UnmapBuffer(void)
+{
+    if (HAL_QSPI_GetState(&hqspi) != HAL_QSPI_STATE_BUSY_MEM_MAPPED)
+    {
+        return 0; // Buffer is not mapped
+    }
+
+    HAL_StatusTypeDef status = HAL_QSPI_Abort(&hqspi);
+    if (status != HAL_OK)
+    {
+        W25N04KV_LogError(FAST_QUAD_READ_IO, 0, status);
+        return 1;
+    }
+
+    return 0;
+}
+
+//! Continuous read instructions
+
+// Stream consecutive pages on 4 lines in continuous read mode, passing them to the sink in chunks
+int W25N04KV_StreamPages(uint32_t pageAddress, uint32_t pageCount, uint8_t *chunkBuf, uint16_t chunkSize,
+                         FlashStreamSink sink, void *context)
+{
+    if (pageCount == 0 || chunkBuf == NULL || chunkSize == 0 || sink == NULL ||
+        pageAddress >= BLOCK_COUNT * PAGES_PER_BLOCK || pageCount > BLOCK_COUNT * PAGES_PER_BLOCK - pageAddress)
+    {
+        return 1; // Run must end at or before the last page of the flash
+    }
+
+    // Switch to continuous read mode
+    uint8_t configRegister = W25N04KV_ReadRegister(2);
+    if (configRegister == UINT8_MAX || W25N04KV_WriteRegister(2, configRegister & ~BUF_BIT) != 0)
+    {
+        return 1;
+    }
+
+    // Load the first page, later pages are loaded by the flash as the read continues
+    int error = (W25N04KV_ReadPage(pageAddress) != 0 || W25N04KV_AwaitNotBusy() != 0);
+
+    // Column address is ignored in continuous mode, so it is followed by extra dummy clocks instead
+    FlashInstruction fastQuadReadBuffer = {
+        .opCode = FAST_QUAD_READ_BUFFER,
+        .address = 0,
+        .addressSize = 2,
+        .dummyClocks = CONTINUOUS_DUMMY_CLOCKS,
+        .dataMode = RECEIVE,
+        .dataSize = 1,
+        .dataLinesUsed = 4,
+    };
+    QSPI_CommandTypeDef sCommand;
+    W25N04KV_BuildCommand(&fastQuadReadBuffer, &sCommand);
+    sCommand.NbData = pageCount * PAGE_SIZE; // Too large for an instruction's dataSize
+
+    HAL_StatusTypeDef status = (error == 0) ? HAL_QSPI_Command(&hqspi, &sCommand, COM_TIMEOUT) : HAL_OK;
+    if (status != HAL_OK)
+    {
+        W25N04KV_LogError(FAST_QUAD_READ_BUFFER, pageAddress, status);
+        error = 1;
+    }
+    if (error == 0)
+    {
+        // Start the read, then drain the FIFO into chunks as data arrives. The HAL only receives into a single
+        // buffer, so the FIFO is read directly to keep chip select low for the whole run of pages.
+        __IO uint8_t *dataRegister = (__IO uint8_t *)&hqspi.Instance->DR;
+        uint32_t remaining = sCommand.NbData;
+        uint16_t chunkIndex = 0;
+        uint32_t tickstart = HAL_GetTick();
+        MODIFY_REG(hqspi.Instance->CCR, QUADSPI_CCR_FMODE, QUADSPI_CCR_FMODE_0);
+        WRITE_REG(hqspi.Instance->AR, sCommand.Address);
+
+        while (remaining > 0)
+        {
+            if (__HAL_QSPI_GET_FLAG(&hqspi, QSPI_FLAG_FT | QSPI_FLAG_TC) == RESET)
+            {
+                if (HAL_GetTick() - tickstart > COM_TIMEOUT)
+                {
+                    W25N04KV_LogError(FAST_QUAD_READ_BUFFER, pageAddress, HAL_TIMEOUT);
+                    error = 1;
+                    break;
+                }
+                continue;
+            }
+
+            chunkBuf[chunkIndex++] = *dataRegister;
+            remaining--;
+            tickstart = HAL_GetTick();
+
+            // Pass on full chunks, and whatever is left at the end
+            if (chunkIndex == chunkSize || remaining == 0)
+            {
+                sink(chunkBuf, chunkIndex, context);
+                chunkIndex = 0;
+            }
+        }
+
+        // Release the peripheral, which also raises chip select to end the continuous read
+        if (FLASH_AbortTransfer() != 0)
+        {
+            W25N04KV_LogError(FAST_QUAD_READ_BUFFER, pageAddress, HAL_TIMEOUT);
+            error = 1;
+        }
+    }
+
+    // Restore buffer read mode
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteRegister(2, configRegister) != 0)
+    {
+        error = 1;
+    }
+
+    return error;
 }
@@ -10,8 +10,8 @@
 
 //! General Operations
 
-// Issues a command to the flash via QSPI
-int W25N04KV_QSPIInstruct(FlashInstruction *instruction)
+// Converts a flash instruction into the command structure used by the QSPI HAL, encoding every field
+void W25N04KV_EncodeCommand(FlashInstruction *instruction, QSPI_CommandTypeDef *command)
 {
     QSPI_CommandTypeDef sCommand = {0};
 
@@ -86,33 +86,53 @@ int W25N04KV_QSPIInstruct(FlashInstruction *instruction)
     }
     sCommand.NbData = instruction->dataSize;
 
-    // Send command
-    if (HAL_QSPI_Command(&hqspi, &sCommand, COM_TIMEOUT) != HAL_OK)
+    *command = sCommand;
+}
+
+// Issues a command to the flash via QSPI
+int W25N04KV_QSPIInstruct(FlashInstruction *instruction)
+{
+    QSPI_CommandTypeDef sCommand;
+    W25N04KV_BuildCommand(instruction, &sCommand);
+
+    // Task which does not own the bus could land in the middle of another's sequence on the data buffer
+    if (!W25N04KV_OwnsBus())
+    {
+        W25N04KV_LogError(instruction->opCode, instruction->address, HAL_BUSY);
+        return 1;
+    }
+
+    // Indirect commands cannot be sent while the data buffer is memory-mapped
+    if (W25N04KV_UnmapBuffer() != 0)
     {
-        return 1; // Command failed
+        return 1;
     }
 
+    // Send command
+    HAL_StatusTypeDef status = HAL_QSPI_Command(&hqspi, &sCommand, COM_TIMEOUT);
+
     // Transmit only if data is provided
-    if (instruction->dataBuf != NULL && instruction->dataSize > 0)
+    if (status == HAL_OK && instruction->dataBuf != NULL && instruction->dataSize > 0)
     {
         // Handle transmits
         if (instruction->dataMode == TRANSMIT)
         {
-            if (HAL_QSPI_Transmit(&hqspi, instruction->dataBuf, COM_TIMEOUT) != HAL_OK)
-            {
-                return 1; // Transmission failed
-            }
+            status = HAL_QSPI_Transmit(&hqspi, instruction->dataBuf, COM_TIMEOUT);
         }
         // Handle receives
         else if (instruction->dataMode == RECEIVE)
         {
-            if (HAL_QSPI_Receive(&hqspi, instruction->dataBuf, COM_TIMEOUT) != HAL_OK)
-            {
-                return 1; // Reception failed
-            }
+            status = HAL_QSPI_Receive(&hqspi, instruction->dataBuf, COM_TIMEOUT);
         }
     }
 
+    // Failures are recorded for the logger task rather than printed, so the caller is not held up by the UART
+    if (status != HAL_OK)
+    {
+        W25N04KV_LogError(instruction->opCode, instruction->address, status);
+        return 1;
+    }
+
     return 0; // Instruction successful
 }
 
@@ -133,30 +153,32 @@ uint8_t W25N04KV_ReadRegister(int registerNo)
 
     if (W25N04KV_QSPIInstruct(&readRegister) != 0)
     {
-        printf("Error: Failed to read register %u\r\n", registerNo);
         return UINT8_MAX;
     }
 
     return registerResponse;
 }
 
-// Disable write protection for all blocks and registers
-void W25N04KV_DisableWriteProtect(void)
+// Writes registers (either 1,2, or 3)
+int W25N04KV_WriteRegister(int registerNo, uint8_t value)
 {
-    uint8_t registerVal = 0x00; // Set all bits of register 1 to 0
-    FlashInstruction disableWriteProtect = {
+    FlashInstruction writeRegister = {
         .opCode = WRITE_REGISTER,
-        .address = REGISTER_ONE,
+        .address = REGISTERS[registerNo - 1],
         .addressSize = 1,
         .dataMode = TRANSMIT,
-        .dataBuf = &registerVal,
+        .dataBuf = &value,
         .dataSize = 1,
     };
 
-    if (W25N04KV_QSPIInstruct(&disableWriteProtect) != 0)
-    {
-        printf("Error: Failed to disable write protection\r\n");
-    }
+    return W25N04KV_QSPIInstruct(&writeRegister);
+}
+
+// Disable write protection for all blocks and registers
+int W25N04KV_DisableWriteProtect(void)
+{
+    // Set all bits of register 1 to 0
+    return W25N04KV_WriteRegister(1, 0x00);
 }
 
 // Read Write Enable Latch (WEL) Bit
@@ -179,24 +201,50 @@ bool W25N04KV_IsBusy(void)
     return statusRegister & 1; // Busy bit is last bit
 }
 
-// Wait till BUSY bit is cleared to zero
-void W25N04KV_AwaitNotBusy(void)
+// Wait till BUSY bit is cleared to zero by repeatedly reading it
+int W25N04KV_SpinAwaitNotBusy(void)
 {
-    // Repeatedly poll busy bit till success
+    // Repeatedly poll busy bit till success, blocks the CPU and QSPI bus
+    uint32_t tickstart = HAL_GetTick();
     while (W25N04KV_IsBusy())
     {
-        // TODO: Is constant polling like this ok? Is it blocking?
-        // Delay till BUSY bit is 0
-        continue;
+        // Give up if the BUSY bit never clears, or the status register cannot be read
+        if (HAL_GetTick() - tickstart > BUSY_TIMEOUT)
+        {
+            W25N04KV_LogError(READ_REGISTER, REGISTER_THREE, HAL_TIMEOUT);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Wait till BUSY bit is cleared to zero
+int W25N04KV_AwaitNotBusy(void)
+{
+    // Status register cannot be read without the bus, so the wait would only time out
+    if (!W25N04KV_OwnsBus())
+    {
+        W25N04KV_LogError(READ_REGISTER, REGISTER_THREE, HAL_BUSY);
+        return 1;
+    }
+
+#if USE_AUTO_POLLING
+    // Auto-polling needs a task to notify, so it is only used once the scheduler is running
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING && W25N04KV_AwaitNotBusyAutoPoll(BUSY_TIMEOUT) == 0)
+    {
+        return 0;
     }
+#endif
 
-    return;
+    // Fall back to spinning if auto-polling is disabled or fails
+    return W25N04KV_SpinAwaitNotBusy();
 }
 
 //! Read Operations
 
 // Read JEDEC ID of flash memory
-void W25N04KV_ReadJEDECID(void)
+int W25N04KV_ReadJEDECID(void)
 {
     uint8_t jedecResponse[3] = {0}; // Buffer to hold 3 byte ID (0xEFAA23)
     FlashInstruction readJEDEC = {
@@ -209,8 +257,7 @@ void W25N04KV_ReadJEDECID(void)
 
     if (W25N04KV_QSPIInstruct(&readJEDEC) != 0)
     {
-        printf("Error: Failed to send JEDEC ID command\r\n");
-        return;
+        return 1;
     }
 
     // Print JEDEC ID to UART
@@ -218,10 +265,18 @@ void W25N04KV_ReadJEDECID(void)
     printf("W25N04KV QspiNAND Memory\r\n");
     printf("JEDEC ID: 0x%02X 0x%02X 0x%02X", jedecResponse[0], jedecResponse[1], jedecResponse[2]);
     printf("\r\n------------------------\r\n");
+
+    return 0;
 }
 
 // Transfers data in a page to the flash memory's data buffer
-void W25N04KV_ReadPage(uint32_t pageAddress)
+int W25N04KV_ReadPage(uint32_t pageAddress)
+{
+    return W25N04KV_ReadPageECC(pageAddress, NULL);
+}
+
+// Transfers data in a page to the data buffer, then fetches the ECC result once the page has loaded
+int W25N04KV_ReadPageECC(uint32_t pageAddress, FlashECCStatus *ecc)
 {
     FlashInstruction readPage = {
         .opCode = READ_PAGE,
@@ -229,15 +284,29 @@ void W25N04KV_ReadPage(uint32_t pageAddress)
         .addressSize = 3,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&readPage) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_QSPIInstruct(&readPage) != 0 || W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to read page %u\r\n", pageAddress);
+        return 1;
     }
+
+    uint8_t statusRegister = W25N04KV_ReadRegister(3);
+    if (statusRegister == UINT8_MAX)
+    {
+        return 1;
+    }
+
+    FlashECCStatus result = (statusRegister >> STATUS_ECC_SHIFT) & 0x03;
+    W25N04KV_RecordECC(pageAddress / PAGES_PER_BLOCK, result);
+    if (ecc != NULL)
+    {
+        *ecc = result;
+    }
+
+    return 0;
 }
 
 // Reads data from the flash memory buffer into the provided buffer `readResponse`
-void W25N04KV_ReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_ReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction readBuffer = {
         .opCode = READ_BUFFER,
@@ -249,15 +318,16 @@ void W25N04KV_ReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readRes
         .dataSize = size,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&readBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to read data buffer\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&readBuffer);
 }
 
 // Read buffer for higher clock rates, functionally same as normal read for this flash
-void W25N04KV_FastReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_FastReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction fastReadBuffer = {
         .opCode = FAST_READ_BUFFER,
@@ -269,15 +339,16 @@ void W25N04KV_FastReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *rea
         .dataSize = size,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&fastReadBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to read data buffer\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&fastReadBuffer);
 }
 
 // Read buffer on 2 lines
-void W25N04KV_FastDualReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_FastDualReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction fastDualReadBuffer = {
         .opCode = FAST_DUAL_READ_BUFFER,
@@ -290,15 +361,16 @@ void W25N04KV_FastDualReadBuffer(uint16_t columnAddress, uint16_t size, uint8_t
         .dataLinesUsed = 2,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&fastDualReadBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to read data buffer on 2 lines\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&fastDualReadBuffer);
 }
 
 // Read buffer on 2 lines, also send address on 2 lines
-void W25N04KV_FastDualReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
+int W25N04KV_FastDualReadIO(uint16_t columnAddress, uint16_t size, uint8_t *readResponse)
 {
     FlashInstruction fastDualReadIO = {
         .opCode = FAST_DUAL_READ_IO,
@@ -312,39 +384,34 @@ void W25N04KV_FastDualReadIO(uint16_t columnAddress, uint16_t size, uint8_t *rea
         .dataLinesUsed = 2,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&fastDualReadIO) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to send address and read data buffer on 2 lines\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&fastDualReadIO);
 }
 
 //! Write Operations
 
 // Enable write operations to the flash memory
-void W25N04KV_WriteEnable(void)
+int W25N04KV_WriteEnable(void)
 {
     FlashInstruction writeEnable = {.opCode = WRITE_ENABLE};
 
-    if (W25N04KV_QSPIInstruct(&writeEnable) != 0)
-    {
-        printf("Error: Failed to enable writes\r\n");
-    }
+    return W25N04KV_QSPIInstruct(&writeEnable);
 }
 
 // Disable write operations to the flash memory
-void W25N04KV_WriteDisable(void)
+int W25N04KV_WriteDisable(void)
 {
     FlashInstruction writeDisable = {.opCode = WRITE_DISABLE};
 
-    if (W25N04KV_QSPIInstruct(&writeDisable) != 0)
-    {
-        printf("Error: Failed to disable writes\r\n");
-    }
+    return W25N04KV_QSPIInstruct(&writeDisable);
 }
 
 // Write to the flash memory's data buffer
-void W25N04KV_WriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress)
+int W25N04KV_WriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress)
 {
     FlashInstruction writeBuffer = {
         .opCode = WRITE_BUFFER,
@@ -355,16 +422,16 @@ void W25N04KV_WriteBuffer(uint8_t *data, uint16_t size, uint16_t columnAddress)
         .dataSize = size,
     };
 
-    W25N04KV_AwaitNotBusy();
-    W25N04KV_WriteEnable();
-    if (W25N04KV_QSPIInstruct(&writeBuffer) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteEnable() != 0)
     {
-        printf("Error: Failed to write to data buffer\r\n");
+        return 1;
     }
+
+    return W25N04KV_QSPIInstruct(&writeBuffer);
 }
 
 // Write data in buffer to a page with a 3 byte address
-void W25N04KV_WriteExecute(uint32_t pageAddress)
+int W25N04KV_WriteExecute(uint32_t pageAddress)
 {
     FlashInstruction writeExecute = {
         .opCode = WRITE_EXECUTE,
@@ -372,17 +439,21 @@ void W25N04KV_WriteExecute(uint32_t pageAddress)
         .addressSize = 3,
     };
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&writeExecute) != 0)
+    // Bad blocks are never written. Programs made by the driver have already recorded the block as dirty, any other
+    // is recorded in RAM, as persisting the table here would go through the loaded buffer
+    if (W25N04KV_IsBadBlock(pageAddress / PAGES_PER_BLOCK) || W25N04KV_AwaitNotBusy() != 0)
     {
-        printf("Error: Failed to write buffer into flash\r\n");
+        return 1;
     }
+    W25N04KV_SetDirtyBlock(pageAddress / PAGES_PER_BLOCK);
+
+    return W25N04KV_QSPIInstruct(&writeExecute);
 }
 
 //! Erase Operations
 
 // Erase the entire data buffer
-void W25N04KV_EraseBuffer(void)
+int W25N04KV_EraseBuffer(void)
 {
     FlashInstruction eraseBuffer = {
         .opCode = WRITE_BUFFER_WITH_RESET,
@@ -390,92 +461,116 @@ void W25N04KV_EraseBuffer(void)
         .addressSize = 2,
     };
 
-    W25N04KV_WriteEnable();
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&eraseBuffer) != 0)
+    if (W25N04KV_WriteEnable() != 0 || W25N04KV_AwaitNotBusy() != 0 || W25N04KV_QSPIInstruct(&eraseBuffer) != 0)
     {
-        printf("Error: Failed to erase buffer\r\n");
+        return 1;
     }
-    W25N04KV_WriteDisable();
+
+    return W25N04KV_WriteDisable();
 }
 
 // Erase the block at the given block address (between 0 and 4095)
-void W25N04KV_EraseBlock(uint16_t blockAddress)
+int W25N04KV_EraseBlock(uint16_t blockAddress)
 {
     FlashInstruction eraseBlock = {
         .opCode = ERASE_BLOCK,
-        .address = blockAddress * 64,
+        .address = blockAddress * PAGES_PER_BLOCK,
         .addressSize = 3,
     };
 
-    W25N04KV_AwaitNotBusy();
-    W25N04KV_WriteEnable();
-    if (W25N04KV_QSPIInstruct(&eraseBlock) != 0)
+    // Bad blocks are never erased, which would clear their factory marker
+    if (W25N04KV_IsBadBlock(blockAddress) || W25N04KV_AwaitNotBusy() != 0 || W25N04KV_WriteEnable() != 0 ||
+        W25N04KV_QSPIInstruct(&eraseBlock) != 0)
     {
-        printf("Error: Failed to erase block\r\n");
+        return 1;
     }
+
+    // Block only counts as clean once the flash reports the erase succeeded
+    uint8_t statusRegister = (W25N04KV_AwaitNotBusy() == 0) ? W25N04KV_ReadRegister(3) : UINT8_MAX;
+    W25N04KV_CountErase(blockAddress);
+    if (statusRegister == UINT8_MAX || (statusRegister & STATUS_E_FAIL))
+    {
+        return 1;
+    }
+
+    W25N04KV_ClearDirtyBlock(blockAddress);
+    return 0;
 }
 
 // Resets device software and disables write protection
-void W25N04KV_ResetDeviceSoftware(void)
+int W25N04KV_ResetDeviceSoftware(void)
 {
     FlashInstruction resetSoftware = {.opCode = RESET_DEVICE};
 
-    W25N04KV_AwaitNotBusy();
-    if (W25N04KV_QSPIInstruct(&resetSoftware) != 0)
+    if (W25N04KV_AwaitNotBusy() != 0 || W25N04KV_QSPIInstruct(&resetSoftware) != 0)
     {
-        printf("Failed to reset software\r\n");
+        return 1;
     }
-    W25N04KV_DisableWriteProtect();
+
+    return W25N04KV_DisableWriteProtect();
 }
 
-// Resets entire memory array of flash to 0xFF, and also reset software
-void W25N04KV_EraseDevice(void)
+// Checks whether every byte of a page, including its spare area, is erased. A program cut off by a power loss may
+// leave any of its bytes programmed
+bool W25N04KV_IsBlankPage(uint32_t pageAddress)
 {
-    // There are 40 blocks
-    for (int i = 0; i < 4096; i++)
+    static uint8_t pageData[PAGE_SIZE + SPARE_SIZE];
+
+    if (W25N04KV_ReadPage(pageAddress) != 0 || W25N04KV_FastQuadReadIO(0, sizeof(pageData), pageData) != 0)
     {
-        W25N04KV_EraseBlock(i);
+        return false;
     }
-
-    // Erase buffer and reset software
-    W25N04KV_EraseBuffer();
-    W25N04KV_ResetDeviceSoftware();
-}
-
-//! Circular Buffer Operations
-
-// Finds the head and tail of the flash and stores it into a circular buffer
-void W25N04KV_FindHeadTail(CircularBuffer *buf, uint8_t pageRange[2])
-{
-    // Use entire range if not specified
-    if (pageRange == NULL)
+    for (uint16_t i = 0; i < sizeof(pageData); i++)
     {
-        pageRange[0] = 0;
-        pageRange[1] = 262144;
+        if (pageData[i] != 0xFF)
+        {
+            return false;
+        }
     }
 
-    bool headFound = false;      // Tracks whether head has been found
-    union PageStructure pageBuf; // Buffer to store page data
+    return true;
+}
 
-    for (int p = pageRange[0]; p < pageRange[1]; p++)
+// Resets every block holding data to 0xFF, and also reset software
+int W25N04KV_EraseDevice(bool blankCheck)
+{
+    // A failed erase does not stop the rest from being erased
+    int error = 0;
+    for (int i = 0; i < BLOCK_COUNT; i++)
     {
-        W25N04KV_ReadPage(p);
-        W25N04KV_ReadBuffer(0, 2048, pageBuf.bytes);
+        // Bad blocks are skipped, and the bad block, dirty block, and erase count tables and tune record are kept
+        if (W25N04KV_IsBadBlock(i) || i == BBT_BLOCK || i == DIRTY_BLOCK || i == WEAR_BLOCK || i == TUNE_BLOCK)
+        {
+            continue;
+        }
 
-        // Check dummy byte of every packet
-        for (int i = 0; i < 6; i++)
+        // Clean blocks are already erased, unless checking finds data the table missed. Pages of a block are
+        // programmed in order, so only the first is checked
+        if (!W25N04KV_IsDirtyBlock(i) && !(blankCheck && !W25N04KV_IsBlankPage(i * PAGES_PER_BLOCK)))
         {
-            Packet packet = pageBuf.page.packetArray[i];
-            if (packet.dummy != 0xFF)
-            {
-                if (!headFound)
-                {
-                    buf->head = p * 2048 + i * sizeof(Packet);
-                    headFound = true;
-                }
-                buf->tail = p * 2048 + (i + 1) * sizeof(Packet);
-            }
+            continue;
         }
+        error |= W25N04KV_EraseBlock(i);
     }
+
+    // Erased blocks were only cleared and counted in RAM
+    error |= W25N04KV_AwaitNotBusy();
+    error |= W25N04KV_PersistDirtyBlocks();
+    error |= W25N04KV_PersistWear();
+
+    // Every FTL page and checkpoint was erased, so it starts again with an empty map
+    error |= W25N04KV_MountFTL();
+
+    // Superblock pair was erased too, so the next commit starts again from the first page
+    Superblock super;
+    W25N04KV_LoadSuperblock(&super);
+
+    // Log writer state in the backup SRAM points at erased pages
+    W25N04KV_DiscardWarmLog();
+
+    // Erase buffer and reset software
+    error |= W25N04KV_EraseBuffer();
+    error |= W25N04KV_ResetDeviceSoftware();
+
+    return error;
 }
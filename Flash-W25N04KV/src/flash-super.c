@@ -0,0 +1,204 @@
+/*
+ * flash-super.c
+ *
+ * Contains the superblock, a checkpoint of the circular log which lets
+ * mount skip the head/tail search. Each commit writes a copy of the
+ * superblock to the next page of one of a pair of reserved blocks. Once
+ * that block is full, the other is erased and written instead, so the
+ * newest copy always survives a power loss during the erase.
+ *
+ * Mount takes the copy with the highest commit count whose CRC matches,
+ * then rolls the log forward through the pages written since.
+ */
+
+#include "W25N04KV.h"
+
+//! Superblock State
+
+static int activeSuper = -1;     // Block of the pair (0 or 1) written to last, -1 if neither has been written
+static int superPage = -1;       // Last page of the active block written, even if its program failed
+static uint32_t commits = 0;     // Commit count of the newest copy
+static bool superLoaded = false; // Set once the pair has been read, so commits never go behind a newer copy
+
+// Checks the magic and CRC of a copy read from the flash
+static bool FLASH_IsSuperblockValid(const Superblock *super)
+{
+    return super->magic == SUPER_MAGIC &&
+           super->crc == W25N04KV_CRC32((uint8_t *)super, sizeof(Superblock) - sizeof(uint32_t));
+}
+
+// Reads the copy held by a page of the pair
+static int FLASH_ReadSuperblock(uint32_t pageAddress, Superblock *super)
+{
+    memset(super, 0xFF, sizeof(*super));
+    if (W25N04KV_ReadPage(pageAddress) != 0)
+    {
+        return 1;
+    }
+
+    return W25N04KV_FastQuadReadIO(0, sizeof(*super), (uint8_t *)super);
+}
+
+// Finds the newest valid copy in a block of the pair, along with the last page written. Copies are written in page
+// order, so the last page which is not blank is binary searched, then any copy cut off or failed is skipped
+static int FLASH_FindSuperblock(uint16_t blockAddress, Superblock *super, int *lastPage)
+{
+    int written = 0;
+    int unwritten = PAGES_PER_BLOCK;
+
+    *lastPage = -1;
+    if (W25N04KV_IsBadBlock(blockAddress))
+    {
+        return -1;
+    }
+
+    while (written < unwritten)
+    {
+        int page = (written + unwritten) / 2;
+        if (!W25N04KV_IsBlankPage(blockAddress * PAGES_PER_BLOCK + page))
+        {
+            written = page + 1;
+        }
+        else
+        {
+            unwritten = page;
+        }
+    }
+
+    *lastPage = written - 1;
+    for (int page = written - 1; page >= 0; page--)
+    {
+        if (FLASH_ReadSuperblock(blockAddress * PAGES_PER_BLOCK + page, super) == 0 && FLASH_IsSuperblockValid(super))
+        {
+            return page;
+        }
+    }
+
+    return -1;
+}
+
+//! Superblock
+
+// Loads the newest valid copy from either block of the pair
+int W25N04KV_LoadSuperblock(Superblock *super)
+{
+    Superblock copies[2];
+    int pages[2];
+    int lastPages[2];
+
+    activeSuper = -1;
+    superPage = -1;
+    commits = 0;
+    superLoaded = true;
+    for (int i = 0; i < 2; i++)
+    {
+        pages[i] = FLASH_FindSuperblock(SUPER_BLOCK + i, &copies[i], &lastPages[i]);
+        if (pages[i] >= 0 && (activeSuper < 0 || copies[i].commits > copies[activeSuper].commits))
+        {
+            activeSuper = i;
+        }
+    }
+
+    if (activeSuper < 0)
+    {
+        return 1; // No copy committed
+    }
+
+    // Commits carry on after the last page written to the block, past any copy which failed after the newest
+    superPage = lastPages[activeSuper];
+    commits = copies[activeSuper].commits;
+    *super = copies[activeSuper];
+    return 0;
+}
+
+// Writes a copy of the superblock to the next page of the active block, moving to the other block once it is full
+int W25N04KV_CommitSuperblock(const CircularBuffer *buf, const uint32_t pageRange[2], uint32_t nextSequence)
+{
+    WearStats wear;
+    Superblock super;
+
+    // Commit count must carry on from the newest copy already in the pair
+    if (!superLoaded)
+    {
+        W25N04KV_LoadSuperblock(&super);
+    }
+
+    W25N04KV_GetWearStats(&wear);
+    super = (Superblock){
+        .magic = SUPER_MAGIC,
+        .commits = commits + 1,
+        .log = *buf,
+        .firstPage = pageRange[0],
+        .endPage = pageRange[1],
+        .nextSequence = nextSequence,
+        .badBlocks = W25N04KV_GetBadBlockCount(),
+        .minErases = wear.minErases,
+        .maxErases = wear.maxErases,
+        .dataBlocks = wear.blocks,
+        .totalErases = wear.totalErases,
+    };
+    super.crc = W25N04KV_CRC32((uint8_t *)&super, sizeof(Superblock) - sizeof(uint32_t));
+
+    // Other block is only erased once the active one is full, so the newest copy is never lost
+    int block = activeSuper;
+    int page = superPage + 1;
+    if (block < 0 || page >= PAGES_PER_BLOCK || W25N04KV_IsBadBlock(SUPER_BLOCK + block))
+    {
+        block = (block == 0) ? 1 : 0;
+        if (W25N04KV_IsBadBlock(SUPER_BLOCK + block))
+        {
+            block = 1 - block; // Only one good block left, so its copy is lost if power fails during the erase
+        }
+        if (W25N04KV_IsBadBlock(SUPER_BLOCK + block) || W25N04KV_EraseBlock(SUPER_BLOCK + block) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+        page = 0;
+    }
+
+    // Page is used even if the program fails, so it is never programmed twice
+    activeSuper = block;
+    superPage = page;
+    FlashSegment copy = {.data = (uint8_t *)&super, .size = sizeof(super)};
+    W25N04KV_MarkDirtyBlock(SUPER_BLOCK + block);
+    if (W25N04KV_QuadWriteBufferSegments(&copy, 1, 0, true) != 0 ||
+        W25N04KV_WriteExecute((SUPER_BLOCK + block) * PAGES_PER_BLOCK + page) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+
+    commits = super.commits;
+    return 0;
+}
+
+//! Mounting
+
+// Loads the log's position from the superblock and rolls forward, or searches for it if no copy matches the range
+int W25N04KV_MountLog(CircularBuffer *buf, uint32_t pageRange[2], uint32_t *nextSequence)
+{
+    Superblock super;
+    PageHeader header;
+
+    if (W25N04KV_LoadSuperblock(&super) == 0 && super.firstPage == pageRange[0] && super.endPage == pageRange[1])
+    {
+        *buf = super.log;
+        *nextSequence = super.nextSequence;
+        W25N04KV_RollForwardLog(buf, pageRange, nextSequence);
+        return 0;
+    }
+
+    // Without a checkpoint, the sequence carries on from the newest page found by the search
+    W25N04KV_FindHeadTail(buf, pageRange, SCAN_BINARY);
+    *nextSequence = 0;
+    if (buf->tail != buf->head)
+    {
+        if (W25N04KV_ReadPageHeader((buf->tail - 1) / PAGE_SIZE, &header) != 0)
+        {
+            return 1;
+        }
+        *nextSequence = (header.sequence != SEQUENCE_BLANK) ? header.sequence + 1 : 0;
+    }
+
+    return 0;
+}
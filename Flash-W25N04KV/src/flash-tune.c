@@ -0,0 +1,147 @@
+/*
+ * flash-tune.c
+ *
+ * Contains code which calibrates the QSPI clock of each board. A known
+ * pattern is read back at every clock setting, and the fastest setting
+ * which reads reliably is applied and persisted in a reserved block.
+ */
+
+#include "W25N04KV.h"
+
+//! Calibration Pattern
+
+#define TUNE_PATTERN_PAGE (TUNE_BLOCK * 64)    // Page holding the calibration pattern
+#define TUNE_RECORD_PAGE (TUNE_BLOCK * 64 + 1) // Page whose spare area holds the calibration result
+
+// Byte of the calibration pattern at a given column, mixing alternating bits with a counter so every line toggles
+static uint8_t FLASH_TunePattern(uint16_t column)
+{
+    return (uint8_t)(column * 167 + 13) ^ ((column & 1) ? 0xAA : 0x55);
+}
+
+// Reads the pattern on 4 lines at the current clock, checking every byte of every read
+static bool FLASH_TuneReadsPass(void)
+{
+    static uint8_t readResponse[PAGE_SIZE];
+
+    for (int pass = 0; pass < TUNE_PASSES; pass++)
+    {
+        memset(readResponse, 0, PAGE_SIZE);
+        W25N04KV_FastQuadReadIO(0, PAGE_SIZE, readResponse);
+        for (uint16_t i = 0; i < PAGE_SIZE; i++)
+        {
+            if (readResponse[i] != FLASH_TunePattern(i))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//! Clock Configuration
+
+// Reinitialises the QSPI peripheral with a new prescaler and sample shift
+int W25N04KV_SetClock(uint8_t prescaler, bool sampleShift)
+{
+    // Peripheral must be idle before it is reconfigured
+    if (W25N04KV_IsAsyncBusy() || W25N04KV_UnmapBuffer() != 0)
+    {
+        return 1;
+    }
+
+    hqspi.Init.ClockPrescaler = prescaler;
+    hqspi.Init.SampleShifting = sampleShift ? QSPI_SAMPLE_SHIFTING_HALFCYCLE : QSPI_SAMPLE_SHIFTING_NONE;
+    return (HAL_QSPI_Init(&hqspi) != HAL_OK) ? 1 : 0;
+}
+
+//! Calibration
+
+// Sweeps clock settings from slowest to fastest and applies the fastest one with margin
+int W25N04KV_TuneClock(ClockTuning *result)
+{
+    ClockTuning tuning = {.magic = TUNE_MAGIC, .prescaler = TUNE_SLOWEST_PRESCALER, .sampleShift = 1};
+    static uint8_t pageData[PAGE_SIZE];
+
+    // Write the pattern at the default clock, into a reset buffer so the spare area is not programmed with stale bytes
+    W25N04KV_SetClock(TUNE_SLOWEST_PRESCALER, true);
+    W25N04KV_EraseBlock(TUNE_BLOCK);
+    for (uint16_t i = 0; i < PAGE_SIZE; i++)
+    {
+        pageData[i] = FLASH_TunePattern(i);
+    }
+    W25N04KV_MarkDirtyBlock(TUNE_BLOCK);
+    W25N04KV_EraseBuffer();
+    W25N04KV_WriteBuffer(pageData, PAGE_SIZE, 0);
+    W25N04KV_WriteExecute(TUNE_PATTERN_PAGE);
+
+    // Only the reads are swept, the page stays loaded in the data buffer throughout
+    W25N04KV_ReadPage(TUNE_PATTERN_PAGE);
+    W25N04KV_AwaitNotBusy();
+    bool found = false;
+    for (int prescaler = TUNE_SLOWEST_PRESCALER; prescaler >= TUNE_FASTEST_PRESCALER; prescaler--)
+    {
+        for (int shift = 0; shift <= 1; shift++)
+        {
+            if (W25N04KV_SetClock(prescaler, shift) == 0 && FLASH_TuneReadsPass())
+            {
+                tuning.passed[prescaler] |= 1 << shift;
+            }
+        }
+
+        // Data must be valid at both sample points, otherwise the setting is on the edge of failing
+        if (tuning.passed[prescaler] == 0x03)
+        {
+            tuning.prescaler = prescaler;
+            found = true;
+        }
+    }
+
+    // Persist the result at the default clock alongside the pattern, a failed calibration is retried next boot
+    W25N04KV_SetClock(TUNE_SLOWEST_PRESCALER, true);
+    if (found)
+    {
+        W25N04KV_EraseBuffer();
+        W25N04KV_WriteBuffer((uint8_t *)&tuning, sizeof(tuning), PAGE_SIZE);
+        W25N04KV_WriteExecute(TUNE_RECORD_PAGE);
+        W25N04KV_AwaitNotBusy();
+        W25N04KV_SetClock(tuning.prescaler, tuning.sampleShift);
+    }
+    if (result != NULL)
+    {
+        *result = tuning;
+    }
+
+    return found ? 0 : 1;
+}
+
+// Reads the calibration result from the spare area of the record page
+int W25N04KV_LoadClockTuning(ClockTuning *result)
+{
+    W25N04KV_ReadPage(TUNE_RECORD_PAGE);
+    W25N04KV_AwaitNotBusy();
+    W25N04KV_FastReadBuffer(PAGE_SIZE, sizeof(ClockTuning), (uint8_t *)result);
+
+    // Erased spare area, or a result from a build with different limits
+    if (result->magic != TUNE_MAGIC || result->prescaler > TUNE_SLOWEST_PRESCALER ||
+        result->prescaler < TUNE_FASTEST_PRESCALER || result->sampleShift > 1)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Applies the persisted clock, calibrating on the first boot of a board
+int W25N04KV_InitClock(void)
+{
+    ClockTuning tuning;
+
+    if (W25N04KV_LoadClockTuning(&tuning) != 0)
+    {
+        return W25N04KV_TuneClock(NULL);
+    }
+
+    return W25N04KV_SetClock(tuning.prescaler, tuning.sampleShift);
+}
@@ -0,0 +1,344 @@
+/*
+ * flash-wear.c
+ *
+ * Contains the wear-leveling block allocator. The erase count of every
+ * block is kept in RAM and persisted in a reserved block, so blocks are
+ * allocated least worn first (dynamic leveling). Data which is never
+ * rewritten keeps its block from being worn, so it is occasionally moved
+ * onto a worn block, freeing the little-worn block for use (static leveling).
+ *
+ * The table is persisted as a snapshot of 4 pages, each holding the
+ * 16-bit counts of 1024 blocks, with WEAR_MAGIC in the spare area. The
+ * last complete snapshot in the reserved block is the current one, and a
+ * snapshot cut off by a power loss is stepped past rather than written
+ * over.
+ */
+
+#include "W25N04KV.h"
+
+#define WEAR_COUNTS_PER_PAGE (PAGE_SIZE / sizeof(uint16_t))       // Erase counts held in each page of a snapshot
+#define WEAR_SNAPSHOT_PAGES (BLOCK_COUNT / WEAR_COUNTS_PER_PAGE) // Pages in each snapshot of the table
+#define WEAR_SNAPSHOTS (PAGES_PER_BLOCK / WEAR_SNAPSHOT_PAGES)   // Snapshots held by WEAR_BLOCK before it is erased
+#define WEAR_MAGIC_COLUMN (PAGE_SIZE + 4)                        // Kept clear of the bad block marker in spare byte 0
+
+//! Allocator State
+
+static uint16_t eraseCounts[BLOCK_COUNT];        // Erases of each block, saturating at UINT16_MAX
+static uint8_t allocatedBlocks[BLOCK_COUNT / 8]; // Bitmap with 1 bit per block, set if the block holds live data
+static int snapshot = -1;                        // Snapshot of WEAR_BLOCK holding the current table, -1 if none
+static int nextSnapshot = 0;                     // Snapshot of WEAR_BLOCK the next table is written to
+static uint32_t unpersistedErases = 0;           // Erases counted since the table was last persisted
+static bool wearMounted = false;                 // Set once the table is loaded, so it is never persisted before
+
+// Checks a block's bit in the allocation bitmap
+bool W25N04KV_IsAllocatedBlock(uint16_t blockAddress)
+{
+    return (allocatedBlocks[blockAddress / 8] >> (blockAddress % 8)) & 1;
+}
+
+// Checks whether a block may be handed out by the allocator
+static bool FLASH_IsFreeBlock(uint16_t blockAddress)
+{
+    return !W25N04KV_IsAllocatedBlock(blockAddress) && !W25N04KV_IsBadBlock(blockAddress);
+}
+
+//! Persistence
+
+// Writes the table as the snapshot after the current one, erasing the block once every snapshot has been used
+int W25N04KV_PersistWear(void)
+{
+    uint32_t magic = WEAR_MAGIC;
+    uint8_t markerPad[WEAR_MAGIC_COLUMN - PAGE_SIZE];
+    memset(markerPad, 0xFF, sizeof(markerPad));
+
+    // Table cannot be persisted in a bad block, so counts restart from 0 next boot
+    if (W25N04KV_IsBadBlock(WEAR_BLOCK))
+    {
+        return 1;
+    }
+
+    int next = nextSnapshot;
+    if (next >= WEAR_SNAPSHOTS)
+    {
+        if (W25N04KV_EraseBlock(WEAR_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+        snapshot = -1;
+        next = 0;
+    }
+
+    // Snapshot is used even if a program fails, so none of its pages is programmed twice
+    nextSnapshot = next + 1;
+    for (int page = 0; page < WEAR_SNAPSHOT_PAGES; page++)
+    {
+        FlashSegment table[] = {
+            {.data = (uint8_t *)&eraseCounts[page * WEAR_COUNTS_PER_PAGE], .size = PAGE_SIZE},
+            {.data = markerPad, .size = sizeof(markerPad)},
+            {.data = (uint8_t *)&magic, .size = sizeof(magic)},
+        };
+        uint32_t pageAddress = WEAR_BLOCK * PAGES_PER_BLOCK + next * WEAR_SNAPSHOT_PAGES + page;
+        if (W25N04KV_QuadWriteBufferSegments(table, 3, 0, true) != 0 || W25N04KV_WriteExecute(pageAddress) != 0 ||
+            W25N04KV_AwaitNotBusy() != 0)
+        {
+            return 1;
+        }
+    }
+
+    snapshot = next;
+    unpersistedErases = 0;
+    return 0;
+}
+
+// Loads the table from the last snapshot of WEAR_BLOCK whose pages were all written, stepping past any snapshot cut
+// off by a power loss
+static int FLASH_LoadWear(void)
+{
+    uint32_t magic;
+
+    for (int next = 0; next < WEAR_SNAPSHOTS; next++)
+    {
+        bool complete = true;
+        bool used = false;
+        for (int page = 0; page < WEAR_SNAPSHOT_PAGES; page++)
+        {
+            uint32_t pageAddress = WEAR_BLOCK * PAGES_PER_BLOCK + next * WEAR_SNAPSHOT_PAGES + page;
+            W25N04KV_ReadPage(pageAddress);
+            if (W25N04KV_FastQuadReadIO(WEAR_MAGIC_COLUMN, sizeof(magic), (uint8_t *)&magic) == 0 &&
+                magic == WEAR_MAGIC)
+            {
+                used = true;
+                continue;
+            }
+            complete = false;
+            if (W25N04KV_IsBlankPage(pageAddress))
+            {
+                break; // Pages after the last one written are erased
+            }
+            used = true;
+        }
+        if (!used)
+        {
+            break; // Snapshots after the last one written are erased
+        }
+        nextSnapshot = next + 1;
+        snapshot = complete ? next : snapshot;
+    }
+
+    if (snapshot < 0)
+    {
+        return 1; // No table persisted
+    }
+
+    for (int page = 0; page < WEAR_SNAPSHOT_PAGES; page++)
+    {
+        W25N04KV_ReadPage(WEAR_BLOCK * PAGES_PER_BLOCK + snapshot * WEAR_SNAPSHOT_PAGES + page);
+        if (W25N04KV_FastQuadReadIO(0, PAGE_SIZE, (uint8_t *)&eraseCounts[page * WEAR_COUNTS_PER_PAGE]) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+//! Erase Counts
+
+// Loads the persisted table, or starts every count at 0 on the first boot
+int W25N04KV_MountWear(void)
+{
+    memset(allocatedBlocks, 0, sizeof(allocatedBlocks));
+    snapshot = -1;
+    nextSnapshot = 0;
+    unpersistedErases = 0;
+    wearMounted = true;
+    if (FLASH_LoadWear() == 0)
+    {
+        return 0;
+    }
+
+    memset(eraseCounts, 0, sizeof(eraseCounts));
+    if (W25N04KV_IsBadBlock(WEAR_BLOCK))
+    {
+        return 0;
+    }
+
+    // Reserved block starts with the first table written
+    if (W25N04KV_EraseBlock(WEAR_BLOCK) != 0 || W25N04KV_AwaitNotBusy() != 0)
+    {
+        return 1;
+    }
+    nextSnapshot = 0;
+    return W25N04KV_PersistWear();
+}
+
+// Increments a block's count in RAM, called on every erase. Counts are persisted every WEAR_PERSIST_ERASES erases,
+// whichever path erased the block
+void W25N04KV_CountErase(uint16_t blockAddress)
+{
+    static bool persisting = false; // Set while persisting, whose own erase of WEAR_BLOCK is counted without recursing
+
+    if (eraseCounts[blockAddress] < UINT16_MAX)
+    {
+        eraseCounts[blockAddress]++;
+    }
+    unpersistedErases++;
+
+    if (wearMounted && !persisting && unpersistedErases >= WEAR_PERSIST_ERASES)
+    {
+        persisting = true;
+        W25N04KV_PersistWear(); // A failed update only loses the counts since the last one
+        persisting = false;
+    }
+}
+
+// Fetches a block's count
+uint16_t W25N04KV_GetEraseCount(uint16_t blockAddress)
+{
+    return eraseCounts[blockAddress];
+}
+
+// Finds the least and most worn good data blocks, and the total of their counts
+void W25N04KV_GetWearStats(WearStats *stats)
+{
+    *stats = (WearStats){.minErases = UINT16_MAX, .minBlock = BLOCK_COUNT, .maxBlock = BLOCK_COUNT};
+
+    for (uint16_t block = 0; block < DATA_BLOCKS; block++)
+    {
+        if (W25N04KV_IsBadBlock(block))
+        {
+            continue;
+        }
+
+        uint16_t count = eraseCounts[block];
+        if (count < stats->minErases)
+        {
+            stats->minErases = count;
+            stats->minBlock = block;
+        }
+        if (count > stats->maxErases || stats->maxBlock == BLOCK_COUNT)
+        {
+            stats->maxErases = count;
+            stats->maxBlock = block;
+        }
+        stats->totalErases += count;
+        stats->blocks++;
+    }
+}
+
+//! Allocation
+
+// Hands out the least worn free data block, erasing it if it holds stale data
+uint16_t W25N04KV_AllocateBlock(void)
+{
+    for (;;)
+    {
+        uint16_t chosen = BLOCK_COUNT;
+        for (uint16_t block = 0; block < DATA_BLOCKS; block++)
+        {
+            if (FLASH_IsFreeBlock(block) && (chosen == BLOCK_COUNT || eraseCounts[block] < eraseCounts[chosen]))
+            {
+                chosen = block;
+            }
+        }
+        if (chosen == BLOCK_COUNT)
+        {
+            return BLOCK_COUNT; // Every data block is allocated or bad
+        }
+
+        // A block which fails to erase is marked bad, and the next least worn block is tried
+        if (W25N04KV_IsDirtyBlock(chosen) && W25N04KV_EraseBlock(chosen) != 0)
+        {
+            W25N04KV_MarkBadBlock(chosen);
+            continue;
+        }
+
+        allocatedBlocks[chosen / 8] |= 1 << (chosen % 8);
+        return chosen;
+    }
+}
+
+// Marks a block allocated without erasing it, for owners rebuilding their state at boot
+void W25N04KV_ClaimBlock(uint16_t blockAddress)
+{
+    allocatedBlocks[blockAddress / 8] |= 1 << (blockAddress % 8);
+}
+
+// Clears a block's bit in the allocation bitmap, it is erased when next allocated
+void W25N04KV_FreeBlock(uint16_t blockAddress)
+{
+    allocatedBlocks[blockAddress / 8] &= ~(1 << (blockAddress % 8));
+}
+
+// Moves the data of the owner's least worn block onto the most worn free block, once their counts spread too far
+int W25N04KV_LevelStaticWear(const StaticWearOwner *owner, uint16_t *fromBlock, uint16_t *toBlock)
+{
+    *fromBlock = BLOCK_COUNT;
+    *toBlock = BLOCK_COUNT;
+
+    // Only blocks the owner can repoint are moved, any other allocated block stays where its owner expects it
+    uint16_t cold = BLOCK_COUNT;
+    uint16_t worn = BLOCK_COUNT;
+    for (uint16_t block = 0; block < DATA_BLOCKS; block++)
+    {
+        if (W25N04KV_IsBadBlock(block))
+        {
+            continue;
+        }
+        if (W25N04KV_IsAllocatedBlock(block) && owner->ownsBlock(block) &&
+            (cold == BLOCK_COUNT || eraseCounts[block] < eraseCounts[cold]))
+        {
+            cold = block;
+        }
+        if (FLASH_IsFreeBlock(block) && (worn == BLOCK_COUNT || eraseCounts[block] > eraseCounts[worn]))
+        {
+            worn = block;
+        }
+    }
+    if (cold == BLOCK_COUNT || worn == BLOCK_COUNT || eraseCounts[worn] - eraseCounts[cold] < WEAR_STATIC_THRESHOLD)
+    {
+        return 0; // Wear is even enough, nothing is moved
+    }
+
+    // Worn block is held while the data is copied, and handed back if the copy is not used
+    if (W25N04KV_IsDirtyBlock(worn) && W25N04KV_EraseBlock(worn) != 0)
+    {
+        W25N04KV_MarkBadBlock(worn);
+        return 1;
+    }
+    W25N04KV_ClaimBlock(worn);
+
+    // Pages of a block are programmed in order, so the first erased page is found by a binary search
+    int programmedPages = 0;
+    int lastPage = PAGES_PER_BLOCK;
+    while (programmedPages < lastPage)
+    {
+        int page = (programmedPages + lastPage) / 2;
+        if (W25N04KV_IsBlankPage(cold * PAGES_PER_BLOCK + page))
+        {
+            lastPage = page;
+        }
+        else
+        {
+            programmedPages = page + 1;
+        }
+    }
+
+    // Programmed pages are copied inside the flash to the same pages of the worn block, so the block's data never
+    // crosses the bus. The owner then points at the copy, and the cold block is only freed once it has
+    uint8_t relocated;
+    uint64_t pageMask = (programmedPages == PAGES_PER_BLOCK) ? UINT64_MAX : ((uint64_t)1 << programmedPages) - 1;
+    if (W25N04KV_RelocateBlock(cold, pageMask, worn * PAGES_PER_BLOCK, &relocated) != 0 ||
+        owner->blockMoved(cold, worn) != 0)
+    {
+        W25N04KV_FreeBlock(worn);
+        return 1;
+    }
+
+    // Cold block is freed, so its low count is handed out by the next allocation
+    W25N04KV_FreeBlock(cold);
+    *fromBlock = cold;
+    *toBlock = worn;
+
+    return 0;
+}
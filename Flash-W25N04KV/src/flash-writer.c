@@ -0,0 +1,404 @@
+/*
+ * flash-writer.c
+ *
+ * Contains the log writer, which appends packets to a circular log. Packets
+ * are gathered into an image of the next page, which is programmed with a
+ * PageHeader once full. The write head is moved to each page before it is
+ * programmed, so the erase-ahead task keeps the blocks after it erased, and
+ * a block it has not reached yet is erased through the flash manager. The
+ * blocks of the range are claimed from the allocator while the log is
+ * open. The superblock is committed every time a block is filled.
+ * Slotted logs program a page every PACKETS_PER_PAGE packets. Packed logs
+ * fill every byte of the page, carrying the end of a packet which runs
+ * past it on at the start of the next page. Record logs are packed the
+ * same way, with records of any length up to a block.
+ *
+ * The writer's state and page image live in the backup SRAM, which keeps
+ * its contents through watchdog and software resets, along with a CRC. A
+ * warm boot resumes appending where it left off, without searching the
+ * flash or losing the packets of the unfinished page. A cold boot, or a
+ * reset during an update of the state, mounts the log from the superblock.
+ */
+
+#include "W25N04KV.h"
+
+//! Writer State
+
+// Writer state mirrored into the backup SRAM, the CRC covers every field after it and the filled part of the image
+typedef struct
+{
+    uint32_t crc;             // CRC-32 of the state, from magic to the end of the packets in the image
+    uint32_t magic;           // WARM_LOG_MAGIC once the writer has been opened
+    CircularBuffer buf;       // Head and tail of the log
+    uint32_t firstPage;       // First page of the range the log wraps around in
+    uint32_t endPage;         // Page after the last of the range
+    uint32_t nextPage;        // Page the image is programmed to
+    uint32_t nextSequence;    // Sequence number stamped on the image
+    uint8_t streamId;         // Stream stamped on every page
+    uint8_t layout;           // LogLayout of the pages
+    uint16_t fill;            // Bytes of the image filled
+    uint16_t firstPacket;     // Offset of the first packet starting in the image, PACKED_NO_START if none has
+    uint16_t packetEnd;       // Offset of the end of the last packet completed in the image, 0 if none has
+    uint8_t image[PAGE_SIZE]; // Page being filled from its start
+} WarmLog;
+
+static WarmLog *const warmLog = (WarmLog *)BKPSRAM_BASE; // 4KB of SRAM kept through resets
+static uint16_t claimedBlocks[2] = {0, 0};               // First block and block after the last claimed by the log
+
+// Computes the CRC of the state as it stands
+static uint32_t LOG_ComputeCRC(void)
+{
+    const uint8_t *start = (const uint8_t *)&warmLog->magic;
+    const uint8_t *end = &warmLog->image[warmLog->fill];
+    return W25N04KV_CRC32(start, end - start);
+}
+
+// Recomputes the CRC after the state changes. A reset before it is recomputed leaves the state invalid, so the next
+// boot is cold rather than resuming from half updated state
+static void LOG_SealState(void)
+{
+    warmLog->crc = LOG_ComputeCRC();
+}
+
+// Enables writes to the backup SRAM. SystemClock_Config sets the DBP bit before the PWR clock runs, so it is set again
+static void LOG_EnableBackupSRAM(void)
+{
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_BKPSRAM_CLK_ENABLE();
+}
+
+//! Page Programming
+
+// Updates the state once the image has been programmed to its page, and starts an empty image for the next page
+static void LOG_CompleteImage(void)
+{
+    uint32_t pageRange[2] = {warmLog->firstPage, warmLog->endPage};
+    uint32_t page = warmLog->nextPage;
+
+    // Log which was empty starts with this page. Positions match those found by a head/tail search of the page
+    if (warmLog->buf.head == warmLog->buf.tail)
+    {
+        uint16_t first = (warmLog->firstPacket != PACKED_NO_START) ? warmLog->firstPacket : warmLog->fill;
+        warmLog->buf.head = page * PAGE_SIZE + first;
+    }
+    warmLog->buf.tail = page * PAGE_SIZE + ((warmLog->packetEnd > 0) ? warmLog->packetEnd : warmLog->fill);
+    warmLog->nextSequence++;
+    warmLog->nextPage = W25N04KV_WrapLogPage(page + 1, pageRange);
+    warmLog->fill = 0;
+    warmLog->firstPacket = PACKED_NO_START;
+    warmLog->packetEnd = 0;
+    memset(warmLog->image, 0xFF, PAGE_SIZE);
+    LOG_SealState();
+}
+
+// Moves the write head to the image's page, which erases its block through the flash manager if the page starts one
+// the erase-ahead task has not reached. The log's head is moved past the block first if it holds the oldest packets
+static int LOG_AdvanceToPage(void)
+{
+    uint32_t pageRange[2] = {warmLog->firstPage, warmLog->endPage};
+
+    for (;;)
+    {
+        if (warmLog->nextPage >= warmLog->endPage)
+        {
+            return 1; // Range holds no good block
+        }
+        uint16_t block = warmLog->nextPage / PAGES_PER_BLOCK;
+        bool entering = warmLog->nextPage % PAGES_PER_BLOCK == 0;
+
+        // Head is moved before the erase, so a reset during it never leaves the head in an erased block
+        if (entering && warmLog->buf.head != warmLog->buf.tail &&
+            warmLog->buf.head / PAGE_SIZE / PAGES_PER_BLOCK == block)
+        {
+            uint32_t headPage = W25N04KV_WrapLogPage((block + 1) * PAGES_PER_BLOCK, pageRange);
+            if (headPage / PAGES_PER_BLOCK == block)
+            {
+                // Block is the only good one in the range, so the log is emptied
+                warmLog->buf.head = warmLog->nextPage * PAGE_SIZE;
+                warmLog->buf.tail = warmLog->buf.head;
+            }
+            else
+            {
+                warmLog->buf.head = W25N04KV_FindLogStart(headPage, pageRange);
+            }
+            LOG_SealState();
+        }
+
+        // Manager remaps a block which fails to erase to a spare, which the second erase reaches, or marks it bad
+        int error = W25N04KV_AdvanceWriteHead(warmLog->nextPage, pageRange);
+        if (error != 0 && entering && !W25N04KV_IsBadBlock(block))
+        {
+            error = W25N04KV_AdvanceWriteHead(warmLog->nextPage, pageRange);
+        }
+        if (error == 0)
+        {
+            return 0;
+        }
+        if (!W25N04KV_IsBadBlock(block))
+        {
+            return 1; // Bus failed rather than the block
+        }
+
+        // Writer moves on to the next good block
+        warmLog->nextPage = W25N04KV_WrapLogPage(warmLog->nextPage, pageRange);
+        LOG_SealState();
+    }
+}
+
+// Programs the image to its page, along with its header. A page which fails to program is skipped, and the image is
+// programmed to the next page instead, until every page of the range has been tried
+static int LOG_ProgramImage(void)
+{
+    uint32_t pageRange[2] = {warmLog->firstPage, warmLog->endPage};
+
+    for (uint32_t attempt = 0;; attempt++)
+    {
+        if (attempt >= pageRange[1] - pageRange[0] || LOG_AdvanceToPage() != 0)
+        {
+            return 1;
+        }
+
+        PageHeader header = {
+            .sequence = warmLog->nextSequence,
+            .streamId = warmLog->streamId,
+            .layout = warmLog->layout,
+            .firstPacket = warmLog->firstPacket,
+            .packetEnd = warmLog->packetEnd,
+            .dataEnd = warmLog->fill,
+        };
+        int error = (warmLog->layout == LAYOUT_SLOTTED)
+                        ? W25N04KV_WriteLogPage(warmLog->nextPage, warmLog->image, warmLog->nextSequence,
+                                                warmLog->streamId)
+                        : W25N04KV_WritePackedPage(warmLog->nextPage, warmLog->image, &header);
+        if (error == 0)
+        {
+            break;
+        }
+        warmLog->nextSequence++;
+        warmLog->nextPage = W25N04KV_WrapLogPage(warmLog->nextPage + 1, pageRange);
+        LOG_SealState();
+    }
+
+    LOG_CompleteImage();
+
+    // Checkpoint is committed once a block is full, so a cold mount only rolls forward through one block
+    if (warmLog->nextPage % PAGES_PER_BLOCK == 0)
+    {
+        W25N04KV_CommitSuperblock(&warmLog->buf, pageRange, warmLog->nextSequence); // Failure only slows mount
+    }
+
+    return 0;
+}
+
+//! Log Writer
+
+// Hands the blocks claimed by the log back to the allocator, stopping the write head first so none is erased ahead
+static void LOG_ReleaseRange(void)
+{
+    uint32_t pageRange[2] = {claimedBlocks[0] * PAGES_PER_BLOCK, claimedBlocks[1] * PAGES_PER_BLOCK};
+
+    if (claimedBlocks[0] == claimedBlocks[1])
+    {
+        return; // No range claimed
+    }
+
+    W25N04KV_AdvanceWriteHead(UINT32_MAX, pageRange);
+    for (uint16_t block = claimedBlocks[0]; block < claimedBlocks[1]; block++)
+    {
+        W25N04KV_FreeBlock(block);
+    }
+    claimedBlocks[0] = 0;
+    claimedBlocks[1] = 0;
+}
+
+// Claims the blocks of a range from the allocator in place of those claimed by the log opened before. Fails if a block
+// of the range is held by another owner, such as the FTL, whose data the log would erase
+static int LOG_ClaimRange(const uint32_t pageRange[2])
+{
+    uint16_t first = pageRange[0] / PAGES_PER_BLOCK;
+    uint16_t end = (pageRange[1] + PAGES_PER_BLOCK - 1) / PAGES_PER_BLOCK;
+
+    if (pageRange[0] >= pageRange[1] || end > DATA_BLOCKS)
+    {
+        return 1;
+    }
+    for (uint16_t block = first; block < end; block++)
+    {
+        if (W25N04KV_IsAllocatedBlock(block) && (block < claimedBlocks[0] || block >= claimedBlocks[1]))
+        {
+            return 1;
+        }
+    }
+
+    LOG_ReleaseRange();
+    for (uint16_t block = first; block < end; block++)
+    {
+        W25N04KV_ClaimBlock(block);
+    }
+    claimedBlocks[0] = first;
+    claimedBlocks[1] = end;
+    return 0;
+}
+
+// Resumes the writer from the backup SRAM if it holds a valid state for the range, or mounts the log from the flash
+int W25N04KV_OpenLog(uint32_t pageRange[2], uint8_t streamId, LogLayout layout, bool *warm)
+{
+    PageHeader header;
+
+    if (LOG_ClaimRange(pageRange) != 0)
+    {
+        return 1;
+    }
+
+    LOG_EnableBackupSRAM();
+    *warm = warmLog->magic == WARM_LOG_MAGIC && warmLog->fill <= PAGE_SIZE && warmLog->crc == LOG_ComputeCRC() &&
+            warmLog->firstPage == pageRange[0] && warmLog->endPage == pageRange[1] &&
+            warmLog->streamId == streamId && warmLog->layout == layout;
+
+    if (*warm)
+    {
+        // Image may have been programmed just before the reset, before the state was updated
+        if (W25N04KV_ReadPageHeader(warmLog->nextPage, &header) == 0 && header.sequence == warmLog->nextSequence)
+        {
+            LOG_CompleteImage();
+        }
+        return 0;
+    }
+
+    warmLog->magic = 0; // State is invalid until it is complete
+    warmLog->buf = (CircularBuffer){pageRange[0] * PAGE_SIZE, pageRange[0] * PAGE_SIZE};
+    if (W25N04KV_MountLog(&warmLog->buf, pageRange, &warmLog->nextSequence) != 0)
+    {
+        return 1;
+    }
+
+    // Pages are programmed whole, so the writer starts on the page after the one holding the tail
+    warmLog->firstPage = pageRange[0];
+    warmLog->endPage = pageRange[1];
+    warmLog->nextPage = W25N04KV_WrapLogPage((warmLog->buf.tail + PAGE_SIZE - 1) / PAGE_SIZE, pageRange);
+    warmLog->streamId = streamId;
+    warmLog->layout = layout;
+    warmLog->fill = 0;
+    warmLog->firstPacket = PACKED_NO_START;
+    warmLog->packetEnd = 0;
+    memset(warmLog->image, 0xFF, PAGE_SIZE);
+    warmLog->magic = WARM_LOG_MAGIC;
+    LOG_SealState();
+
+    return 0;
+}
+
+// Copies bytes of a packed packet or record into the image, programming each image as it fills, so the bytes run on
+// into as many pages as they need
+static int LOG_AppendBytes(const uint8_t *data, uint32_t size, bool starts, bool ends)
+{
+    // Image left full by a program which failed is programmed again before anything is added to it
+    if (warmLog->fill == PAGE_SIZE && LOG_ProgramImage() != 0)
+    {
+        return 1;
+    }
+
+    if (starts && warmLog->firstPacket == PACKED_NO_START)
+    {
+        warmLog->firstPacket = warmLog->fill;
+    }
+
+    do
+    {
+        uint16_t part = (PAGE_SIZE - warmLog->fill < size) ? PAGE_SIZE - warmLog->fill : size;
+        memcpy(&warmLog->image[warmLog->fill], data, part);
+        warmLog->fill += part;
+        data += part;
+        size -= part;
+        warmLog->packetEnd = (size == 0 && ends) ? warmLog->fill : warmLog->packetEnd;
+        LOG_SealState();
+
+        if (warmLog->fill == PAGE_SIZE && LOG_ProgramImage() != 0)
+        {
+            return 1;
+        }
+    } while (size > 0);
+
+    return 0;
+}
+
+// Copies a packet into the image, programming the image once it is full. Packed packets which run past the end of the
+// image are carried on at the start of the next one
+int W25N04KV_AppendPacket(const Packet *packet)
+{
+    if (warmLog->magic != WARM_LOG_MAGIC || warmLog->layout == LAYOUT_RECORDS || packet->dummy == 0xFF)
+    {
+        return 1; // Writer is not open for packets, or the packet would read as an empty slot
+    }
+
+    if (warmLog->layout == LAYOUT_PACKED)
+    {
+        return LOG_AppendBytes((const uint8_t *)packet, sizeof(Packet), true, true);
+    }
+
+    // Image left full by a program which failed is programmed again first, so the packet is never copied past its end
+    if (warmLog->fill + sizeof(Packet) > PAGE_SIZE && LOG_ProgramImage() != 0)
+    {
+        return 1;
+    }
+
+    memcpy(&warmLog->image[warmLog->fill], packet, sizeof(Packet));
+    warmLog->firstPacket = (warmLog->firstPacket == PACKED_NO_START) ? warmLog->fill : warmLog->firstPacket;
+    warmLog->fill += sizeof(Packet);
+    warmLog->packetEnd = warmLog->fill;
+    LOG_SealState();
+
+    // Slotted image is full once another packet would not fit
+    return (warmLog->fill + sizeof(Packet) > PAGE_SIZE) ? LOG_ProgramImage() : 0;
+}
+
+// Appends a record's header, then its payload, which together may run on through many pages
+int W25N04KV_AppendRecord(uint8_t type, uint8_t flags, const uint8_t *payload, uint32_t length)
+{
+    if (warmLog->magic != WARM_LOG_MAGIC || warmLog->layout != LAYOUT_RECORDS || length > RECORD_MAX_PAYLOAD ||
+        (payload == NULL && length > 0))
+    {
+        return 1;
+    }
+
+    RecordHeader record = {
+        .length = length,
+        .crc = W25N04KV_RecordCRC(type, flags, payload, length),
+        .type = type,
+        .flags = flags,
+        .check = (uint16_t)~length,
+    };
+    if (LOG_AppendBytes((const uint8_t *)&record, sizeof(record), true, length == 0) != 0)
+    {
+        return 1;
+    }
+
+    return (length > 0) ? LOG_AppendBytes(payload, length, false, true) : 0;
+}
+
+// Programs the image even though some of its slots are empty
+int W25N04KV_FlushLog(void)
+{
+    if (warmLog->magic != WARM_LOG_MAGIC)
+    {
+        return 1;
+    }
+
+    return (warmLog->fill > 0) ? LOG_ProgramImage() : 0;
+}
+
+// Fetches the head and tail of the log, and the bytes waiting in the image
+void W25N04KV_GetLogPosition(CircularBuffer *buf, uint16_t *pendingBytes)
+{
+    *buf = warmLog->buf;
+    *pendingBytes = (warmLog->magic == WARM_LOG_MAGIC) ? warmLog->fill : 0;
+}
+
+// Invalidates the state in the backup SRAM, so the next open mounts the log from the flash, and hands its blocks back
+void W25N04KV_DiscardWarmLog(void)
+{
+    LOG_EnableBackupSRAM();
+    warmLog->magic = 0;
+    LOG_ReleaseRange();
+}
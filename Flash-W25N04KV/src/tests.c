@@ -79,8 +79,28 @@ void FLASH_GetHelpCmd(void)
     printf("help\r\n");
     printf("Displays available commands and descriptions.\r\n\n");
 
-    printf("reset-device\r\n");
-    printf("Resets the entire W25N04KV flash memory device.\r\n\n");
+    printf("reset-device [verify]\r\n");
+    printf("[verify]: Subcommand, also erases clean blocks whose first page holds data. Skipped if not provided.\r\n");
+    printf("Resets the entire W25N04KV flash memory device, erasing only blocks written since their last erase.\r\n\n");
+
+    printf("clock-tune [run]\r\n");
+    printf("[run]: Subcommand, recalibrates the QSPI clock. Reports the persisted calibration if not provided.\r\n");
+    printf("Shows the QSPI clock in use and which clock settings read the calibration pattern reliably.\r\n\n");
+
+    printf("bad-blocks\r\n");
+    printf("Lists the blocks marked bad in the bad block table, which are never erased or written.\r\n\n");
+
+    printf("bbm-lut\r\n");
+    printf("Lists the blocks remapped in the on-chip BBM look-up table, and how many entries are free.\r\n\n");
+
+    printf("ecc-stats\r\n");
+    printf("Lists the blocks with the most corrected and uncorrectable page reads since boot, worst first.\r\n\n");
+
+    printf("wear-stats\r\n");
+    printf("Shows the min, max, and mean P/E cycles of the good data blocks.\r\n\n");
+
+    printf("flash-stats\r\n");
+    printf("Shows the queue depth, wait time, and service time of each class of request to the flash manager.\r\n\n");
 
     printf("register-test\r\n");
     printf("Verifies the values and functionality of the flash status registers.\r\n\n");
@@ -91,7 +111,64 @@ void FLASH_GetHelpCmd(void)
     printf("Tests whether the read, write, and erase functionality of a flash is working");
 
     printf("head-tail-test\r\n");
-    printf("Ensures flash is able to correctly detect head and tail of circular data buffer.\r\n\n");
+    printf("Ensures flash is able to correctly detect head and tail of circular data buffer, by linear scan and\r\n"
+           "binary search. Uses blocks 0 and 30 to 32.\r\n\n");
+
+    printf("encode-test\r\n");
+    printf("Checks precompiled command templates against the full encoder, and compares their cycle counts.\r\n\n");
+
+    printf("chain-test\r\n");
+    printf("Tests write and read sequences run as a single chain of instructions from interrupts.\r\n\n");
+
+    printf("map-test\r\n");
+    printf("Tests reading the data buffer directly through a memory-mapped pointer.\r\n\n");
+
+    printf("stream-test\r\n");
+    printf("Tests streaming consecutive pages in a single continuous read.\r\n\n");
+
+    printf("gather-test\r\n");
+    printf("Tests writing a packet which wraps around a ring buffer into the data buffer without copying it.\r\n\n");
+
+    printf("erase-ahead-test\r\n");
+    printf("Checks blocks ahead of the write head are erased in the background. Uses blocks 10 to %d.\r\n\n",
+           10 + ERASE_AHEAD_BLOCKS + 1);
+
+    printf("dirty-test\r\n");
+    printf("Programs and erases block 0, checking the dirty block table before and after a remount.\r\n\n");
+
+    printf("wear-test\r\n");
+    printf("Allocates the 2 least worn blocks, erasing them, and checks erases are counted.\r\n\n");
+
+    printf("ftl-test\r\n");
+    printf("Rewrites, trims, and remounts a logical page of the flash translation layer, then shows its stats.\r\n\n");
+
+    printf("copy-test\r\n");
+    printf("Copies pages inside the flash, one with a patched spare area. Uses blocks 20 and 21.\r\n\n");
+
+    printf("header-test\r\n");
+    printf("Writes a page of packets with a spare area header, then checks the header. Uses block 33.\r\n\n");
+
+    printf("super-test\r\n");
+    printf("Commits a log's position to the superblock, then checks mount rolls forward. Uses blocks 34 and 35.\r\n\n");
+
+    printf("warm-test\r\n");
+    printf("Appends packets, then reopens the log writer from backup SRAM. Uses blocks 36 and 37.\r\n\n");
+
+    printf("packed-test\r\n");
+    printf("Packs packets across page boundaries, then finds the head and tail and reads them back.\r\n"
+           "Uses blocks 38 and 39.\r\n\n");
+
+    printf("record-test\r\n");
+    printf("Appends records of mixed lengths, one spanning pages, then iterates them. Uses blocks 40 and 41.\r\n\n");
+
+    printf("ecc-test\r\n");
+    printf("Flips a bit of a page with ECC disabled, then checks the ECC corrects and counts it.\r\n\n");
+
+    printf("manager-test\r\n");
+    printf("Tests reads, programs, and erases through the flash manager, and that reads overtake queued erases.\r\n\n");
+
+    printf("dma-test\r\n");
+    printf("Tests DMA-driven reads and writes of the data buffer, and the order in which completion is signalled.\r\n\n");
 
     // Print out status details about FreeRTOS
     printf("------FREERTOS DETAILS------\r\n");
@@ -102,18 +179,65 @@ void FLASH_GetHelpCmd(void)
 // Sequentially erases all blocks
 void W25N04KV_ResetDeviceCmd(void)
 {
+    W25N04KV_AcquireBus();
     uint32_t startTime = xTaskGetTickCount();
-    printf("Performing software and data reset...\r\n");
+    uint32_t blankCheck = 0;
+    osMessageQueueGet(cmdParamQueueHandle, &blankCheck, NULL, 0);
+
+    printf("Performing software and data reset of %u dirty blocks...\r\n", W25N04KV_GetDirtyBlockCount());
     W25N04KV_ResetDeviceSoftware();
-    W25N04KV_EraseDevice();
+    W25N04KV_EraseDevice(blankCheck);
     printf("Reset complete, time taken: %ums\r\n", xTaskGetTickCount() - startTime);
 
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Report, and optionally rerun, calibration of the QSPI clock
+void W25N04KV_ClockTuneCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    uint32_t runTuning = 0;
+    osMessageQueueGet(cmdParamQueueHandle, &runTuning, NULL, 0);
+
+    ClockTuning tuning;
+    if (runTuning)
+    {
+        printf("Calibrating QSPI clock...\r\n");
+        if (W25N04KV_TuneClock(&tuning) != 0)
+        {
+            printf("Error: No QSPI clock setting passed calibration, using the default clock\r\n");
+        }
+    }
+    else if (W25N04KV_LoadClockTuning(&tuning) != 0)
+    {
+        printf("No calibration found, run \"clock-tune run\" to calibrate\r\n");
+        W25N04KV_ReleaseBus();
+        osThreadExit(); // Safely exit thread
+    }
+
+    // Table of every setting tried, from slowest to fastest
+    uint32_t hclk = HAL_RCC_GetHCLKFreq();
+    printf("\r\nPrescaler\tClock\t\tNo shift\tHalf-cycle shift\r\n");
+    for (int prescaler = TUNE_SLOWEST_PRESCALER; prescaler >= TUNE_FASTEST_PRESCALER; prescaler--)
+    {
+        printf("%d\t\t%uMHz\t\t%s\t\t%s\r\n", prescaler, hclk / (prescaler + 1) / 1000000,
+               (tuning.passed[prescaler] & 0x01) ? "PASS" : "FAIL",
+               (tuning.passed[prescaler] & 0x02) ? "PASS" : "FAIL");
+    }
+    printf("\r\nIn use: prescaler %u (%uMHz), %s sample shift\r\n", hqspi.Init.ClockPrescaler,
+           hclk / (hqspi.Init.ClockPrescaler + 1) / 1000000,
+           (hqspi.Init.SampleShifting == QSPI_SAMPLE_SHIFTING_HALFCYCLE) ? "half-cycle" : "no");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
     osThreadExit(); // Safely exit thread
 }
 
 // Perform sequence to test registers
 void W25N04KV_TestRegistersCmd(void)
 {
+    W25N04KV_AcquireBus();
     uint32_t startTime = xTaskGetTickCount();
     bool error = false; // Set error flag to default
     printf("\r\nTesting flash's register values and functionality\r\n\n");
@@ -139,17 +263,25 @@ void W25N04KV_TestRegistersCmd(void)
     osDelay(10); // Ensure erase properly terminates
     ASSERT(W25N04KV_ReadRegister(3) == 0, "WEL and BUSY bits not cleared after erase operation");
 
+    // Check if BUSY bit clearing is detected by auto-polling
+    W25N04KV_WriteEnable();
+    W25N04KV_QSPIInstruct(&eraseBlock);
+    ASSERT(W25N04KV_AwaitNotBusyAutoPoll(BUSY_TIMEOUT) == 0, "Auto-polling failed to detect BUSY bit clearing");
+    ASSERT(W25N04KV_IsBusy() == false, "Auto-polling returned before BUSY bit cleared");
+
     if (!error)
         printf("\r\n[PASSED] All registers configured correctly\r\n");
     else
         printf("\r\n[FAILED] Some tests failed\r\n");
     printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
     osThreadExit(); // Safely exit thread
 }
 
 // Performs sequence to test buffer, read, writes, and erase
 void W25N04KV_TestDataCmd(void)
 {
+    W25N04KV_AcquireBus();
     uint32_t startTime = xTaskGetTickCount();
     bool error = false; // Set error flag to default
 
@@ -225,12 +357,14 @@ void W25N04KV_TestDataCmd(void)
     else
         printf("\r\n[FAILED] Some tests failed, ensure tested blocks are empty\r\n");
     printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
     osThreadExit(); // Safely exit thread
 }
 
 // Test if the flash memory is able to find head and tail given data with gaps
 void W25N04KV_TestHeadTailCmd(void)
 {
+    W25N04KV_AcquireBus();
     uint32_t startTime = xTaskGetTickCount();
     // Data read buffer and test Packet
     uint8_t testPacket[338] = {
@@ -262,7 +396,7 @@ void W25N04KV_TestHeadTailCmd(void)
     W25N04KV_WriteBuffer(testPacket, 338, 338);
     W25N04KV_WriteBuffer(testPacket, 338, 338 * 2);
     W25N04KV_WriteExecute(0);
-    W25N04KV_FindHeadTail(&buf, (uint8_t[]){0, 3});
+    W25N04KV_FindHeadTail(&buf, (uint32_t[]){0, 3}, SCAN_LINEAR);
     ASSERT((buf.head == 0 && buf.tail == 1014), "Failed to detect head and tail of contiguous packets in page 0");
 
     // Packets to contiguous locations in page 1, starting at non-zero position
@@ -271,23 +405,1514 @@ void W25N04KV_TestHeadTailCmd(void)
     W25N04KV_WriteBuffer(testPacket, 338, 338 * 2);
     W25N04KV_WriteBuffer(testPacket, 338, 338 * 3);
     W25N04KV_WriteExecute(1);
-    W25N04KV_FindHeadTail(&buf, (uint8_t[]){0, 3});
+    W25N04KV_FindHeadTail(&buf, (uint32_t[]){0, 3}, SCAN_LINEAR);
     ASSERT((buf.head == 2386 && buf.tail == 3400), "Failed to detect head and tail of contiguous packets in page 1");
 
     // Additional packet at end of page 2, non-contiguous buffer
     W25N04KV_WriteBuffer(testPacket, 338, 338 * 4);
     W25N04KV_WriteExecute(2);
-    W25N04KV_FindHeadTail(&buf, (uint8_t[]){0, 3});
+    W25N04KV_FindHeadTail(&buf, (uint32_t[]){0, 3}, SCAN_LINEAR);
     ASSERT((buf.head == 2386 && buf.tail == 5786),
            "Failed to detect head and tail of non-contiguous packets in page 1 & 2");
 
     // Erase block where test was conducted to prep for next test
     W25N04KV_EraseBlock(0);
 
+    // Log of stamped pages which has not wrapped, found by binary search over blocks 30 to 32
+    uint16_t logBlock = 30;
+    for (uint16_t block = logBlock; block < logBlock + 3; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+    for (uint32_t page = 0; page < 3; page++)
+    {
+        W25N04KV_EraseBuffer();
+        W25N04KV_WriteBuffer(testPacket, 338, 0);
+        W25N04KV_StampSequence(page);
+        W25N04KV_WriteExecute(logBlock * PAGES_PER_BLOCK + page);
+        W25N04KV_AwaitNotBusy();
+    }
+    uint32_t logRange[2] = {logBlock * PAGES_PER_BLOCK, (logBlock + 3) * PAGES_PER_BLOCK};
+    W25N04KV_FindHeadTail(&buf, logRange, SCAN_BINARY);
+    ASSERT((buf.head == logBlock * PAGES_PER_BLOCK * 2048 && buf.tail == (logBlock * PAGES_PER_BLOCK + 2) * 2048 + 338),
+           "Failed to binary search head and tail of a log which has not wrapped");
+
+    // Log which has wrapped, newest pages at the start of the range and oldest after the erased block ahead of them
+    W25N04KV_EraseBlock(logBlock);
+    W25N04KV_AwaitNotBusy();
+    for (uint32_t page = 0; page < PAGES_PER_BLOCK; page++)
+    {
+        W25N04KV_EraseBuffer();
+        W25N04KV_WriteBuffer(testPacket, 338, 0);
+        W25N04KV_StampSequence(100 + page);
+        W25N04KV_WriteExecute((logBlock + 2) * PAGES_PER_BLOCK + page);
+        W25N04KV_AwaitNotBusy();
+    }
+    for (uint32_t page = 0; page < 2; page++)
+    {
+        W25N04KV_EraseBuffer();
+        W25N04KV_WriteBuffer(testPacket, 338, 0);
+        W25N04KV_StampSequence(200 + page);
+        W25N04KV_WriteExecute(logBlock * PAGES_PER_BLOCK + page);
+        W25N04KV_AwaitNotBusy();
+    }
+    W25N04KV_FindHeadTail(&buf, logRange, SCAN_BINARY);
+    ASSERT((buf.head == (logBlock + 2) * PAGES_PER_BLOCK * 2048 &&
+            buf.tail == (logBlock * PAGES_PER_BLOCK + 1) * 2048 + 338),
+           "Failed to binary search head and tail of a log which has wrapped");
+    for (uint16_t block = logBlock; block < logBlock + 3; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+
     if (!error)
         printf("\r\n[PASSED] Head and tail tests completed successfully\r\n");
     else
         printf("\r\n[FAILED] Some tests failed, circular buffer not working properly\r\n");
     printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Tracks whether the DMA completion callback ran before the waiting task was woken
+static volatile bool dmaCallbackRan = false;
+
+static void FLASH_DMACallback(int status)
+{
+    dmaCallbackRan = (status == 0);
+}
+
+// Test if data phases moved by DMA reach the data buffer, and signal completion in order
+void W25N04KV_TestDMACmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting DMA-driven transfers to and from the data buffer\r\n\n");
+
+    // Data buffers
+    uint8_t testData[256];
+    uint8_t readResponse[256] = {0};
+    for (int i = 0; i < 256; i++)
+    {
+        testData[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    // Write pattern into the data buffer on 4 lines
+    FlashInstruction quadWriteBuffer = {
+        .opCode = QUAD_WRITE_BUFFER,
+        .address = 0,
+        .addressSize = 2,
+        .dataMode = TRANSMIT,
+        .dataBuf = testData,
+        .dataSize = sizeof(testData),
+        .dataLinesUsed = 4,
+    };
+    dmaCallbackRan = false;
+    W25N04KV_AwaitNotBusy();
+    W25N04KV_WriteEnable();
+    ASSERT(W25N04KV_QSPIInstructAsync(&quadWriteBuffer, FLASH_DMACallback) == 0, "Failed to start DMA transmit");
+    ASSERT(W25N04KV_AwaitAsync(COM_TIMEOUT) == 0, "DMA transmit did not complete");
+    ASSERT(dmaCallbackRan, "Task was woken before transmit callback ran");
+    ASSERT(!W25N04KV_IsAsyncBusy(), "Peripheral still marked busy after transmit completed");
+
+    // Read pattern back on 4 lines
+    FlashInstruction fastQuadReadIO = {
+        .opCode = FAST_QUAD_READ_IO,
+        .address = 0,
+        .addressSize = 2,
+        .addressLinesUsed = 4,
+        .dummyClocks = 4,
+        .dataMode = RECEIVE,
+        .dataBuf = readResponse,
+        .dataSize = sizeof(readResponse),
+        .dataLinesUsed = 4,
+    };
+    dmaCallbackRan = false;
+    ASSERT(W25N04KV_QSPIInstructAsync(&fastQuadReadIO, FLASH_DMACallback) == 0, "Failed to start DMA receive");
+    ASSERT(W25N04KV_AwaitAsync(COM_TIMEOUT) == 0, "DMA receive did not complete");
+    ASSERT(dmaCallbackRan, "Task was woken before receive callback ran");
+    ASSERT(memcmp(readResponse, testData, sizeof(testData)) == 0, "Data read by DMA does not match data written");
+
+    // Instructions without a data phase still signal completion
+    FlashInstruction writeDisable = {.opCode = WRITE_DISABLE};
+    ASSERT(W25N04KV_QSPIInstructAsync(&writeDisable, NULL) == 0, "Failed to issue instruction without data phase");
+    ASSERT(W25N04KV_AwaitAsync(COM_TIMEOUT) == 0, "Instruction without data phase did not signal completion");
+
+    // Clear the data buffer to prep for next test
+    W25N04KV_EraseBuffer();
+
+    if (!error)
+        printf("\r\n[PASSED] DMA tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, DMA transfers not working properly\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if precompiled command templates match the full encoder, and compare their speed
+void W25N04KV_TestEncodeCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting precompiled command templates against the full encoder\r\n\n");
+
+    // Enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55; // Unlock DWT registers
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    // Instructions in the format used by the library, including one without a data phase
+    uint8_t dataBuf[4];
+    FlashInstruction instructions[] = {
+        {.opCode = READ_REGISTER, .address = REGISTER_THREE, .addressSize = 1, .dataMode = RECEIVE,
+         .dataBuf = dataBuf, .dataSize = 1},
+        {.opCode = READ_PAGE, .address = 262143, .addressSize = 3},
+        {.opCode = FAST_DUAL_READ_IO, .address = 2, .addressSize = 2, .addressLinesUsed = 2, .dummyClocks = 4,
+         .dataMode = RECEIVE, .dataBuf = dataBuf, .dataSize = 4, .dataLinesUsed = 2},
+        {.opCode = FAST_QUAD_READ_IO, .address = 2, .addressSize = 2, .addressLinesUsed = 4, .dummyClocks = 4,
+         .dataMode = RECEIVE, .dataBuf = dataBuf, .dataSize = 4, .dataLinesUsed = 4},
+        {.opCode = QUAD_WRITE_BUFFER, .address = 338, .addressSize = 2, .dataMode = TRANSMIT, .dataBuf = dataBuf,
+         .dataSize = 4, .dataLinesUsed = 4},
+        {.opCode = WRITE_BUFFER_WITH_RESET, .address = 0, .addressSize = 2},
+        {.opCode = WRITE_ENABLE},
+    };
+
+    for (int i = 0; i < sizeof(instructions) / sizeof(FlashInstruction); i++)
+    {
+        QSPI_CommandTypeDef encoded, built;
+        uint32_t encodeCycles, buildCycles, cycleStart;
+
+        cycleStart = DWT->CYCCNT;
+        for (int n = 0; n < 1000; n++)
+            W25N04KV_EncodeCommand(&instructions[i], &encoded);
+        encodeCycles = (DWT->CYCCNT - cycleStart) / 1000;
+
+        cycleStart = DWT->CYCCNT;
+        for (int n = 0; n < 1000; n++)
+            W25N04KV_BuildCommand(&instructions[i], &built);
+        buildCycles = (DWT->CYCCNT - cycleStart) / 1000;
+
+        printf("Opcode 0x%02X: %u cycles encoded, %u cycles from template\r\n", instructions[i].opCode, encodeCycles,
+               buildCycles);
+        ASSERT(memcmp(&encoded, &built, sizeof(QSPI_CommandTypeDef)) == 0,
+               "Template command differs from fully encoded command");
+    }
+
+    // Instructions in a different format must still be encoded correctly
+    FlashInstruction singleLineAddress = {.opCode = FAST_QUAD_READ_IO, .address = 2, .addressSize = 2,
+                                          .dummyClocks = 8, .dataMode = RECEIVE, .dataBuf = dataBuf, .dataSize = 4,
+                                          .dataLinesUsed = 4};
+    QSPI_CommandTypeDef encoded, built;
+    W25N04KV_EncodeCommand(&singleLineAddress, &encoded);
+    W25N04KV_BuildCommand(&singleLineAddress, &built);
+    ASSERT(memcmp(&encoded, &built, sizeof(QSPI_CommandTypeDef)) == 0,
+           "Instruction not matching its template was encoded incorrectly");
+
+    if (!error)
+        printf("\r\n[PASSED] Encode tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, command templates do not match encoder\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Counts how many times completion was signalled for a chain
+static volatile uint8_t chainCallbackCount = 0;
+
+static void FLASH_ChainCallback(int status)
+{
+    chainCallbackCount++;
+}
+
+// Test if packets can be written and read back by instruction chains without returning to the task between steps
+void W25N04KV_TestChainCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting write and read sequences run as instruction chains\r\n\n");
+
+    // Data buffers
+    uint8_t testPacket[338];
+    uint8_t readResponse[338] = {0};
+    for (int i = 0; i < 338; i++)
+    {
+        testPacket[i] = (uint8_t)(i * 13 + 1);
+    }
+
+    // Write a packet to the second slot of page 0
+    FlashInstruction writeChain[] = {
+        {.opCode = WRITE_ENABLE},
+        {.opCode = QUAD_WRITE_BUFFER, .address = 338, .addressSize = 2, .dataMode = TRANSMIT, .dataBuf = testPacket,
+         .dataSize = 338, .dataLinesUsed = 4},
+        {.opCode = WRITE_EXECUTE, .address = 0, .addressSize = 3},
+        AWAIT_NOT_BUSY_STEP,
+    };
+    W25N04KV_AwaitNotBusy();
+    W25N04KV_MarkDirtyBlock(0); // Chain programs the page without going through W25N04KV_WriteExecute
+    chainCallbackCount = 0;
+    ASSERT(W25N04KV_QSPIInstructChain(writeChain, 4, FLASH_ChainCallback) == 0, "Failed to start write chain");
+    ASSERT(W25N04KV_AwaitAsync(BUSY_TIMEOUT) == 0, "Write chain did not complete");
+    ASSERT(chainCallbackCount == 1, "Completion of write chain not signalled exactly once");
+    ASSERT(W25N04KV_IsBusy() == false, "Write chain completed before page program finished");
+
+    // Read the packet back from page 0
+    FlashInstruction readChain[] = {
+        {.opCode = READ_PAGE, .address = 0, .addressSize = 3},
+        AWAIT_NOT_BUSY_STEP,
+        {.opCode = FAST_QUAD_READ_IO, .address = 338, .addressSize = 2, .addressLinesUsed = 4, .dummyClocks = 4,
+         .dataMode = RECEIVE, .dataBuf = readResponse, .dataSize = 338, .dataLinesUsed = 4},
+    };
+    chainCallbackCount = 0;
+    ASSERT(W25N04KV_QSPIInstructChain(readChain, 3, FLASH_ChainCallback) == 0, "Failed to start read chain");
+    ASSERT(W25N04KV_AwaitAsync(BUSY_TIMEOUT) == 0, "Read chain did not complete");
+    ASSERT(chainCallbackCount == 1, "Completion of read chain not signalled exactly once");
+    ASSERT(memcmp(readResponse, testPacket, 338) == 0, "Packet read by chain does not match packet written");
+
+    // Only one chain may run at a time
+    ASSERT(W25N04KV_QSPIInstructChain(readChain, 3, NULL) == 0, "Failed to start read chain");
+    ASSERT(W25N04KV_QSPIInstructChain(writeChain, 4, NULL) != 0, "Second chain started while first was running");
+    ASSERT(W25N04KV_AwaitAsync(BUSY_TIMEOUT) == 0, "Read chain did not complete");
+
+    // Erase block where test was conducted to prep for next test
+    W25N04KV_EraseBlock(0);
+
+    if (!error)
+        printf("\r\n[PASSED] Chain tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, instruction chains not working properly\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if the data buffer can be read through the memory-mapped window
+void W25N04KV_TestMapCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting memory-mapped reads of the data buffer\r\n\n");
+
+    // Data buffers
+    uint8_t testData[4] = {0x34, 0x5b, 0x78, 0x68};
+    uint8_t emptyResponse[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t readResponse[4];
+
+    // Write to the data buffer at a non-zero position, then read it through the mapped pointer
+    W25N04KV_QuadWriteBuffer(testData, 4, 338);
+    const volatile uint8_t *buffer = W25N04KV_MapBuffer();
+    ASSERT(buffer != NULL, "Failed to map data buffer");
+    if (buffer != NULL)
+    {
+        ASSERT(buffer[338] == testData[0] && buffer[341] == testData[3],
+               "Bytes read through mapped pointer do not match data buffer");
+        memcpy(readResponse, (const uint8_t *)&buffer[338], 4);
+        ASSERT(memcmp(readResponse, testData, 4) == 0, "Data copied from mapped buffer does not match data buffer");
+        ASSERT(buffer[PAGE_SIZE + SPARE_SIZE - 1] == 0xFF, "Failed to read end of spare area through mapped pointer");
+    }
+
+    // Other instructions unmap the buffer, and mapping again shows the newly loaded page
+    W25N04KV_ReadPage(2);
+    buffer = W25N04KV_MapBuffer();
+    ASSERT(buffer != NULL, "Failed to map data buffer after reading a page");
+    if (buffer != NULL)
+    {
+        memcpy(readResponse, (const uint8_t *)&buffer[338], 4);
+        ASSERT(memcmp(readResponse, emptyResponse, 4) == 0, "Mapped buffer not refreshed after reading an empty page");
+    }
+    ASSERT(W25N04KV_UnmapBuffer() == 0, "Failed to unmap data buffer");
+
+    if (!error)
+        printf("\r\n[PASSED] Memory-mapped tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure page 2 is empty\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Expected contents of each streamed page, and how far the sink has checked
+typedef struct
+{
+    uint32_t offset;
+    uint32_t mismatches;
+} StreamCheck;
+
+// Byte written at a given offset into the streamed pages
+static uint8_t FLASH_StreamPattern(uint32_t offset)
+{
+    return (uint8_t)((offset / PAGE_SIZE) * 31 + offset);
+}
+
+// Compares each streamed chunk against the pattern written to the pages
+static void FLASH_StreamSink(const uint8_t *data, uint16_t size, void *context)
+{
+    StreamCheck *check = (StreamCheck *)context;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        if (data[i] != FLASH_StreamPattern(check->offset + i))
+            check->mismatches++;
+    }
+    check->offset += size;
+}
+
+// Test if consecutive pages can be streamed in continuous read mode
+void W25N04KV_TestStreamCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting continuous reads across page boundaries\r\n\n");
+
+    // Data buffers, chunk size does not divide the page size so chunks span page boundaries
+    static uint8_t pageData[PAGE_SIZE];
+    static uint8_t chunkBuf[600];
+
+    // Write a different pattern to each of the first 3 pages
+    for (uint32_t page = 0; page < 3; page++)
+    {
+        for (uint32_t i = 0; i < PAGE_SIZE; i++)
+            pageData[i] = FLASH_StreamPattern(page * PAGE_SIZE + i);
+        W25N04KV_WriteEnable();
+        W25N04KV_QuadWriteBuffer(pageData, PAGE_SIZE, 0);
+        W25N04KV_WriteExecute(page);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    // Stream all 3 pages in one read
+    StreamCheck check = {0};
+    ASSERT(W25N04KV_StreamPages(0, 3, chunkBuf, sizeof(chunkBuf), FLASH_StreamSink, &check) == 0,
+           "Failed to stream pages");
+    ASSERT(check.offset == 3 * PAGE_SIZE, "Streamed length does not match pages requested");
+    ASSERT(check.mismatches == 0, "Streamed data does not match pages written");
+
+    // Buffer read mode is restored afterwards
+    ASSERT((W25N04KV_ReadRegister(2) & BUF_BIT) != 0, "Buffer read mode not restored after streaming");
+    uint8_t readResponse[4];
+    W25N04KV_ReadPage(1);
+    W25N04KV_FastQuadReadBuffer(0, 4, readResponse);
+    ASSERT(readResponse[0] == FLASH_StreamPattern(PAGE_SIZE) && readResponse[3] == FLASH_StreamPattern(PAGE_SIZE + 3),
+           "Buffer reads not working after streaming");
+
+    // Erase block where test was conducted to prep for next test
+    W25N04KV_EraseBlock(0);
+
+    if (!error)
+        printf("\r\n[PASSED] Stream tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure block 0 is empty\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+static volatile uint8_t managerRequestsDone = 0;
+static volatile int managerReadStatus = 1;
+static uint8_t managerReadResponse[4];
+
+// Queues an erase of the given block through the manager, counting it once served
+static void FLASH_ManagerEraseTask(void *argument)
+{
+    W25N04KV_RequestErase((uint16_t)(uintptr_t)argument);
+    managerRequestsDone++;
+    osThreadExit(); // Safely exit thread
+}
+
+// Queues a read of the page programmed by the manager test, counting it once served
+static void FLASH_ManagerReadTask(void *argument)
+{
+    managerReadStatus = W25N04KV_RequestRead(64, 338, managerReadResponse, 4);
+    managerRequestsDone++;
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if requests through the flash manager are served correctly and in priority order
+void W25N04KV_TestManagerCmd(void)
+{
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting requests served by the flash manager task\r\n\n");
+
+    // Data buffers
+    uint8_t testData[4] = {0x6d, 0x61, 0x6e, 0x61};
+    uint8_t emptyResponse[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t readResponse[4];
+    FlashRequestStats readStatsBefore, readStatsAfter, eraseStats;
+    W25N04KV_GetRequestStats(FLASH_REQUEST_READ, &readStatsBefore);
+
+    // Program and read back page 64 (block 1)
+    ASSERT(W25N04KV_RequestErase(1) == 0, "Failed to erase block through manager");
+    ASSERT(W25N04KV_RequestProgram(64, 338, testData, 4) == 0, "Failed to program page through manager");
+    ASSERT(W25N04KV_RequestRead(64, 338, readResponse, 4) == 0, "Failed to read page through manager");
+    ASSERT(memcmp(readResponse, testData, 4) == 0, "Data read through manager does not match data programmed");
+
+    // Bus is held while erases of blocks 1 to 3 are queued from other tasks, then a read, so the manager can take at
+    // most the first erase before the read is queued. The read is then served ahead of the other two
+    managerRequestsDone = 0;
+    const osThreadAttr_t requestTaskAttr = {.priority = osPriorityHigh, .stack_size = 256 * 4};
+    W25N04KV_AcquireBus();
+    for (uint32_t block = 1; block <= 3; block++)
+    {
+        osThreadNew(FLASH_ManagerEraseTask, (void *)(uintptr_t)block, &requestTaskAttr);
+    }
+    do
+    {
+        osDelay(1);
+        W25N04KV_GetRequestStats(FLASH_REQUEST_ERASE, &eraseStats);
+    } while (eraseStats.depth < 2);
+    osThreadNew(FLASH_ManagerReadTask, NULL, &requestTaskAttr);
+    do
+    {
+        osDelay(1);
+        W25N04KV_GetRequestStats(FLASH_REQUEST_READ, &readStatsAfter);
+    } while (readStatsAfter.depth < 1);
+    W25N04KV_ReleaseBus();
+    while (managerRequestsDone < 4)
+    {
+        osDelay(1);
+    }
+    W25N04KV_GetRequestStats(FLASH_REQUEST_READ, &readStatsAfter);
+    W25N04KV_GetRequestStats(FLASH_REQUEST_ERASE, &eraseStats);
+    ASSERT(managerReadStatus == 0, "Failed to read page while erases were queued");
+    ASSERT(eraseStats.lastServed >= readStatsAfter.lastServed + 2, "Read was not served ahead of queued erases");
+    ASSERT(W25N04KV_RequestRead(64, 338, readResponse, 4) == 0, "Failed to read page after erases");
+    ASSERT(memcmp(readResponse, emptyResponse, 4) == 0, "Block was not erased through manager");
+
+    // Every request is counted
+    W25N04KV_GetRequestStats(FLASH_REQUEST_READ, &readStatsAfter);
+    ASSERT(readStatsAfter.served == readStatsBefore.served + 3, "Reads served not counted");
+    ASSERT(readStatsAfter.depth == 0, "Read queue not empty after all reads were served");
+
+    if (!error)
+        printf("\r\n[PASSED] Manager tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure the flash manager task is running\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if programmed blocks are recorded dirty without disturbing the page programmed, and erased blocks clean
+void W25N04KV_TestDirtyCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting dirty block tracking\r\n\n");
+
+    // Data buffers
+    static uint8_t writeData[PAGE_SIZE];
+    static uint8_t readData[PAGE_SIZE];
+    uint8_t garbage[4] = {0x00, 0x12, 0x34, 0x56};
+    PageHeader header;
+    memset(writeData, 0x5A, PAGE_SIZE);
+
+    // Erased block is clean, also once the table is reloaded from the flash
+    ASSERT(W25N04KV_EraseBlock(0) == 0, "Failed to erase block 0");
+    ASSERT(!W25N04KV_IsDirtyBlock(0), "Erased block recorded dirty");
+    W25N04KV_PersistDirtyBlocks();
+    W25N04KV_MountDirtyBlocks();
+    ASSERT(!W25N04KV_IsDirtyBlock(0), "Erased block recorded dirty after remount");
+
+    // Driver programs persist the block as dirty before loading the page, so the page is programmed as given
+    ASSERT(W25N04KV_WriteLogPage(0, writeData, 0, 0) == 0, "Failed to write log page");
+    ASSERT(W25N04KV_IsDirtyBlock(0), "Programmed block not recorded dirty");
+    ASSERT(W25N04KV_ReadLogPage(0, readData, &header) == 0, "Page header CRC does not match programmed data");
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Programmed page does not match data given");
+    W25N04KV_MountDirtyBlocks();
+    ASSERT(W25N04KV_IsDirtyBlock(0), "Programmed block recorded clean after remount");
+
+    // Direct programs are recorded in RAM, then persisted with the next update
+    ASSERT(W25N04KV_EraseBlock(0) == 0, "Failed to erase block 0");
+    W25N04KV_EraseBuffer();
+    W25N04KV_QuadWriteBuffer(writeData, PAGE_SIZE, 0);
+    W25N04KV_WriteExecute(1);
+    W25N04KV_AwaitNotBusy();
+    ASSERT(W25N04KV_IsDirtyBlock(0), "Directly programmed block not recorded dirty");
+    W25N04KV_ReadPage(1);
+    W25N04KV_FastQuadReadIO(0, PAGE_SIZE, readData);
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Directly programmed page does not match data given");
+    W25N04KV_PersistDirtyBlocks();
+    W25N04KV_MountDirtyBlocks();
+    ASSERT(W25N04KV_IsDirtyBlock(0), "Directly programmed block recorded clean after remount");
+
+    // Update cut off by a power loss leaves a page which is neither blank nor a table, the next update goes after it
+    int cutPage = 0;
+    while (cutPage < PAGES_PER_BLOCK && !W25N04KV_IsBlankPage(DIRTY_BLOCK * PAGES_PER_BLOCK + cutPage))
+    {
+        cutPage++;
+    }
+    if (cutPage + 1 < PAGES_PER_BLOCK)
+    {
+        W25N04KV_EraseBuffer();
+        W25N04KV_QuadWriteBuffer(garbage, sizeof(garbage), 0);
+        W25N04KV_WriteExecute(DIRTY_BLOCK * PAGES_PER_BLOCK + cutPage);
+        W25N04KV_AwaitNotBusy();
+        W25N04KV_MountDirtyBlocks();
+        ASSERT(W25N04KV_EraseBlock(0) == 0, "Failed to erase block 0");
+        ASSERT(W25N04KV_PersistDirtyBlocks() == 0, "Failed to persist table after cut off page");
+        W25N04KV_MountDirtyBlocks();
+        ASSERT(!W25N04KV_IsDirtyBlock(0), "Update after cut off page not loaded");
+        W25N04KV_ReadPage(DIRTY_BLOCK * PAGES_PER_BLOCK + cutPage);
+        W25N04KV_FastQuadReadIO(0, sizeof(garbage), readData);
+        ASSERT(memcmp(readData, garbage, sizeof(garbage)) == 0, "Cut off page programmed again");
+    }
+
+    // Erase block where test was conducted to prep for next test
+    W25N04KV_EraseBlock(0);
+
+    if (!error)
+        printf("\r\n[PASSED] Dirty block tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure block 0 is empty\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if blocks ahead of a log writer holding the bus are erased in the background, and the head block is left alone
+void W25N04KV_TestEraseAheadCmd(void)
+{
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting background erase-ahead of the write head\r\n\n");
+
+    // Data buffers
+    static union PageStructure pageBuf;
+    uint8_t testData[4] = {0x61, 0x68, 0x65, 0x64};
+    Packet packet;
+    PageHeader header;
+    uint16_t headBlock = 10;
+    uint16_t lastBlock = headBlock + ERASE_AHEAD_BLOCKS + 1; // First block past those kept erased
+    uint32_t pageRange[2] = {headBlock * PAGES_PER_BLOCK, (lastBlock + 1) * PAGES_PER_BLOCK};
+    CircularBuffer empty = {pageRange[0] * PAGE_SIZE, pageRange[0] * PAGE_SIZE};
+    bool appended = true;
+    bool warm;
+
+    // Dirty every block after the head up to the first block past those kept erased
+    W25N04KV_RequestErase(headBlock);
+    for (uint16_t block = headBlock + 1; block <= lastBlock; block++)
+    {
+        W25N04KV_RequestErase(block);
+        W25N04KV_RequestProgram(block * PAGES_PER_BLOCK, 0, testData, 4);
+    }
+    ASSERT(W25N04KV_IsDirtyBlock(headBlock + 1), "Programmed block not marked dirty");
+
+    // Writer moves the head with the bus held, while the task wakes for the move and waits for the bus. The head is
+    // never locked while the bus is awaited, so the writer is not held up by the pass
+    W25N04KV_AcquireBus();
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_SLOTTED, &warm) == 0, "Failed to open log writer");
+    for (uint8_t i = 0; i < PACKETS_PER_PAGE; i++)
+    {
+        memset(&packet, i, sizeof(packet));
+        appended = appended && W25N04KV_AppendPacket(&packet) == 0;
+    }
+    osDelay(ERASE_AHEAD_INTERVAL);
+    for (uint8_t i = 0; i < PACKETS_PER_PAGE; i++)
+    {
+        memset(&packet, PACKETS_PER_PAGE + i, sizeof(packet));
+        appended = appended && W25N04KV_AppendPacket(&packet) == 0;
+    }
+    ASSERT(appended, "Writer failed to append during an erase pass");
+    ASSERT(W25N04KV_IsDirtyBlock(headBlock + 1), "Block erased while the writer held the bus");
+    W25N04KV_ReleaseBus();
+
+    // Blocks ahead of the head are erased once the writer lets go of the bus
+    uint32_t waitStart = xTaskGetTickCount();
+    while (W25N04KV_IsDirtyBlock(headBlock + ERASE_AHEAD_BLOCKS) && xTaskGetTickCount() - waitStart < 1000)
+    {
+        osDelay(1);
+    }
+    for (uint16_t block = headBlock + 1; block < lastBlock; block++)
+    {
+        ASSERT(!W25N04KV_IsDirtyBlock(block), "Block ahead of write head not erased");
+    }
+    ASSERT(W25N04KV_IsDirtyBlock(lastBlock), "Block past those kept erased was erased");
+    W25N04KV_AcquireBus();
+    ASSERT(W25N04KV_ReadLogPage(pageRange[0], pageBuf.bytes, &header) == 0 && pageBuf.page.packetArray[0].dummy == 0,
+           "Block under write head was erased");
+
+    // Writer fills the head block and enters the next, which needs no erase, and the window moves with the head
+    for (uint32_t i = 0; i < (PAGES_PER_BLOCK - 1) * PACKETS_PER_PAGE; i++)
+    {
+        memset(&packet, (uint8_t)i, sizeof(packet));
+        appended = appended && W25N04KV_AppendPacket(&packet) == 0;
+    }
+    ASSERT(appended, "Writer failed to fill the head block");
+    W25N04KV_ReleaseBus();
+    waitStart = xTaskGetTickCount();
+    while (W25N04KV_IsDirtyBlock(lastBlock) && xTaskGetTickCount() - waitStart < 1000)
+    {
+        osDelay(1);
+    }
+    ASSERT(!W25N04KV_IsDirtyBlock(lastBlock), "Window of erased blocks did not move with write head");
+    W25N04KV_AcquireBus();
+    ASSERT(W25N04KV_ReadLogPage((headBlock + 1) * PAGES_PER_BLOCK, pageBuf.bytes, &header) == 0,
+           "Block under write head was erased after moving");
+
+    // Close the log and checkpoint it empty, so the next run starts at the head block again, then erase blocks where
+    // test was conducted to prep for next test
+    W25N04KV_DiscardWarmLog();
+    W25N04KV_CommitSuperblock(&empty, pageRange, 0);
+    W25N04KV_ReleaseBus();
+    W25N04KV_RequestErase(headBlock);
+    W25N04KV_RequestErase(headBlock + 1);
+
+    if (!error)
+        printf("\r\n[PASSED] Erase-ahead tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure the erase-ahead and flash manager tasks are running and blocks "
+               "10 to 15 are not allocated\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if the allocator hands out the least worn blocks and counts every erase
+void W25N04KV_TestWearCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting the wear-leveling block allocator\r\n\n");
+
+    // Data buffers
+    uint8_t testData[4] = {0x77, 0x65, 0x61, 0x72};
+    WearStats stats;
+
+    // Least worn block is handed out, erased if it held data
+    W25N04KV_GetWearStats(&stats);
+    uint16_t first = W25N04KV_AllocateBlock();
+    ASSERT(first < DATA_BLOCKS, "Failed to allocate a block");
+    ASSERT(W25N04KV_IsAllocatedBlock(first), "Allocated block not marked allocated");
+    ASSERT(W25N04KV_GetEraseCount(first) <= stats.minErases + 1, "Allocated block is not the least worn");
+    ASSERT(!W25N04KV_IsDirtyBlock(first), "Allocated block not erased");
+
+    // Allocated blocks are not handed out twice
+    uint16_t second = W25N04KV_AllocateBlock();
+    ASSERT(second < DATA_BLOCKS && second != first, "Allocated block handed out again");
+
+    // Every erase of a block is counted
+    uint16_t erasesBefore = W25N04KV_GetEraseCount(first);
+    W25N04KV_QuadWriteBuffer(testData, 4, 0);
+    W25N04KV_WriteExecute(first * PAGES_PER_BLOCK);
+    W25N04KV_EraseBlock(first);
+    W25N04KV_AwaitNotBusy();
+    ASSERT(W25N04KV_GetEraseCount(first) == erasesBefore + 1, "Erase not counted");
+
+    // Freed blocks can be allocated again
+    W25N04KV_FreeBlock(first);
+    W25N04KV_FreeBlock(second);
+    ASSERT(!W25N04KV_IsAllocatedBlock(first) && !W25N04KV_IsAllocatedBlock(second), "Freed blocks still allocated");
+    ASSERT(W25N04KV_PersistWear() == 0, "Failed to persist erase counts");
+
+    if (!error)
+        printf("\r\n[PASSED] Wear-leveling tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure the erase count table is mounted\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if pages can be copied inside the flash without their data crossing the bus
+void W25N04KV_TestCopyCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting on-chip page copies\r\n\n");
+
+    // Data buffers
+    static uint8_t writeData[PAGE_SIZE];
+    static uint8_t readData[PAGE_SIZE];
+    uint8_t patch[4] = {0x63, 0x6F, 0x70, 0x79};
+    uint8_t readPatch[4];
+    uint16_t sourceBlock = 20;
+    uint16_t destinationBlock = 21;
+    uint8_t relocated;
+
+    // Source block holds 2 pages with different data
+    W25N04KV_EraseBlock(sourceBlock);
+    W25N04KV_EraseBlock(destinationBlock);
+    W25N04KV_AwaitNotBusy();
+    for (int page = 0; page < 2; page++)
+    {
+        memset(writeData, 0x10 + page, PAGE_SIZE);
+        W25N04KV_QuadWriteBuffer(writeData, PAGE_SIZE, 0);
+        W25N04KV_WriteExecute(sourceBlock * PAGES_PER_BLOCK + page);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    // Copy keeps the page's data, with the patch written over its spare area
+    ASSERT(W25N04KV_CopyPage(sourceBlock * PAGES_PER_BLOCK, destinationBlock * PAGES_PER_BLOCK, patch, 4,
+                             PAGE_SIZE + 8) == 0,
+           "Failed to copy page");
+    W25N04KV_ReadPage(destinationBlock * PAGES_PER_BLOCK);
+    W25N04KV_FastQuadReadIO(0, PAGE_SIZE, readData);
+    W25N04KV_FastQuadReadIO(PAGE_SIZE + 8, 4, readPatch);
+    memset(writeData, 0x10, PAGE_SIZE);
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Copied data does not match source page");
+    ASSERT(memcmp(readPatch, patch, 4) == 0, "Spare area patch not written");
+
+    // Only the pages selected are relocated, to consecutive pages
+    ASSERT(W25N04KV_RelocateBlock(sourceBlock, 0x2, destinationBlock * PAGES_PER_BLOCK + 1, &relocated) == 0,
+           "Failed to relocate block");
+    ASSERT(relocated == 1, "Wrong number of pages relocated");
+    W25N04KV_ReadPage(destinationBlock * PAGES_PER_BLOCK + 1);
+    W25N04KV_FastQuadReadIO(0, PAGE_SIZE, readData);
+    memset(writeData, 0x11, PAGE_SIZE);
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Relocated data does not match source page");
+
+    if (!error)
+        printf("\r\n[PASSED] Page copy tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure blocks 20 and 21 are good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if the header in the spare area of a page describes its packets, and catches corrupt data
+void W25N04KV_TestPageHeaderCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting spare area page headers\r\n\n");
+
+    // Data buffers
+    static union PageStructure pageBuf;
+    static uint8_t readData[PAGE_SIZE];
+    PageHeader header;
+    uint16_t headerBlock = 33;
+    uint32_t page = headerBlock * PAGES_PER_BLOCK;
+    CircularBuffer buf = {0, 0};
+
+    // Page with packets in slots 0 and 2 only
+    memset(pageBuf.bytes, 0xFF, PAGE_SIZE);
+    memset(&pageBuf.page.packetArray[0], 0x11, sizeof(Packet));
+    memset(&pageBuf.page.packetArray[2], 0x22, sizeof(Packet));
+    W25N04KV_EraseBlock(headerBlock);
+    W25N04KV_AwaitNotBusy();
+    ASSERT(W25N04KV_WriteLogPage(page, pageBuf.bytes, 42, 7) == 0, "Failed to write page with header");
+
+    // Header is read on its own, and describes the page
+    ASSERT(W25N04KV_ReadPageHeader(page, &header) == 0, "Failed to read page header");
+    ASSERT(header.version == PAGE_HEADER_VERSION, "Page header not found");
+    ASSERT(header.sequence == 42 && header.streamId == 7, "Wrong sequence number or stream in header");
+    ASSERT(header.validPackets == 0x05, "Packet bitmap does not match packets written");
+    ASSERT(header.crc == W25N04KV_CRC32(pageBuf.bytes, PAGE_SIZE), "CRC in header does not match data");
+
+    // Data is checked against the CRC when read back
+    ASSERT(W25N04KV_ReadLogPage(page, readData, &header) == 0, "Failed to read page with header");
+    ASSERT(memcmp(readData, pageBuf.bytes, PAGE_SIZE) == 0, "Read data does not match page written");
+
+    // Packets are found from the header alone
+    W25N04KV_FindHeadTail(&buf, (uint32_t[]){page, page + 1}, SCAN_LINEAR);
+    ASSERT(buf.head == page * 2048 && buf.tail == page * 2048 + 3 * sizeof(Packet), "Packets not found from header");
+
+    // Pages without a header are not passed as valid
+    ASSERT(W25N04KV_ReadLogPage(page + 1, readData, &header) != 0, "Erased page passed as valid");
+    W25N04KV_EraseBlock(headerBlock);
+    W25N04KV_AwaitNotBusy();
+
+    if (!error)
+        printf("\r\n[PASSED] Page header tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure block 33 is good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if a log's position is committed to the superblock, and mount rolls forward through pages written since
+void W25N04KV_TestSuperblockCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting the superblock\r\n\n");
+
+    // Data buffers
+    static uint8_t pageData[PAGE_SIZE];
+    Superblock super;
+    uint16_t logBlock = 34;
+    uint32_t page = logBlock * PAGES_PER_BLOCK;
+    uint32_t pageRange[2] = {page, page + 2 * PAGES_PER_BLOCK};
+    CircularBuffer buf = {page * PAGE_SIZE, (page + 2) * PAGE_SIZE};
+    uint32_t nextSequence;
+
+    // Log of 2 full pages is committed
+    memset(pageData, 0x11, PAGE_SIZE);
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+    ASSERT(W25N04KV_WriteLogPage(page, pageData, 0, 0) == 0, "Failed to write first log page");
+    ASSERT(W25N04KV_WriteLogPage(page + 1, pageData, 1, 0) == 0, "Failed to write second log page");
+    ASSERT(W25N04KV_CommitSuperblock(&buf, pageRange, 2) == 0, "Failed to commit superblock");
+    ASSERT(W25N04KV_LoadSuperblock(&super) == 0, "Committed superblock not found");
+    ASSERT(super.log.head == buf.head && super.log.tail == buf.tail, "Wrong log position in superblock");
+    ASSERT(super.nextSequence == 2 && super.badBlocks == W25N04KV_GetBadBlockCount(), "Wrong summary in superblock");
+
+    // Newer commits replace the older one
+    uint32_t commits = super.commits;
+    ASSERT(W25N04KV_CommitSuperblock(&buf, pageRange, 2) == 0, "Failed to commit superblock again");
+    ASSERT(W25N04KV_LoadSuperblock(&super) == 0 && super.commits == commits + 1, "Newest commit not loaded");
+
+    // Page written after the commit is found by rolling forward
+    ASSERT(W25N04KV_WriteLogPage(page + 2, pageData, 2, 0) == 0, "Failed to write third log page");
+    buf = (CircularBuffer){0, 0};
+    ASSERT(W25N04KV_MountLog(&buf, pageRange, &nextSequence) == 0, "Failed to mount log");
+    ASSERT(buf.head == page * PAGE_SIZE && buf.tail == (page + 3) * PAGE_SIZE, "Log not rolled forward");
+    ASSERT(nextSequence == 3, "Wrong sequence number after mount");
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    if (!error)
+        printf("\r\n[PASSED] Superblock tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure blocks 34 and 35 are good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if the log writer resumes from the backup SRAM with the packets of its unfinished page
+void W25N04KV_TestWarmLogCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting the log writer state in backup SRAM\r\n\n");
+
+    // Data buffers
+    static union PageStructure pageBuf;
+    Packet packet;
+    PageHeader header;
+    uint16_t logBlock = 36;
+    uint32_t page = logBlock * PAGES_PER_BLOCK;
+    uint32_t pageRange[2] = {page, page + 2 * PAGES_PER_BLOCK};
+    CircularBuffer buf;
+    uint16_t pending;
+    bool warm;
+
+    // Writer on an erased range starts cold, with an empty log
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_SLOTTED, &warm) == 0 && !warm, "Failed to open log writer cold");
+
+    // First page is programmed once full, the rest of the packets wait in the backup SRAM
+    for (uint8_t i = 0; i < PACKETS_PER_PAGE + 2; i++)
+    {
+        memset(&packet, i, sizeof(packet));
+        ASSERT(W25N04KV_AppendPacket(&packet) == 0, "Failed to append packet");
+    }
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(buf.head == page * PAGE_SIZE && buf.tail == page * PAGE_SIZE + PACKETS_PER_PAGE * sizeof(Packet),
+           "Wrong log position after first page");
+    ASSERT(pending == 2 * sizeof(Packet), "Unfinished page does not hold the last packets");
+
+    // Reopening finds the state left in the backup SRAM, as a warm boot would
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_SLOTTED, &warm) == 0 && warm, "Log writer did not resume warm");
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(pending == 2 * sizeof(Packet), "Packets of unfinished page lost by reopening");
+
+    // Unfinished page carries on from the packets appended before the reopen
+    for (uint8_t i = PACKETS_PER_PAGE + 2; i < 2 * PACKETS_PER_PAGE; i++)
+    {
+        memset(&packet, i, sizeof(packet));
+        ASSERT(W25N04KV_AppendPacket(&packet) == 0, "Failed to append packet after reopening");
+    }
+    ASSERT(W25N04KV_ReadLogPage(page + 1, pageBuf.bytes, &header) == 0, "Failed to read second page");
+    for (uint8_t i = 0; i < PACKETS_PER_PAGE; i++)
+    {
+        ASSERT(pageBuf.page.packetArray[i].dummy == PACKETS_PER_PAGE + i, "Packet out of order in second page");
+    }
+    ASSERT(header.sequence == 1, "Wrong sequence number on second page");
+
+    // Writer resumes cold once the state is discarded, from the log on the flash
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_SLOTTED, &warm) == 0 && !warm, "Discarded state was resumed");
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(buf.tail == (page + 1) * PAGE_SIZE + PACKETS_PER_PAGE * sizeof(Packet) && pending == 0,
+           "Cold open did not find the log's tail");
+
+    // Range holding a block allocated to another owner is refused
+    if (!W25N04KV_IsAllocatedBlock(logBlock + 2))
+    {
+        uint32_t overlapRange[2] = {page, page + 3 * PAGES_PER_BLOCK};
+        W25N04KV_ClaimBlock(logBlock + 2);
+        ASSERT(W25N04KV_OpenLog(overlapRange, 0, LAYOUT_SLOTTED, &warm) != 0, "Log opened over an allocated block");
+        W25N04KV_FreeBlock(logBlock + 2);
+    }
+
+    // Full image whose program fails is kept rather than overrun, and programmed once the flash accepts it. The log is
+    // a single page away from a block start, so nothing is erased while every block is protected
+    uint32_t lockedRange[2] = {page + 2, page + 3};
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(lockedRange, 0, LAYOUT_SLOTTED, &warm) == 0, "Failed to open single page log");
+    W25N04KV_WriteRegister(1, 0x78); // BP3 to BP0 set
+    for (uint8_t i = 0; i < PACKETS_PER_PAGE - 1; i++)
+    {
+        memset(&packet, i, sizeof(packet));
+        ASSERT(W25N04KV_AppendPacket(&packet) == 0, "Failed to append packet to single page log");
+    }
+    ASSERT(W25N04KV_AppendPacket(&packet) != 0, "Program of a protected page did not fail");
+    ASSERT(W25N04KV_AppendPacket(&packet) != 0, "Append to an image left full did not fail");
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(pending == PACKETS_PER_PAGE * sizeof(Packet), "Image left full was overrun");
+    W25N04KV_WriteRegister(1, 0x00); // Protection cleared
+    ASSERT(W25N04KV_AppendPacket(&packet) == 0, "Image left full not programmed once unprotected");
+    ASSERT(W25N04KV_ReadLogPage(page + 2, pageBuf.bytes, &header) == 0, "Image left full lost");
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(pending == sizeof(Packet), "Packet after the image left full lost");
+    W25N04KV_DiscardWarmLog();
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    if (!error)
+        printf("\r\n[PASSED] Warm log tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure blocks 36 and 37 are good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if packets packed across page boundaries are found by the head/tail search and read back whole
+void W25N04KV_TestPackedLogCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting packets packed across pages\r\n\n");
+
+    // Data buffers
+    Packet packet;
+    PageHeader header;
+    uint16_t logBlock = 38;
+    uint32_t page = logBlock * PAGES_PER_BLOCK;
+    uint32_t pageRange[2] = {page, page + 2 * PAGES_PER_BLOCK};
+    uint8_t packetCount = 13; // Fills 2 pages, with 2 packets straddling a boundary
+    CircularBuffer buf;
+    uint16_t pending;
+    bool warm;
+
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_PACKED, &warm) == 0, "Failed to open packed log writer");
+
+    // Every byte of a page is used, so the start of the next packet is carried over
+    for (uint8_t i = 0; i < packetCount; i++)
+    {
+        memset(&packet, i, sizeof(packet));
+        ASSERT(W25N04KV_AppendPacket(&packet) == 0, "Failed to append packet");
+    }
+    W25N04KV_GetLogPosition(&buf, &pending);
+    ASSERT(pending == packetCount * sizeof(Packet) - 2 * PAGE_SIZE, "Pages were not filled without padding");
+    ASSERT(W25N04KV_FlushLog() == 0, "Failed to flush log");
+
+    // Headers mark where the first packet of each page starts
+    ASSERT(W25N04KV_ReadPageHeader(page + 1, &header) == 0 && header.layout == LAYOUT_PACKED,
+           "Packed page header not found");
+    ASSERT(header.firstPacket == 7 * sizeof(Packet) - PAGE_SIZE && header.dataEnd == PAGE_SIZE,
+           "Wrong first packet offset in header");
+
+    // Tail is found after the last complete packet
+    buf = (CircularBuffer){0, 0};
+    W25N04KV_FindHeadTail(&buf, pageRange, SCAN_BINARY);
+    ASSERT(buf.head == page * PAGE_SIZE && buf.tail == page * PAGE_SIZE + packetCount * sizeof(Packet),
+           "Wrong head or tail of packed log");
+
+    // Straddling packets are read back whole
+    uint32_t address = buf.head;
+    for (uint8_t i = 0; i < packetCount; i++)
+    {
+        memset(&packet, 0xFF, sizeof(packet));
+        ASSERT(W25N04KV_ReadPackedPacket(&address, pageRange, &packet) == 0, "Failed to read packed packet");
+        ASSERT(packet.dummy == i && packet.pl[sizeof(packet.pl) - 1] == i, "Packed packet read back wrong");
+    }
+    ASSERT(address == buf.tail, "Packets did not end at the tail");
+
+    // Packet ending at the end of the range's last page is followed by the packet at the start of its first page
+    static uint8_t pageData[PAGE_SIZE];
+    uint32_t wrapRange[2] = {page + 4, page + 6};
+    header = (PageHeader){.sequence = 1, .layout = LAYOUT_PACKED, .firstPacket = 0, .packetEnd = sizeof(Packet),
+                          .dataEnd = sizeof(Packet)};
+    memset(pageData, 0xFF, sizeof(pageData));
+    memset(pageData, 1, sizeof(Packet));
+    ASSERT(W25N04KV_WritePackedPage(wrapRange[0], pageData, &header) == 0, "Failed to write first page of range");
+    header = (PageHeader){.sequence = 0, .layout = LAYOUT_PACKED, .firstPacket = PAGE_SIZE - sizeof(Packet),
+                          .packetEnd = PAGE_SIZE, .dataEnd = PAGE_SIZE};
+    memset(pageData, 0, sizeof(pageData));
+    ASSERT(W25N04KV_WritePackedPage(wrapRange[1] - 1, pageData, &header) == 0, "Failed to write last page of range");
+    address = wrapRange[1] * PAGE_SIZE - sizeof(Packet);
+    ASSERT(W25N04KV_ReadPackedPacket(&address, wrapRange, &packet) == 0 && packet.dummy == 0,
+           "Failed to read packet ending the range");
+    ASSERT(address == wrapRange[0] * PAGE_SIZE, "Address after the range's last page did not wrap");
+    ASSERT(W25N04KV_ReadPackedPacket(&address, wrapRange, &packet) == 0 && packet.dummy == 1,
+           "Failed to read packet after wrapping");
+
+    W25N04KV_DiscardWarmLog();
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    if (!error)
+        printf("\r\n[PASSED] Packed log tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure blocks 38 and 39 are good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if records of mixed lengths are appended back to back, found by the head/tail search, and iterated
+void W25N04KV_TestRecordLogCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting variable length records\r\n\n");
+
+    // Data buffers
+    static uint8_t payload[3000];
+    RecordHeader record;
+    uint16_t logBlock = 40;
+    uint32_t page = logBlock * PAGES_PER_BLOCK;
+    uint32_t pageRange[2] = {page, page + 2 * PAGES_PER_BLOCK};
+    uint32_t lengths[] = {5, sizeof(payload), 0, 200}; // Second record runs on into the next page
+    uint8_t recordCount = sizeof(lengths) / sizeof(lengths[0]);
+    uint32_t totalBytes = 0;
+    CircularBuffer buf;
+    bool warm;
+
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+    W25N04KV_DiscardWarmLog();
+    ASSERT(W25N04KV_OpenLog(pageRange, 0, LAYOUT_RECORDS, &warm) == 0, "Failed to open record log writer");
+
+    // Records only take the bytes of their header and payload
+    for (uint8_t i = 0; i < recordCount; i++)
+    {
+        memset(payload, i + 1, lengths[i]);
+        ASSERT(W25N04KV_AppendRecord(i + 1, 0x80 | i, payload, lengths[i]) == 0, "Failed to append record");
+        totalBytes += sizeof(RecordHeader) + lengths[i];
+    }
+    ASSERT(W25N04KV_AppendRecord(0, 0, payload, RECORD_MAX_PAYLOAD + 1) != 0, "Record larger than a block appended");
+    ASSERT(W25N04KV_FlushLog() == 0, "Failed to flush log");
+
+    // Tail is found after the last record
+    buf = (CircularBuffer){0, 0};
+    W25N04KV_FindHeadTail(&buf, pageRange, SCAN_BINARY);
+    ASSERT(buf.head == page * PAGE_SIZE && buf.tail == page * PAGE_SIZE + totalBytes, "Wrong head or tail of records");
+
+    // Records are read back whole, with their payloads checked against their CRCs
+    uint32_t address = buf.head;
+    for (uint8_t i = 0; i < recordCount; i++)
+    {
+        memset(payload, 0, sizeof(payload));
+        ASSERT(W25N04KV_ReadRecord(&address, pageRange, &record, payload, sizeof(payload)) == 0,
+               "Failed to read record");
+        ASSERT(record.type == i + 1 && record.flags == (0x80 | i) && record.length == lengths[i],
+               "Wrong record header read back");
+        ASSERT(lengths[i] == 0 || (payload[0] == i + 1 && payload[lengths[i] - 1] == i + 1),
+               "Wrong record payload read back");
+    }
+    ASSERT(address == buf.tail, "Records did not end at the tail");
+
+    // Headers are iterated alone by skipping the payloads
+    uint8_t iterated = 0;
+    for (address = buf.head; address != buf.tail && iterated <= recordCount; iterated++)
+    {
+        ASSERT(W25N04KV_ReadRecord(&address, pageRange, &record, NULL, 0) == 0, "Failed to skip record payload");
+    }
+    ASSERT(iterated == recordCount, "Wrong number of records iterated");
+
+    // Record longer than two pages fills a page without starting anything. A head found in that page, or a corrupt
+    // length read inside it, moves on to the record after it rather than to the start of the next page
+    static uint8_t longPayload[2 * PAGE_SIZE + 1000];
+    memset(longPayload, 0x5A, sizeof(longPayload));
+    ASSERT(W25N04KV_AppendRecord(9, 0, longPayload, sizeof(longPayload)) == 0, "Failed to append long record");
+    ASSERT(W25N04KV_AppendRecord(10, 0, payload, 5) == 0, "Failed to append record after long record");
+    ASSERT(W25N04KV_FlushLog() == 0, "Failed to flush log");
+    address = buf.tail;
+    ASSERT(W25N04KV_ReadRecord(&address, pageRange, &record, NULL, 0) == 0 && record.type == 9,
+           "Failed to read long record");
+    uint32_t nextRecord = address;
+    uint32_t innerPage = (nextRecord - sizeof(longPayload)) / PAGE_SIZE + 1; // Filled by the long record alone
+    uint32_t innerRange[2] = {innerPage, pageRange[1]};
+    ASSERT(innerPage < nextRecord / PAGE_SIZE, "Long record fills no page");
+    W25N04KV_FindHeadTail(&buf, innerRange, SCAN_LINEAR);
+    ASSERT(buf.head == nextRecord, "Head in a page filled by a long record not moved to the next record");
+    address = innerPage * PAGE_SIZE + 100;
+    ASSERT(W25N04KV_ReadRecord(&address, pageRange, &record, NULL, 0) != 0, "Corrupt record length not caught");
+    ASSERT(address == nextRecord, "Corrupt record length not skipped to the next record");
+    ASSERT(W25N04KV_ReadRecord(&address, pageRange, &record, payload, sizeof(payload)) == 0 && record.type == 10,
+           "Failed to read record after long record");
+
+    W25N04KV_DiscardWarmLog();
+    for (uint16_t block = logBlock; block < logBlock + 2; block++)
+    {
+        W25N04KV_EraseBlock(block);
+        W25N04KV_AwaitNotBusy();
+    }
+
+    if (!error)
+        printf("\r\n[PASSED] Record log tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure blocks 40 and 41 are good\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if logical pages can be rewritten in place through the FTL, and survive a remount
+void W25N04KV_TestFTLCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting the flash translation layer\r\n\n");
+
+    // Data buffers
+    static uint8_t writeData[PAGE_SIZE];
+    static uint8_t readData[PAGE_SIZE];
+    uint32_t logicalPage = 5;
+    FTLStats stats;
+
+    // Every write of a logical page goes to a new physical page
+    memset(writeData, 0xA5, PAGE_SIZE);
+    ASSERT(W25N04KV_FTLWrite(logicalPage, writeData) == 0, "Failed to write logical page");
+    W25N04KV_GetFTLStats(&stats);
+    ASSERT(stats.mappedPages > 0 && stats.activeBlock < DATA_BLOCKS, "Logical page not mapped");
+    memset(writeData, 0x5A, PAGE_SIZE);
+    ASSERT(W25N04KV_FTLWrite(logicalPage, writeData) == 0, "Failed to rewrite logical page");
+    ASSERT(W25N04KV_FTLRead(logicalPage, readData) == 0, "Failed to read logical page");
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Read did not return the newest copy");
+
+    // Map is rebuilt from the checkpoint and the pages of the active block
+    ASSERT(W25N04KV_MountFTL() == 0, "Failed to remount FTL");
+    memset(readData, 0, PAGE_SIZE);
+    ASSERT(W25N04KV_FTLRead(logicalPage, readData) == 0, "Failed to read logical page after remount");
+    ASSERT(memcmp(readData, writeData, PAGE_SIZE) == 0, "Newest copy lost by remount");
+
+    // Filling the active block leaves older copies behind for garbage collection, which keeps the newest copies
+    uint32_t keptPage = logicalPage + 1;
+    uint32_t trimmedPage = logicalPage + 2;
+    ASSERT(W25N04KV_FTLWrite(keptPage, writeData) == 0, "Failed to write kept logical page");
+    ASSERT(W25N04KV_FTLWrite(trimmedPage, writeData) == 0, "Failed to write trimmed logical page");
+    for (int i = 0; i < PAGES_PER_BLOCK && !error; i++)
+    {
+        writeData[0] = i;
+        ASSERT(W25N04KV_FTLWrite(logicalPage, writeData) == 0, "Failed to rewrite logical page to fill the block");
+    }
+    ASSERT(W25N04KV_FTLTrim(trimmedPage) == 0, "Failed to trim logical page before collecting");
+    W25N04KV_GetFTLStats(&stats);
+    uint32_t collections = stats.collections;
+    ASSERT(W25N04KV_FTLCollectGarbage() == 0, "Failed to collect garbage");
+    W25N04KV_GetFTLStats(&stats);
+    ASSERT(stats.collections == collections + 1, "No block reclaimed by garbage collection");
+
+    // Newest copies and the trim survive both the collection and a remount
+    ASSERT(W25N04KV_MountFTL() == 0, "Failed to remount FTL after collecting");
+    ASSERT(W25N04KV_FTLRead(logicalPage, readData) == 0 && memcmp(readData, writeData, PAGE_SIZE) == 0,
+           "Newest copy lost by garbage collection");
+    ASSERT(W25N04KV_FTLRead(keptPage, readData) == 0 && readData[1] == 0x5A, "Kept page lost by garbage collection");
+    ASSERT(W25N04KV_FTLRead(trimmedPage, readData) == 0 && readData[1] == 0xFF, "Trim lost by garbage collection");
+
+    // Checkpoints move to the other block of the pair once one is full, and mount takes the newest of either block
+    int checkpointsPerBlock = PAGES_PER_BLOCK * (PAGE_SIZE / sizeof(uint32_t)) / FTL_LOGICAL_PAGES;
+    for (int i = 0; i <= checkpointsPerBlock; i++)
+    {
+        ASSERT(W25N04KV_FTLCheckpoint() == 0, "Failed to checkpoint map");
+    }
+    ASSERT(W25N04KV_MountFTL() == 0, "Failed to remount FTL after changing checkpoint block");
+    ASSERT(W25N04KV_FTLRead(keptPage, readData) == 0 && readData[1] == 0x5A, "Map lost by changing checkpoint block");
+    W25N04KV_FTLTrim(keptPage);
+
+    // Trimmed pages read as erased
+    ASSERT(W25N04KV_FTLTrim(logicalPage) == 0, "Failed to trim logical page");
+    ASSERT(W25N04KV_FTLRead(logicalPage, readData) == 0, "Failed to read trimmed page");
+    ASSERT(readData[0] == 0xFF && readData[PAGE_SIZE - 1] == 0xFF, "Trimmed page not erased");
+
+    W25N04KV_GetFTLStats(&stats);
+    printf("Mapped pages: %u\r\nBlocks held: %u\r\nActive block: %u\r\n", stats.mappedPages, stats.ownedBlocks,
+           stats.activeBlock);
+    printf("Collections: %u\r\nPages relocated: %u\r\nBlocks leveled: %u\r\n", stats.collections, stats.relocatedPages,
+           stats.leveledBlocks);
+
+    if (!error)
+        printf("\r\n[PASSED] FTL tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure the FTL is mounted\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Print queueing statistics of each class of request served by the flash manager
+void W25N04KV_FlashStatsCmd(void)
+{
+    const char *classNames[FLASH_REQUEST_CLASSES] = {"Read", "Program", "Erase"};
+
+    printf("\r\nClass\t\tDepth\tMax\tServed\tAvg wait\tMax wait\tAvg service\tMax service\r\n");
+    for (int type = 0; type < FLASH_REQUEST_CLASSES; type++)
+    {
+        FlashRequestStats stats;
+        W25N04KV_GetRequestStats(type, &stats);
+        uint32_t avgWait = (stats.served > 0) ? stats.totalWait / stats.served : 0;
+        uint32_t avgService = (stats.served > 0) ? stats.totalService / stats.served : 0;
+        printf("%s\t\t%u\t%u\t%u\t%uus\t\t%uus\t\t%uus\t\t%uus\r\n", classNames[type], stats.depth, stats.maxDepth,
+               stats.served, avgWait, stats.maxWait, avgService, stats.maxService);
+    }
+
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if packets held in a ring buffer can be written without first being copied into a contiguous buffer
+void W25N04KV_TestGatherCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting scatter/gather writes from a ring buffer\r\n\n");
+
+    // Ring holding a packet which wraps around its end, as a producer would leave it
+    static uint8_t ring[512];
+    static uint8_t expected[sizeof(Packet)];
+    static uint8_t readResponse[sizeof(Packet)];
+    uint16_t packetStart = 400;
+    for (uint16_t i = 0; i < sizeof(Packet); i++)
+    {
+        expected[i] = (uint8_t)(i * 7 + 1);
+        ring[(packetStart + i) % sizeof(ring)] = expected[i];
+    }
+
+    // Ring runs are split into segments only when they wrap
+    FlashSegment segments[3];
+    ASSERT(W25N04KV_RingSegments(ring, sizeof(ring), 0, 100, segments) == 1, "Run not wrapping split into segments");
+    ASSERT(W25N04KV_RingSegments(ring, sizeof(ring), 0, 600, segments) == 0, "Run larger than ring accepted");
+    uint8_t segmentCount = W25N04KV_RingSegments(ring, sizeof(ring), packetStart, sizeof(Packet), segments);
+    ASSERT(segmentCount == 2, "Wrapping run not split into 2 segments");
+    ASSERT(segments[0].size == 112 && segments[1].data == ring && segments[1].size == sizeof(Packet) - 112,
+           "Wrapping run split at wrong position");
+
+    // Leave stale bytes in the buffer, then write the wrapped packet and a segment from elsewhere right after it
+    uint8_t trailer[4] = {0x67, 0x61, 0x74, 0x68};
+    uint8_t stale[4] = {0};
+    segments[2] = (FlashSegment){.data = trailer, .size = 4};
+    W25N04KV_QuadWriteBuffer(stale, 4, sizeof(Packet) - 4);
+    ASSERT(W25N04KV_QuadWriteBufferSegments(segments, 3, sizeof(Packet), true) == 0, "Failed to write segments");
+    W25N04KV_FastQuadReadIO(sizeof(Packet), sizeof(Packet), readResponse);
+    ASSERT(memcmp(readResponse, expected, sizeof(Packet)) == 0, "Packet in data buffer does not match ring");
+    W25N04KV_FastQuadReadIO(2 * sizeof(Packet), 4, readResponse);
+    ASSERT(memcmp(readResponse, trailer, 4) == 0, "Segments not written at consecutive column addresses");
+    W25N04KV_FastQuadReadIO(sizeof(Packet) - 4, 4, readResponse);
+    ASSERT(readResponse[0] == 0xFF && readResponse[3] == 0xFF, "Stale bytes kept by a reset write");
+
+    // Patches keep the rest of the buffer
+    ASSERT(W25N04KV_QuadWriteBufferSegments(&segments[2], 1, 0, false) == 0, "Failed to patch buffer");
+    W25N04KV_FastQuadReadIO(sizeof(Packet), sizeof(Packet), readResponse);
+    ASSERT(memcmp(readResponse, expected, sizeof(Packet)) == 0, "Patch reset the rest of the buffer");
+
+    // Segments reach the page once executed
+    W25N04KV_WriteExecute(0);
+    W25N04KV_ReadPage(0);
+    W25N04KV_FastQuadReadIO(sizeof(Packet), sizeof(Packet), readResponse);
+    ASSERT(memcmp(readResponse, expected, sizeof(Packet)) == 0, "Packet in page does not match ring");
+
+    // Erase block where test was conducted to prep for next test
+    W25N04KV_EraseBlock(0);
+
+    if (!error)
+        printf("\r\n[PASSED] Gather tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure block 0 is empty\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Test if bit errors corrected by the on-chip ECC are reported and counted against their block
+void W25N04KV_TestECCCmd(void)
+{
+    W25N04KV_AcquireBus();
+    uint32_t startTime = xTaskGetTickCount();
+    bool error = false; // Set error flag to default
+    printf("\r\nTesting ECC status reporting\r\n\n");
+
+    // Data buffers
+    uint8_t testData[4] = {0xA5, 0x65, 0x63, 0x63};
+    uint8_t flippedByte = 0xA4;
+    uint8_t readResponse[4];
+    FlashECCStatus ecc = ECC_UNCORRECTABLE;
+    BlockECCStats statsBefore, statsAfter;
+
+    // Program page 0 with ECC enabled, so parity is stored in the spare area
+    W25N04KV_EraseBlock(0);
+    W25N04KV_EraseBuffer();
+    W25N04KV_QuadWriteBuffer(testData, 4, 0);
+    W25N04KV_WriteExecute(0);
+    ASSERT(W25N04KV_ReadPageECC(0, &ecc) == 0, "Failed to read page");
+    ASSERT(ecc == ECC_NONE, "Bit errors reported in freshly programmed page");
+
+    // Clear 1 bit of the page with ECC disabled, leaving the parity unchanged
+    uint8_t configRegister = W25N04KV_ReadRegister(2);
+    W25N04KV_WriteRegister(2, configRegister & ~ECC_E_BIT);
+    W25N04KV_EraseBuffer();
+    W25N04KV_QuadWriteBuffer(&flippedByte, 1, 0);
+    W25N04KV_WriteExecute(0);
+    W25N04KV_WriteRegister(2, configRegister);
+    ASSERT((W25N04KV_ReadRegister(2) & ECC_E_BIT) != 0, "ECC not enabled again after bit was cleared");
+
+    // Flipped bit is corrected on the next read, and counted against block 0
+    W25N04KV_GetBlockECCStats(0, &statsBefore);
+    ASSERT(W25N04KV_ReadPageECC(0, &ecc) == 0, "Failed to read page with flipped bit");
+    ASSERT(ecc == ECC_CORRECTED, "Flipped bit not reported as corrected");
+    W25N04KV_FastQuadReadIO(0, 4, readResponse);
+    ASSERT(memcmp(readResponse, testData, 4) == 0, "Data read does not match data programmed before bit flip");
+    W25N04KV_GetBlockECCStats(0, &statsAfter);
+    ASSERT(statsAfter.corrected == statsBefore.corrected + 1, "Corrected read not counted against block");
+    ASSERT(statsAfter.uncorrectable == statsBefore.uncorrectable, "Corrected read counted as uncorrectable");
+
+    // Block with events is ranked among the worst
+    static uint16_t worstBlocks[BLOCK_COUNT];
+    uint16_t found = W25N04KV_GetWorstECCBlocks(worstBlocks, BLOCK_COUNT);
+    bool ranked = false;
+    for (uint16_t i = 0; i < found; i++)
+    {
+        ranked |= (worstBlocks[i] == 0);
+    }
+    ASSERT(ranked, "Block with corrected reads missing from worst blocks");
+    uint16_t worstBlock;
+    ASSERT(W25N04KV_GetWorstECCBlocks(&worstBlock, 1) == found, "Blocks not counted once the list is full");
+
+    // Erase block where test was conducted to prep for next test
+    W25N04KV_EraseBlock(0);
+
+    if (!error)
+        printf("\r\n[PASSED] ECC tests completed successfully\r\n");
+    else
+        printf("\r\n[FAILED] Some tests failed, ensure block 0 is empty\r\n");
+    printf("Time taken: %ums\r\n", xTaskGetTickCount() - startTime);
+    W25N04KV_ReleaseBus();
+    osThreadExit(); // Safely exit thread
+}
+
+// Print the blocks with the most ECC events since boot
+void W25N04KV_ECCStatsCmd(void)
+{
+    uint16_t worstBlocks[ECC_WORST_BLOCKS];
+    uint16_t found = W25N04KV_GetWorstECCBlocks(worstBlocks, ECC_WORST_BLOCKS);
+    if (found == 0)
+    {
+        printf("\r\nNo ECC events since boot\r\n");
+        osThreadExit(); // Safely exit thread
+    }
+
+    printf("\r\nBlock\tCorrected\tUncorrectable\tState\r\n");
+    for (uint16_t i = 0; i < found && i < ECC_WORST_BLOCKS; i++)
+    {
+        BlockECCStats stats;
+        W25N04KV_GetBlockECCStats(worstBlocks[i], &stats);
+        printf("%u\t%u\t\t%u\t\t%s\r\n", worstBlocks[i], stats.corrected, stats.uncorrectable,
+               W25N04KV_IsBadBlock(worstBlocks[i]) ? "Bad" : "Good");
+    }
+    printf("Blocks with ECC events: %u\r\n", found);
+
+    osThreadExit(); // Safely exit thread
+}
+
+// Print every block marked bad in the bad block table
+void W25N04KV_BadBlocksCmd(void)
+{
+    printf("\r\nBad blocks: %u of %u\r\n", W25N04KV_GetBadBlockCount(), BLOCK_COUNT);
+    for (uint16_t block = 0; block < BLOCK_COUNT; block++)
+    {
+        if (W25N04KV_IsBadBlock(block))
+            printf("Block %u (pages %u to %u)\r\n", block, block * PAGES_PER_BLOCK,
+                   (block + 1) * PAGES_PER_BLOCK - 1);
+    }
+
+    osThreadExit(); // Safely exit thread
+}
+
+// Print the spread of erase counts across the good data blocks
+void W25N04KV_WearStatsCmd(void)
+{
+    WearStats stats;
+    W25N04KV_GetWearStats(&stats);
+    if (stats.blocks == 0)
+    {
+        printf("\r\nNo good data blocks\r\n");
+        osThreadExit(); // Safely exit thread
+    }
+
+    // Mean is printed to 2 decimal places without floating point
+    uint32_t meanHundredths = (uint32_t)(((uint64_t)stats.totalErases * 100) / stats.blocks);
+    printf("\r\nP/E cycles across %u good data blocks\r\n", stats.blocks);
+    printf("Min: %u (block %u)\r\n", stats.minErases, stats.minBlock);
+    printf("Max: %u (block %u)\r\n", stats.maxErases, stats.maxBlock);
+    printf("Mean: %u.%02u\r\n", meanHundredths / 100, meanHundredths % 100);
+
+    osThreadExit(); // Safely exit thread
+}
+
+// Print every entry of the on-chip bad block management look-up table
+void W25N04KV_BBMLUTCmd(void)
+{
+    W25N04KV_AcquireBus();
+    BBMEntry entries[BBM_LUT_ENTRIES];
+    if (W25N04KV_ReadBBMLUT(entries) != 0)
+    {
+        printf("Failed to read BBM look-up table\r\n");
+        W25N04KV_ReleaseBus();
+        osThreadExit(); // Safely exit thread
+    }
+
+    printf("\r\nEntry\tLogical\tPhysical\tState\r\n");
+    int freeEntries = 0;
+    for (int i = 0; i < BBM_LUT_ENTRIES; i++)
+    {
+        if (!entries[i].enabled)
+        {
+            freeEntries++;
+            continue;
+        }
+        printf("%d\t%u\t%u\t\t%s\r\n", i, entries[i].logicalBlock, entries[i].physicalBlock,
+               entries[i].invalid ? "Invalid" : "Active");
+    }
+    printf("Free entries: %d of %d\r\n", freeEntries, BBM_LUT_ENTRIES);
+
+    W25N04KV_ReleaseBus();
     osThreadExit(); // Safely exit thread
 }